@@ -0,0 +1,190 @@
+#include "latency_harness.h"
+
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+
+LatencyHarness::LatencyHarness(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private) :
+  nh_(nh), nh_private_(nh_private), sim_(NULL), running_(false)
+{
+  const char* topics[STREAM_COUNT] = { "imu", "ins", "mag", "baro" };
+  const uint32_t dids[STREAM_COUNT] = { DID_DUAL_IMU, DID_INS_2, DID_MAGNETOMETER_1, DID_BAROMETER };
+  for (int i = 0; i < STREAM_COUNT; i++)
+  {
+    streams_[i].topic = topics[i];
+    streams_[i].did = dids[i];
+    for (int j = 0; j < LATENCY_SEQ_WINDOW; j++)
+    {
+      streams_[i].sent_seq[j] = UINT32_MAX;
+      streams_[i].sent_ns[j] = 0;
+    }
+    streams_[i].sent = 0;
+    streams_[i].received = 0;
+    streams_[i].unmatched = 0;
+  }
+
+  UINSSimulator::options_t options;
+  nh_private_.param<std::string>("port", options.link, "/tmp/ttyUINS_latency");
+  nh_private_.param<int>("baudrate", options.baudrate, 3000000);
+  nh_private_.param<double>("imu_hz", options.imu_hz, 0.0);
+  nh_private_.param<double>("ins_hz", options.ins_hz, 0.0);
+  nh_private_.param<double>("mag_hz", options.mag_hz, 0.0);
+  nh_private_.param<double>("baro_hz", options.baro_hz, 0.0);
+  nh_private_.param<std::string>("label", label_, "default");
+  nh_private_.param<std::string>("output_file", output_file_, "");
+  double report_period = nh_private_.param<double>("report_period", 10.0);
+  bool tcp_nodelay = nh_private_.param<bool>("tcp_nodelay", true);
+
+  sim_ = new UINSSimulator(options);
+  sim_->set_payload_hook(std::bind(&LatencyHarness::stamp_payload, this, std::placeholders::_1,
+                                   std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+  sim_->set_written_hook(std::bind(&LatencyHarness::frame_written, this, std::placeholders::_1, std::placeholders::_2));
+  if (!sim_->open())
+  {
+    ROS_FATAL("latency_harness: unable to start simulator on \"%s\"", options.link.c_str());
+    return;
+  }
+  ROS_INFO("latency_harness: simulating uINS on \"%s\" -> \"%s\"", options.link.c_str(), sim_->port().c_str());
+
+  ros::TransportHints hints;
+  if (tcp_nodelay)
+    hints.tcpNoDelay();
+  subs_.push_back(nh_.subscribe("imu", 1000, &LatencyHarness::imu_callback, this, hints));
+  subs_.push_back(nh_.subscribe("ins", 1000, &LatencyHarness::ins_callback, this, hints));
+  subs_.push_back(nh_.subscribe("mag", 1000, &LatencyHarness::mag_callback, this, hints));
+  subs_.push_back(nh_.subscribe("baro", 1000, &LatencyHarness::baro_callback, this, hints));
+  report_timer_ = nh_.createWallTimer(ros::WallDuration(report_period), &LatencyHarness::report_timer_callback, this);
+
+  running_ = true;
+  thread_ = std::thread(&LatencyHarness::sim_thread, this);
+}
+
+LatencyHarness::~LatencyHarness()
+{
+  running_ = false;
+  if (thread_.joinable())
+    thread_.join();
+  delete sim_;
+}
+
+uint64_t LatencyHarness::now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void LatencyHarness::sim_thread()
+{
+  while (running_)
+    sim_->spin_once(1);
+}
+
+// Sequence numbers go in a field the node copies straight into the published message
+void LatencyHarness::stamp_payload(uint32_t did, uint32_t seq, void* data, uint32_t size)
+{
+  (void)size;
+  float value = (float)(seq & LATENCY_SEQ_MASK);
+  switch (did)
+  {
+  case DID_DUAL_IMU:       ((dual_imu_t*)data)->I[0].acc[0] = value; break;
+  case DID_INS_2:          ((ins_2_t*)data)->uvw[0] = value; break;
+  case DID_MAGNETOMETER_1: ((magnetometer_t*)data)->mag[0] = value; break;
+  case DID_BAROMETER:      ((barometer_t*)data)->bar = value; break;
+  default: break;
+  }
+}
+
+void LatencyHarness::frame_written(uint32_t did, uint32_t seq)
+{
+  uint64_t t = now_ns();
+  for (int i = 0; i < STREAM_COUNT; i++)
+  {
+    if (streams_[i].did != did)
+      continue;
+    uint32_t slot = (seq & LATENCY_SEQ_MASK) % LATENCY_SEQ_WINDOW;
+    streams_[i].sent_ns[slot].store(t, std::memory_order_relaxed);
+    streams_[i].sent_seq[slot].store(seq & LATENCY_SEQ_MASK, std::memory_order_release);
+    streams_[i].sent++;
+  }
+}
+
+void LatencyHarness::record(stream_id_t id, double value)
+{
+  uint64_t t = now_ns();
+  std::lock_guard<std::mutex> lock(mutex_);
+  stream_latency_t& s = streams_[id];
+  uint32_t seq = (uint32_t)value;
+  uint32_t slot = seq % LATENCY_SEQ_WINDOW;
+  s.received++;
+  if (s.sent_seq[slot].load(std::memory_order_acquire) != seq)
+  {
+    s.unmatched++;
+    return;
+  }
+  uint64_t sent = s.sent_ns[slot].load(std::memory_order_relaxed);
+  s.latency_us.push_back((t - sent) * 1e-3);
+}
+
+void LatencyHarness::imu_callback(const sensor_msgs::Imu::ConstPtr& msg)
+{
+  record(STREAM_IMU, msg->linear_acceleration.x);
+}
+
+void LatencyHarness::ins_callback(const nav_msgs::Odometry::ConstPtr& msg)
+{
+  record(STREAM_INS, msg->twist.twist.linear.x);
+}
+
+void LatencyHarness::mag_callback(const sensor_msgs::MagneticField::ConstPtr& msg)
+{
+  record(STREAM_MAG, msg->magnetic_field.x);
+}
+
+void LatencyHarness::baro_callback(const sensor_msgs::FluidPressure::ConstPtr& msg)
+{
+  record(STREAM_BARO, msg->fluid_pressure);
+}
+
+void LatencyHarness::report_timer_callback(const ros::WallTimerEvent& event)
+{
+  (void)event;
+  report(false);
+}
+
+void LatencyHarness::report(bool final)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ofstream csv;
+  if (final && !output_file_.empty())
+  {
+    csv.open(output_file_.c_str(), std::ios::app);
+    if (!csv)
+      ROS_ERROR("latency_harness: unable to open \"%s\"", output_file_.c_str());
+  }
+
+  ROS_INFO("latency [%s] %-5s %9s %9s %9s %9s %9s %9s %9s", label_.c_str(), "topic", "sent", "received",
+           "unmatched", "p50 us", "p99 us", "p99.9 us", "max us");
+  for (int i = 0; i < STREAM_COUNT; i++)
+  {
+    stream_latency_t& s = streams_[i];
+    if (s.received == 0)
+      continue;
+    std::vector<double> sorted(s.latency_us);
+    std::sort(sorted.begin(), sorted.end());
+    double p[4] = { 0, 0, 0, 0 };
+    if (!sorted.empty())
+    {
+      p[0] = sorted[(size_t)(0.5 * (sorted.size() - 1))];
+      p[1] = sorted[(size_t)(0.99 * (sorted.size() - 1))];
+      p[2] = sorted[(size_t)(0.999 * (sorted.size() - 1))];
+      p[3] = sorted.back();
+    }
+    ROS_INFO("latency [%s] %-5s %9llu %9llu %9llu %9.1f %9.1f %9.1f %9.1f", label_.c_str(), s.topic,
+             (unsigned long long)s.sent.load(), (unsigned long long)s.received, (unsigned long long)s.unmatched,
+             p[0], p[1], p[2], p[3]);
+    if (csv.is_open())
+      csv << label_ << "," << s.topic << "," << s.sent.load() << "," << s.received << "," << s.unmatched << ","
+          << p[0] << "," << p[1] << "," << p[2] << "," << p[3] << "\n";
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef LATENCY_HARNESS_H
+#define LATENCY_HARNESS_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ros/ros.h"
+#include "sensor_msgs/Imu.h"
+#include "sensor_msgs/MagneticField.h"
+#include "sensor_msgs/FluidPressure.h"
+#include "nav_msgs/Odometry.h"
+
+#include "uins_simulator.h"
+
+#define LATENCY_SEQ_WINDOW 65536
+#define LATENCY_SEQ_MASK 0xFFFFFF // sequence numbers ride in a float, which is exact up to 2^24
+
+/**
+ * @brief Measures UART-to-subscriber latency of the node
+ *
+ * Runs a uINS simulator on a pty, stamps a sequence number into each frame,
+ * records when the frame's last byte was written and subscribes to the node's
+ * output topics to find out when the matching message arrives.
+ */
+class LatencyHarness
+{
+public:
+  LatencyHarness(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private);
+  ~LatencyHarness();
+
+  void report(bool final);
+
+private:
+  typedef enum
+  {
+    STREAM_IMU,
+    STREAM_INS,
+    STREAM_MAG,
+    STREAM_BARO,
+    STREAM_COUNT
+  } stream_id_t;
+
+  typedef struct
+  {
+    const char* topic;
+    uint32_t did;
+    std::atomic<uint32_t> sent_seq[LATENCY_SEQ_WINDOW];
+    std::atomic<uint64_t> sent_ns[LATENCY_SEQ_WINDOW];
+    std::atomic<uint64_t> sent;
+    std::vector<double> latency_us;
+    uint64_t received;
+    uint64_t unmatched;
+  } stream_latency_t;
+
+  void stamp_payload(uint32_t did, uint32_t seq, void* data, uint32_t size);
+  void frame_written(uint32_t did, uint32_t seq);
+  void record(stream_id_t id, double value);
+  void sim_thread();
+
+  void imu_callback(const sensor_msgs::Imu::ConstPtr& msg);
+  void ins_callback(const nav_msgs::Odometry::ConstPtr& msg);
+  void mag_callback(const sensor_msgs::MagneticField::ConstPtr& msg);
+  void baro_callback(const sensor_msgs::FluidPressure::ConstPtr& msg);
+  void report_timer_callback(const ros::WallTimerEvent& event);
+
+  static uint64_t now_ns();
+
+  ros::NodeHandle nh_;
+  ros::NodeHandle nh_private_;
+  std::vector<ros::Subscriber> subs_;
+  ros::WallTimer report_timer_;
+
+  std::string label_;
+  std::string output_file_;
+  UINSSimulator* sim_;
+  std::thread thread_;
+  std::atomic<bool> running_;
+  std::mutex mutex_; // subscriber callbacks and reports may run on different manager threads
+  stream_latency_t streams_[STREAM_COUNT];
+};
+
+#endif // LATENCY_HARNESS_H
@@ -0,0 +1,11 @@
+#include "latency_harness.h"
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "latency_harness");
+  ros::NodeHandle nh, nh_private("~");
+  LatencyHarness harness(nh, nh_private);
+  ros::spin();
+  harness.report(true);
+  return 0;
+}
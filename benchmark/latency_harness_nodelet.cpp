@@ -0,0 +1,34 @@
+#include "latency_harness.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace inertial_sense
+{
+
+/**
+ * @brief Latency harness loaded into the same manager as the driver nodelet,
+ * so the measured path includes intra-process delivery instead of TCPROS
+ */
+class LatencyHarnessNodelet : public nodelet::Nodelet
+{
+public:
+  ~LatencyHarnessNodelet()
+  {
+    if (harness_)
+      harness_->report(true);
+  }
+
+private:
+  virtual void onInit()
+  {
+    harness_.reset(new LatencyHarness(getNodeHandle(), getPrivateNodeHandle()));
+  }
+
+  boost::scoped_ptr<LatencyHarness> harness_;
+};
+
+} // namespace inertial_sense
+
+PLUGINLIB_EXPORT_CLASS(inertial_sense::LatencyHarnessNodelet, nodelet::Nodelet)
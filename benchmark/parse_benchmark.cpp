@@ -0,0 +1,334 @@
+/**
+ * Parser and dispatch microbenchmarks
+ *
+ * Feeds synthetic uINS byte streams through is_comm_parse() alone and through
+ * InertialSenseROS::parse_bytes() (dispatch + message conversion, publishers
+ * not advertised) and reports ns/byte, ns/frame per DID, heap allocations and
+ * cache misses.  A corrupted-stream scenario exercises the bad-data path, and
+ * the "traced" rows repeat the node run with stage tracing enabled, and the
+ * "health" rows with the IMU health monitor running on every DID_DUAL_IMU, and the
+ * "frames" rows converting every INS solution to all the geodetic frames.
+ */
+
+#include "inertial_sense.h"
+#include "uins_simulator.h"
+
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <chrono>
+#include <new>
+#include <random>
+
+static uint64_t g_allocs = 0;
+
+void* operator new(size_t size)
+{
+  g_allocs++;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+// Hardware cache miss counter for the calling thread, if the kernel allows it
+class CacheMissCounter
+{
+public:
+  CacheMissCounter()
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~CacheMissCounter() { if (fd_ >= 0) close(fd_); }
+  bool valid() const { return fd_ >= 0; }
+  void start() { if (fd_ >= 0) { ioctl(fd_, PERF_EVENT_IOC_RESET, 0); ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0); } }
+  uint64_t stop()
+  {
+    uint64_t count = 0;
+    if (fd_ >= 0)
+    {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd_, &count, sizeof(count)) != sizeof(count))
+        count = 0;
+    }
+    return count;
+  }
+private:
+  int fd_;
+};
+
+typedef struct
+{
+  std::string name;
+  std::vector<uint8_t> bytes;
+} scenario_t;
+
+typedef struct
+{
+  double ns;
+  uint64_t allocs;
+  uint64_t cache_misses;
+  uint64_t frames;
+  uint64_t bad;
+} result_t;
+
+static const struct { uint32_t did; const char* name; } g_dids[] = {
+  { DID_INS_1, "INS_1" },
+  { DID_INS_2, "INS_2" },
+  { DID_INL2_VARIANCE, "INL2_VARIANCE" },
+  { DID_DUAL_IMU, "DUAL_IMU" },
+  { DID_PREINTEGRATED_IMU, "PREINTEGRATED_IMU" },
+  { DID_GPS_NAV, "GPS_NAV" },
+  { DID_GPS1_SAT, "GPS1_SAT" },
+  { DID_MAGNETOMETER_1, "MAGNETOMETER_1" },
+  { DID_BAROMETER, "BAROMETER" },
+  { DID_STROBE_IN_TIME, "STROBE_IN_TIME" },
+};
+
+static void append_frame(UINSSimulator& sim, std::vector<uint8_t>& out, uint32_t did, double t, uint8_t& counter)
+{
+  uint8_t sample[PKT_BUF_SIZE];
+  uint8_t frame[2 * PKT_BUF_SIZE];
+  uint32_t size = sim.synthesize(did, t, sample);
+  int n = UINSSimulator::encode_data(did, sample, size, 0, counter++, frame, sizeof(frame));
+  out.insert(out.end(), frame, frame + n);
+}
+
+// The stream test.launch asks for at a 10 ms navigation period
+static scenario_t build_mix(UINSSimulator& sim, double seconds, double error_rate)
+{
+  scenario_t s;
+  s.name = (error_rate > 0) ? "corrupted mix" : "realistic mix";
+  uint8_t counter = 0;
+  int steps = (int)(seconds / 0.01);
+  for (int k = 0; k < steps; k++)
+  {
+    double t = k * 0.01;
+    append_frame(sim, s.bytes, DID_DUAL_IMU, t, counter);
+    append_frame(sim, s.bytes, DID_INS_1, t, counter);
+    append_frame(sim, s.bytes, DID_INS_2, t, counter);
+    if (k % 2 == 0)
+    {
+      append_frame(sim, s.bytes, DID_MAGNETOMETER_1, t, counter);
+      append_frame(sim, s.bytes, DID_BAROMETER, t, counter);
+    }
+    if (k % 10 == 0)
+      append_frame(sim, s.bytes, DID_INL2_VARIANCE, t, counter);
+    if (k % 20 == 0)
+      append_frame(sim, s.bytes, DID_GPS_NAV, t, counter);
+    if (k % 100 == 0)
+    {
+      append_frame(sim, s.bytes, DID_GPS1_SAT, t, counter);
+      append_frame(sim, s.bytes, DID_STROBE_IN_TIME, t, counter);
+    }
+  }
+
+  if (error_rate > 0)
+  {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (size_t i = 0; i < s.bytes.size(); i++)
+    {
+      if (uniform(rng) < error_rate)
+        s.bytes[i] ^= (uint8_t)(1 << (rng() % 8));
+    }
+  }
+  return s;
+}
+
+static scenario_t build_single(UINSSimulator& sim, uint32_t did, const char* name, int frames)
+{
+  scenario_t s;
+  s.name = name;
+  uint8_t counter = 0;
+  for (int k = 0; k < frames; k++)
+    append_frame(sim, s.bytes, did, k * 0.01, counter);
+  return s;
+}
+
+static result_t run_parser(const scenario_t& s, int repeat, CacheMissCounter& cache)
+{
+  result_t best = { 1e300, 0, 0, 0, 0 };
+  uint8_t buffer[BUFFER_SIZE];
+  for (int r = 0; r < repeat; r++)
+  {
+    is_comm_instance_t comm;
+    comm.buffer = buffer;
+    comm.bufferSize = sizeof(buffer);
+    is_comm_init(&comm);
+
+    result_t res = { 0, 0, 0, 0, 0 };
+    uint64_t allocs = g_allocs;
+    cache.start();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < s.bytes.size(); i++)
+    {
+      uint32_t did = is_comm_parse(&comm, s.bytes[i]);
+      if (did == (uint32_t)-1)
+        res.bad++;
+      else if (did != DID_NULL)
+        res.frames++;
+    }
+    res.ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    res.cache_misses = cache.stop();
+    res.allocs = g_allocs - allocs;
+    if (res.ns < best.ns)
+      best = res;
+  }
+  return best;
+}
+
+static result_t run_node(InertialSenseROS& node, const scenario_t& s, int repeat, CacheMissCounter& cache, uint64_t frames)
+{
+  result_t best = { 1e300, 0, 0, frames, 0 };
+
+  // The parser logs through rosconsole: bad-frame warnings (ROS_WARN_THROTTLE) go to stderr and
+  // unhandled messages (ROS_INFO) to stdout.  Send both to /dev/null so they are paid for but
+  // don't clutter the report
+  fflush(stdout);
+  fflush(stderr);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int saved_stderr = dup(STDERR_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, STDOUT_FILENO);
+  dup2(devnull, STDERR_FILENO);
+
+  for (int r = 0; r < repeat; r++)
+  {
+    uint64_t allocs = g_allocs;
+    cache.start();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // Hand the node the same 512 byte reads update() does
+    for (size_t i = 0; i < s.bytes.size(); i += 512)
+      node.parse_bytes(s.bytes.data() + i, std::min<size_t>(512, s.bytes.size() - i));
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    uint64_t misses = cache.stop();
+    if (ns < best.ns)
+    {
+      best.ns = ns;
+      best.cache_misses = misses;
+      best.allocs = g_allocs - allocs;
+    }
+  }
+
+  std::cout.flush();
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_stdout, STDOUT_FILENO);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stdout);
+  close(saved_stderr);
+  close(devnull);
+  return best;
+}
+
+static void print_header(bool have_cache)
+{
+  printf("%-22s %-6s %10s %8s %9s %10s %12s %12s %8s\n", "scenario", "stage", "bytes", "frames",
+         "ns/byte", "ns/frame", "allocs/frame", have_cache ? "misses/frame" : "misses", "bad");
+}
+
+static void print_result(const std::string& name, const char* stage, size_t bytes, const result_t& r, bool have_cache)
+{
+  double frames = (double)r.frames;
+  char per_frame[32], allocs[32], misses[32];
+  snprintf(per_frame, sizeof(per_frame), r.frames ? "%.1f" : "-", r.ns / frames);
+  snprintf(allocs, sizeof(allocs), r.frames ? "%.3f" : "-", r.allocs / frames);
+  if (have_cache)
+    snprintf(misses, sizeof(misses), r.frames ? "%.2f" : "-", r.cache_misses / frames);
+  else
+    snprintf(misses, sizeof(misses), "n/a");
+  printf("%-22s %-6s %10zu %8llu %9.2f %10s %12s %12s %8llu\n", name.c_str(), stage, bytes,
+         (unsigned long long)r.frames, r.ns / bytes, per_frame, allocs, misses,
+         (unsigned long long)r.bad);
+}
+
+int main(int argc, char** argv)
+{
+  double seconds = 60.0;
+  double error_rate = 1e-4;
+  int repeat = 5;
+  int frames_per_did = 20000;
+
+  static struct option long_options[] = {
+    { "seconds", required_argument, 0, 's' },
+    { "error-rate", required_argument, 0, 'e' },
+    { "repeat", required_argument, 0, 'r' },
+    { "frames", required_argument, 0, 'f' },
+    { 0, 0, 0, 0 }
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "s:e:r:f:", long_options, NULL)) != -1)
+  {
+    switch (c)
+    {
+    case 's': seconds = atof(optarg); break;
+    case 'e': error_rate = atof(optarg); break;
+    case 'r': repeat = std::max(1, atoi(optarg)); break;
+    case 'f': frames_per_did = std::max(1, atoi(optarg)); break;
+    default:
+      printf("Usage: %s [--seconds S] [--error-rate P] [--repeat N] [--frames N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  ros::init(argc, argv, "parse_benchmark", ros::init_options::AnonymousName | ros::init_options::NoRosout);
+  InertialSenseROS node(false);
+  InertialSenseROS traced_node(false);
+  traced_node.enable_tracing(FrameTracer::options_t());
+  InertialSenseROS health_node(false);
+  health_node.enable_imu_health(ImuHealth::options_t());
+  InertialSenseROS frames_node(false);
+  frames_node.enable_frames({ "ned", "enu", "ecef", "utm" }, "ned");
+  const double ref_lla[3] = { 40.25, -111.67, 1556.59 }; // the simulator's
+  frames_node.set_frames_reference(ref_lla);
+  UINSSimulator::options_t options;
+  UINSSimulator sim(options);
+  CacheMissCounter cache;
+
+  std::vector<scenario_t> scenarios;
+  scenarios.push_back(build_mix(sim, seconds, 0));
+  scenarios.push_back(build_mix(sim, seconds, error_rate));
+  for (size_t i = 0; i < sizeof(g_dids) / sizeof(g_dids[0]); i++)
+    scenarios.push_back(build_single(sim, g_dids[i].did, g_dids[i].name, frames_per_did));
+
+  printf("best of %d runs, %.0f s of simulated traffic, corrupted byte rate %g\n\n", repeat, seconds, error_rate);
+  print_header(cache.valid());
+  for (size_t i = 0; i < scenarios.size(); i++)
+  {
+    const scenario_t& s = scenarios[i];
+    result_t parse = run_parser(s, repeat, cache);
+    result_t full = run_node(node, s, repeat, cache, parse.frames);
+    result_t traced = run_node(traced_node, s, repeat, cache, parse.frames);
+    result_t health = run_node(health_node, s, repeat, cache, parse.frames);
+    result_t frames = run_node(frames_node, s, repeat, cache, parse.frames);
+    full.bad = traced.bad = health.bad = frames.bad = parse.bad;
+    print_result(s.name, "parse", s.bytes.size(), parse, cache.valid());
+    print_result(s.name, "node", s.bytes.size(), full, cache.valid());
+    print_result(s.name, "traced", s.bytes.size(), traced, cache.valid());
+    print_result(s.name, "health", s.bytes.size(), health, cache.valid());
+    print_result(s.name, "frames", s.bytes.size(), frames, cache.valid());
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef ALLAN_VARIANCE_H
+#define ALLAN_VARIANCE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "data_sets.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief Overlapping Allan variance of several channels, one sample at a time in bounded memory
+ *
+ * Cluster sizes are octave spaced, m = 1, 2, 4...  For each one the engine
+ * keeps the running integral of every channel (minus an offset, which the
+ * variance doesn't depend on) at a stride of m / overlap samples, 2 * overlap + 1
+ * values deep, and sums the squared second differences
+ * (theta[k + 2m] - 2 theta[k + m] + theta[k])^2 for every k on that stride.
+ * Up to overlap clusters are fully overlapping, past that a cluster starts
+ * every m / overlap samples, which gives nearly the same confidence for a
+ * fraction of the memory and work.  Memory is levels * (2 * overlap + 1) doubles
+ * per channel, however long it runs.
+ *
+ * Channels are stored next to each other (structure of arrays by level and
+ * slot) so every update is one pass over the channels.
+ *
+ * For splitting a long record into time ranges, set_window() limits the
+ * clusters counted to those starting in a range of sample indices.  Engines
+ * fed overlapping stretches of the same record with disjoint windows can then
+ * be merge()d into exactly what one engine would have computed.
+ */
+class AllanVariance
+{
+public:
+  typedef struct
+  {
+    double tau;      // seconds
+    double adev;     // Allan deviation, in the units of the samples
+    double clusters; // independent (non overlapping) clusters the estimate comes from
+  } point_t;
+
+  typedef struct
+  {
+    bool valid;
+    double white_noise;    // ARW (rad/s/sqrt(Hz) = rad/sqrt(s)) for a gyro, VRW for an accelerometer
+    double bias_instability;
+    double bias_instability_tau;
+    double random_walk;    // RRW (rad/s/sqrt(s)) for a gyro, AcRW for an accelerometer, 0 if not reached
+  } noise_t;
+
+  // A dual_imu_t as channels: IMU1 gyro x, y, z and accelerometer x, y, z, then IMU2
+  static const int DUAL_IMU_CHANNELS = 12;
+  static void dual_imu_sample(const dual_imu_t& imu, float* sample);
+  static std::vector<std::string> dual_imu_names();
+
+  /**
+   * @param overlap - clusters started per cluster length, rounded to a power of two
+   * @param levels - cluster sizes from 1 to 2^(levels - 1) samples
+   */
+  AllanVariance(int channels, int overlap = 64, int levels = 32);
+
+  /**
+   * @brief reset
+   * Forget everything and start at sample index first
+   */
+  void reset(uint64_t first = 0);
+  // Only count clusters that start at [from, until)
+  void set_window(uint64_t from, uint64_t until);
+  // Subtracted from every sample, the first sample if not set
+  void set_offset(const float* offset);
+
+  void push(const float* sample);
+  // After the last sample, so the clusters ending there are counted too
+  void finish();
+
+  int channels() const { return channels_; }
+  int levels() const { return levels_; }
+  uint64_t samples() const { return n_ - first_; }
+  // Cluster size of level
+  uint64_t cluster(int level) const { return uint64_t(1) << level; }
+
+  // Add the sums of an engine with the same channels, overlap and levels
+  void merge(const AllanVariance& other);
+
+  /**
+   * @brief curve
+   * @param dt - sample period in seconds
+   * @param points - one per cluster size with at least one cluster
+   */
+  void curve(int channel, double dt, std::vector<point_t>& points) const;
+
+  /**
+   * @brief fit
+   * Read the noise terms off a curve: white noise on the -1/2 slope at tau = 1 s, bias
+   * instability at the minimum (divided by 0.664), random walk on the +1/2 slope at
+   * tau = 3 s.  Points from fewer than 8 independent clusters are left out
+   */
+  static noise_t fit(const std::vector<point_t>& points);
+
+  // Write curves and fits as CSV, one row per channel and cluster size
+  static void write_csv(FILE* file, const std::vector<std::string>& names,
+                        const std::vector<std::vector<point_t> >& curves, const std::vector<noise_t>& noise);
+
+  /**
+   * @brief fill_diagnostics
+   * Append a status with each channel's fit
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id,
+                        const std::vector<std::string>& names, double dt) const;
+
+private:
+  void store(uint64_t index);
+
+  int channels_;
+  int overlap_;
+  int levels_;
+
+  uint64_t first_;
+  uint64_t n_; // index of the next sample
+  uint64_t from_;
+  uint64_t until_;
+  bool offset_set_;
+
+  std::vector<double> offset_;
+  std::vector<double> theta_; // per channel, integral of the samples before n_
+
+  // Per level: slots of theta, channels_ values each
+  std::vector<std::vector<double> > ring_;
+  std::vector<int> head_;     // next slot to write
+  std::vector<int> filled_;
+  std::vector<double> sum_;   // level * channels_
+  std::vector<uint64_t> count_;
+};
+
+#endif // ALLAN_VARIANCE_H
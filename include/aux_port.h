@@ -0,0 +1,108 @@
+#ifndef AUX_PORT_H
+#define AUX_PORT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ISComm.h"
+#include "serialPort.h"
+#include "stream_stats.h"
+#include "realtime.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief Second serial link to the uINS (its other UART)
+ *
+ * The port is read and parsed on its own thread so it runs in parallel with
+ * the main link.  Decoded frames are copied into a fixed single-producer,
+ * single-consumer queue and handed to the read loop, which interleaves them
+ * with the main link's frames by device time (see InertialSenseROS::merge_port2).
+ * If the read loop falls behind the newest frames are dropped and counted.
+ * A port that hangs up (a USB adapter unplugged) is closed and reopened.
+ */
+class AuxPort
+{
+public:
+  typedef std::chrono::steady_clock steady_clock_t;
+
+  typedef struct
+  {
+    uint32_t did;
+    steady_clock_t::time_point arrival;
+    const uint8_t* data;
+  } frame_t;
+
+  /**
+   * @param buffer_size - largest payload parsed, same as the main link's buffer
+   * @param queue_frames - frames held for the read loop
+   */
+  AuxPort(size_t buffer_size, size_t queue_frames = 64);
+  ~AuxPort();
+
+  /**
+   * @brief open
+   * @param port - device path or tcp:// / udp:// url, as for ~port
+   * @return false (after logging why) if the port couldn't be opened
+   */
+  bool open(const std::string& port, int baudrate);
+  serial_port_t* port() { return &serial_; }
+  const std::string& name() const { return name_; }
+
+  /**
+   * @brief start
+   * Start reading once the uINS is configured.  Writes to port() must stop here
+   * @param rt - real-time setup for the reader thread, NULL to leave it as created
+   * @param stack_bytes - stack to fault in when rt is set
+   */
+  void start(const RealTime::thread_options_t* rt = NULL, size_t stack_bytes = 0);
+
+  // Read loop side: oldest undelivered frame, or NULL
+  const frame_t* front() const;
+  void pop();
+  void count_late() { late_.store(late_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+  StreamStats& stats() { return stats_; }
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, double wakeup_warn_us);
+
+private:
+  void read_loop();
+  void push(uint32_t did);
+  // Close the port if it hung up or failed, true if it did
+  bool check_port();
+  // Open it again, at most once a second
+  bool reopen();
+
+  std::string name_;
+  serial_port_t serial_;
+  is_comm_instance_t comm_;
+  std::vector<uint8_t> buffer_; // parse buffer
+  uint32_t frame_bytes_;
+  StreamStats stats_;
+
+  std::vector<uint8_t> storage_;
+  std::vector<frame_t> frames_;
+  std::atomic<size_t> head_; // next frame to deliver, read loop
+  std::atomic<size_t> tail_; // next free slot, reader thread
+
+  std::atomic<bool> running_;
+  std::thread thread_;
+  bool rt_;
+  RealTime::thread_options_t rt_options_;
+  size_t rt_stack_bytes_;
+  WakeupStats wakeup_;
+
+  // Reader thread only.  A port that hangs up is closed and reopened every second
+  int baudrate_;
+  bool port_open_;
+  steady_clock_t::time_point port_retry_;
+
+  // Read by fill_diagnostics() from whichever thread runs the timer
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> late_;
+};
+
+#endif // AUX_PORT_H
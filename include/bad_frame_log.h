@@ -0,0 +1,78 @@
+#ifndef BAD_FRAME_LOG_H
+#define BAD_FRAME_LOG_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+#include "ISComm.h"
+#include "ros/ros.h"
+#include "inertial_sense/GetBadFrames.h"
+
+#define BAD_FRAME_HISTORY 16       // frames kept for the bad_frames service
+#define BAD_FRAME_CAPTURE_SIZE 256 // bytes kept per frame
+
+/**
+ * @brief Keeps the raw bytes of the frame being parsed and a short history of rejected ones
+ *
+ * track() is called for every received byte and only copies it into a fixed
+ * buffer, so the cost of a bad frame is a memcpy into the ring instead of
+ * printing it from the read loop.
+ */
+class BadFrameLog
+{
+public:
+  BadFrameLog();
+
+  // Parser side
+  inline void track(uint8_t byte)
+  {
+    if (byte == PSC_START_BYTE)
+      length_ = 0;
+    if (length_ < BAD_FRAME_CAPTURE_SIZE)
+      raw_[length_] = byte;
+    last_ = byte;
+    length_++;
+  }
+  inline void good_frame() { length_ = 0; }
+
+  /**
+   * @brief bad_frame
+   * Classify the frame tracked so far and copy it into the history
+   * @param max_length - size of the parse buffer, anything longer couldn't have fit
+   * @return the classification (inertial_sense::BadFrame::CHECKSUM, LENGTH or FRAMING)
+   */
+  uint8_t bad_frame(uint32_t max_length);
+
+  static const char* error_name(uint8_t error);
+  uint64_t count(uint8_t error) const { return counts_[error].load(std::memory_order_relaxed); }
+  uint64_t total() const;
+
+  /**
+   * @brief get
+   * Copy out the most recent bad frames, oldest first
+   * @param count - number of frames to return, 0 for all that are kept
+   */
+  void get(uint32_t count, inertial_sense::GetBadFrames::Response& res);
+
+private:
+  typedef struct
+  {
+    ros::Time stamp;
+    uint8_t error;
+    uint32_t length;
+    uint8_t data[BAD_FRAME_CAPTURE_SIZE];
+  } entry_t;
+
+  uint8_t raw_[BAD_FRAME_CAPTURE_SIZE];
+  uint32_t length_;
+  uint8_t last_;
+
+  std::mutex mutex_; // only taken for a bad frame or a service call
+  entry_t history_[BAD_FRAME_HISTORY];
+  uint32_t head_;    // next slot to write
+  uint32_t stored_;
+  std::atomic<uint64_t> counts_[3];
+};
+
+#endif // BAD_FRAME_LOG_H
@@ -0,0 +1,89 @@
+#ifndef BANDWIDTH_PLANNER_H
+#define BANDWIDTH_PLANNER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+#define IS_FRAME_OVERHEAD 20                 // start byte, packet and data headers, checksum, end byte
+#define IS_ESCAPE_FACTOR (1.0 + 3.0 / 256.0) // 0xFD-0xFF are escaped with a second byte
+
+/**
+ * @brief Estimates the serial bandwidth of the configured streams
+ *
+ * Streams are named groups of DIDs (or raw ASCII output) that the node turns
+ * on together.  A DID requested by more than one enabled stream is only
+ * counted once.
+ */
+class BandwidthPlanner
+{
+public:
+  typedef enum
+  {
+    POLICY_WARN,    // log the overrun and carry on
+    POLICY_DEGRADE, // turn off the lowest priority streams until the plan fits
+    POLICY_REFUSE   // don't start
+  } policy_t;
+
+  static bool parse_policy(const std::string& name, policy_t& policy);
+
+  /**
+   * @brief frame_bytes
+   * @param payload_size - size of the data set in bytes
+   * @return expected bytes on the wire for one frame carrying it
+   */
+  static double frame_bytes(uint32_t payload_size);
+
+  // Describe the streams
+  void add_stream(const std::string& name, bool enabled, bool required = false);
+  void add_did(const std::string& stream, uint32_t did, uint32_t size, double period_s);
+  void add_ascii(const std::string& stream, uint32_t bytes, double period_s);
+
+  bool enabled(const std::string& stream) const;
+  double bytes_per_second() const;
+
+  /**
+   * @brief plan
+   * Check the enabled streams against the link and apply the policy
+   * @param capacity - usable bytes per second
+   * @param priority - stream names, highest priority first.  Streams not listed come last
+   * @param disabled - filled with the streams turned off to make the plan fit
+   * @return false if the plan doesn't fit and the policy is to refuse
+   */
+  bool plan(double capacity, policy_t policy, const std::vector<std::string>& priority,
+            std::vector<std::string>& disabled);
+
+  void log_plan(double capacity) const;
+
+  /**
+   * @brief fill_diagnostics
+   * Compare the plan with the measured throughput of the link
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id, double capacity,
+                        double measured) const;
+
+private:
+  typedef struct
+  {
+    std::string name;
+    bool enabled;
+    bool required; // never turned off to make room
+  } stream_t;
+
+  typedef struct
+  {
+    int stream;
+    uint32_t did; // 0 for ASCII output
+    double bytes_per_s;
+  } item_t;
+
+  int find(const std::string& stream) const;
+  double stream_bytes_per_second(int stream) const;
+
+  std::vector<stream_t> streams_;
+  std::vector<item_t> items_;
+};
+
+#endif // BANDWIDTH_PLANNER_H
@@ -0,0 +1,63 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ros/ros.h"
+
+/**
+ * @brief Maps device clocks onto ROS time, shared by every device in the process
+ *
+ * Each sample of (arrival time - device time) is the true offset plus however
+ * long the frame took to get to us, so the smallest sample over a sliding
+ * window is the best estimate of the offset.  Because every device is read by
+ * the same loop and estimated the same way, timestamps from different units
+ * line up to within the minimum transport delay instead of each unit carrying
+ * its own filter lag.
+ */
+class ClockSync
+{
+public:
+  /**
+   * @param window - seconds of samples the minimum is taken over.  Longer windows reject
+   *  more jitter but follow clock drift more slowly
+   */
+  ClockSync(double window = 10.0);
+
+  /**
+   * @brief add_clock
+   * @param name - used in log messages, e.g. "imu_left boot"
+   * @return id to pass to to_ros()
+   */
+  int add_clock(const std::string& name);
+
+  /**
+   * @brief to_ros
+   * @param clock - id from add_clock()
+   * @param device_time - seconds on the device clock
+   * @param arrival - when the frame carrying device_time was read
+   */
+  ros::Time to_ros(int clock, double device_time, const ros::Time& arrival);
+
+  // Current offset estimate (ROS - device) in seconds
+  double offset(int clock);
+
+private:
+  typedef struct
+  {
+    std::string name;
+    bool valid;
+    double current_min;  // smallest offset sample in the current window
+    double previous_min; // ... and in the window before it
+    double window_start;
+    int jumps;           // consecutive samples far from the estimate
+  } device_clock_t;
+
+  std::mutex mutex_;
+  double window_;
+  std::vector<device_clock_t> clocks_;
+};
+
+#endif // CLOCK_SYNC_H
@@ -0,0 +1,147 @@
+#ifndef COMMAND_CHANNEL_H
+#define COMMAND_CHANNEL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ISComm.h"
+#include "serial_writer.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief Commands to the uINS that are confirmed, retried and never block the read loop
+ *
+ * A command is a set or a get of part of a data set.  It is encoded with the
+ * channel's own ISComm instance and queued on the SerialWriter, then a get of
+ * the same data set follows.  The parser doesn't hand over ACK/NACK packets,
+ * so a set counts as done when the data set comes back holding the bytes that
+ * were written, and a get when the data set comes back at all.  Commands that
+ * see no such reply within the timeout are sent again, and fail after the
+ * last retry.
+ *
+ * Commands may be queued, and their futures waited on, from any thread but
+ * the read loop.  The read loop only calls frame_received(), which is a single
+ * atomic load while nothing is outstanding.  Completion callbacks run on the channel's own
+ * thread, so they may block (on the parameter server, say).
+ */
+class CommandChannel
+{
+public:
+  typedef struct
+  {
+    bool success;
+    std::string message;
+    std::vector<uint8_t> data; // the requested bytes as the uINS reported them
+  } result_t;
+
+  typedef std::function<void(const result_t&)> callback_t;
+
+  /**
+   * @param writer - queue the commands go out through (at PRIORITY_CONFIG)
+   */
+  CommandChannel(SerialWriter& writer);
+  ~CommandChannel();
+
+  /**
+   * @brief set_options
+   * @param timeout - seconds to wait for the reply to each attempt
+   * @param retries - attempts after the first
+   */
+  void set_options(double timeout, int retries);
+
+  // Longest a command can take to finish, every attempt timing out
+  double max_duration() const { return timeout_ * (retries_ + 1); }
+
+  /**
+   * @brief set_data
+   * Write size bytes at offset into data set did, and read them back
+   * @param done - called with the result, from the channel's thread
+   */
+  std::shared_future<result_t> set_data(uint32_t did, uint32_t offset, uint32_t size, const void* data,
+                                        const callback_t& done = callback_t());
+
+  /**
+   * @brief get_data
+   * Ask for data set did once and return size bytes from offset
+   */
+  std::shared_future<result_t> get_data(uint32_t did, uint32_t offset, uint32_t size,
+                                        const callback_t& done = callback_t());
+
+  /**
+   * @brief post
+   * Queue a packet there is no reply to wait for (a reset, a broadcast request), encoded
+   * by encode with the channel's ISComm instance
+   * @param encode - returns the packet size, like the is_comm_ functions
+   */
+  void post(const std::function<int(is_comm_instance_t*)>& encode);
+
+  /**
+   * @brief frame_received
+   * From the read loop, for every data set parsed
+   * @param data - the whole data set
+   */
+  inline void frame_received(uint32_t did, const uint8_t* data)
+  {
+    if (outstanding_.load(std::memory_order_acquire))
+      match(did, data);
+  }
+
+  /**
+   * @brief fill_diagnostics
+   * Append a status with the commands sent, retried and failed so far
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id);
+
+private:
+  typedef std::chrono::steady_clock steady_clock_t;
+
+  typedef struct
+  {
+    bool set; // set_data, otherwise get_data
+    uint32_t did;
+    uint32_t offset;
+    std::vector<uint8_t> data; // bytes written, for a set
+    int attempts;
+    steady_clock_t::time_point deadline;
+    std::shared_ptr<std::promise<result_t>> promise;
+    callback_t done;
+    result_t result;
+    bool finished;
+  } command_t;
+
+  std::shared_future<result_t> submit(bool set, uint32_t did, uint32_t offset, uint32_t size, const void* data,
+                                      const callback_t& done);
+  void send(command_t& command);
+  void match(uint32_t did, const uint8_t* data);
+  void run();
+
+  SerialWriter& writer_;
+  double timeout_;
+  int retries_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::list<command_t> commands_;
+  std::atomic<size_t> outstanding_; // commands not finished yet
+  is_comm_instance_t comm_; // encoding only, the read loop's instance and buffer are left alone
+  uint8_t buffer_[PKT_BUF_SIZE];
+
+  uint64_t sent_;
+  uint64_t retried_;
+  uint64_t failed_;
+  std::string last_failure_;
+
+  bool running_;
+  std::thread thread_;
+};
+
+#endif // COMMAND_CHANNEL_H
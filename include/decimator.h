@@ -0,0 +1,82 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Decimates a multi-channel stream to several lower rates at once
+ *
+ * Each output keeps every ratio-th input sample after a linear phase FIR low
+ * pass (Blackman windowed sinc, cut off at 80% of the output Nyquist
+ * frequency) so what is above the new Nyquist frequency doesn't alias into
+ * it.  The outputs share one history of the input, and an output's filter
+ * only runs when it produces a sample, so several outputs cost little more
+ * than the slowest one.
+ *
+ * The history is interleaved, LANES floats per sample with unused channels
+ * zeroed, so the filter's inner loop is LANES independent multiply-adds the
+ * compiler can turn into one vector operation.
+ */
+class Decimator
+{
+public:
+  static const int LANES = 8; // channels per sample at most
+  static const int TAPS_PER_RATIO = 16;
+
+  Decimator();
+
+  /**
+   * @brief add_output
+   * @param ratio - input samples per output sample
+   * @return the output's index
+   */
+  int add_output(int ratio);
+  void set_ratio(int output, int ratio);
+  int ratio(int output) const { return outputs_[output].ratio; }
+  int size() const { return outputs_.size(); }
+
+  // Forget the history, the outputs wait for a full filter length again
+  void clear();
+
+  /**
+   * @brief push
+   * Add one input sample
+   * @param sample - channels values
+   * @param t - time of the sample
+   * @return true if any output produced a sample, see ready()
+   */
+  bool push(const float* sample, int channels, double t);
+
+  // Whether the output produced a sample on the last push, and that sample
+  bool ready(int output) const { return outputs_[output].ready; }
+  const float* value(int output) const { return outputs_[output].value; }
+  // Time of the input sample at the filter's center, the output is delayed by half the filter
+  double time(int output) const { return outputs_[output].time; }
+
+private:
+  typedef struct
+  {
+    int ratio;
+    std::vector<float> taps;
+    int phase;
+    bool ready;
+    float value[LANES];
+    double time;
+  } output_t;
+
+  static void design(int ratio, std::vector<float>& taps);
+  void resize_history();
+
+  std::vector<output_t> outputs_;
+
+  // Each sample is stored twice, at pos and pos + length, so the newest taps samples are
+  // always contiguous
+  std::vector<float> history_;
+  std::vector<double> times_;
+  int length_;
+  int pos_;    // newest sample
+  int count_;  // samples since clear(), up to length_
+};
+
+#endif // DECIMATOR_H
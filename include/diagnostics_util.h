@@ -0,0 +1,23 @@
+#ifndef DIAGNOSTICS_UTIL_H
+#define DIAGNOSTICS_UTIL_H
+
+#include <stdio.h>
+#include <string>
+
+#include "diagnostic_msgs/KeyValue.h"
+
+/**
+ * @brief key_value
+ * A diagnostic status value, formatted with printf (whole numbers unless format says otherwise)
+ */
+inline diagnostic_msgs::KeyValue key_value(const std::string& key, double value, const char* format = "%.0f")
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), format, value);
+  diagnostic_msgs::KeyValue kv;
+  kv.key = key;
+  kv.value = buf;
+  return kv;
+}
+
+#endif // DIAGNOSTICS_UTIL_H
@@ -0,0 +1,33 @@
+#ifndef EVENT_CALLBACK_QUEUE_H
+#define EVENT_CALLBACK_QUEUE_H
+
+#include <stdint.h>
+
+#include "ros/callback_queue.h"
+
+/**
+ * @brief ros::CallbackQueue that can be waited on with poll()
+ *
+ * Every callback added (subscriptions, services, timers) signals an eventfd, so
+ * the read loop can block on the serial port and the queue at once instead of
+ * waking up every millisecond to check both.
+ */
+class EventCallbackQueue : public ros::CallbackQueue
+{
+public:
+  EventCallbackQueue();
+  ~EventCallbackQueue();
+
+  virtual void addCallback(const ros::CallbackInterfacePtr& callback, uint64_t owner_id = 0);
+
+  // Readable while callbacks are waiting
+  int fd() const { return fd_; }
+
+  // Reset the signal and run what is queued.  Callbacks added meanwhile signal again
+  void call_signalled();
+
+private:
+  int fd_;
+};
+
+#endif // EVENT_CALLBACK_QUEUE_H
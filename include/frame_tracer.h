@@ -0,0 +1,139 @@
+#ifndef FRAME_TRACER_H
+#define FRAME_TRACER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#define TRACE_SUB_BITS 4                      // 16 linear sub-buckets per power of two, <= 6.25% error
+#define TRACE_SUB_BUCKETS (1 << TRACE_SUB_BITS)
+#define TRACE_BUCKETS (33 * TRACE_SUB_BUCKETS) // 1 ns to ~68 s
+#define TRACE_MAX_DIDS 16                     // histogram sets, DIDs beyond this share the last one
+#define TRACE_MAX_DID 128
+
+/**
+ * @brief Per-frame pipeline stage timing
+ *
+ * The node calls the hooks below around the read, at the end of each frame,
+ * around each publish and after the handler returns.  Every completed frame is
+ * split into stages and recorded into per-DID log-linear histograms that never
+ * allocate after construction.  A sampled window can also be written out as a
+ * Chrome trace-event file (chrome://tracing, Perfetto).
+ *
+ * Not thread safe: the hooks and exports must all run on the thread that reads
+ * the port.
+ */
+class FrameTracer
+{
+public:
+  typedef enum
+  {
+    STAGE_READ,    // serialPortReadTimeout call that delivered the end of the frame, including the wait for data
+    STAGE_QUEUE,   // from the read returning until the parser reached the frame
+    STAGE_PARSE,   // is_comm_parse over the frame's bytes
+    STAGE_HANDLER, // message conversion, excluding publish
+    STAGE_PUBLISH, // publish() calls
+    STAGE_TOTAL,   // from the read returning until the handler returned
+    STAGE_COUNT
+  } stage_t;
+
+  typedef struct
+  {
+    std::string histogram_file; // rewritten on every export, empty to only log
+    std::string chrome_file;    // empty to disable the trace-event dump
+    double chrome_start = 5.0;  // seconds after start up to open the window
+    double chrome_duration = 1.0;
+    int chrome_sample = 1;      // trace every Nth frame in the window
+  } options_t;
+
+  FrameTracer(const options_t& options);
+
+  static inline uint64_t now_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  // Hooks
+  inline void read_started() { read_start_ = now_ns(); }
+  inline void read_finished() { last_mark_ = read_end_ = now_ns(); }
+  inline void frame_parsed(uint32_t did)
+  {
+    frame_end_ = now_ns();
+    did_ = did;
+    publish_ns_ = 0;
+    publish_first_ = 0;
+    pending_ = true;
+  }
+  inline void publish_started()
+  {
+    publish_start_ = now_ns();
+    if (!publish_first_)
+      publish_first_ = publish_start_;
+  }
+  inline void publish_finished() { publish_ns_ += now_ns() - publish_start_; }
+  void frame_handled();
+
+  /**
+   * @brief export_histograms
+   * Log a summary of every histogram and rewrite histogram_file
+   * @param final - also write out a Chrome trace window that hasn't closed yet
+   */
+  void export_histograms(bool final = false);
+
+  static uint32_t bucket(uint64_t ns);
+  static uint64_t bucket_value(uint32_t bucket);
+  static const char* stage_name(int stage);
+
+private:
+  typedef struct
+  {
+    uint32_t counts[TRACE_BUCKETS];
+    uint64_t n;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+  } histogram_t;
+
+  typedef struct
+  {
+    uint64_t start_ns;
+    uint32_t duration_ns;
+    uint8_t stage;
+    uint8_t slot;
+  } trace_event_t;
+
+  void record(int slot, int stage, uint64_t ns);
+  void trace(int slot, int stage, uint64_t start_ns, uint64_t end_ns);
+  uint64_t percentile(const histogram_t& h, double p) const;
+  void write_chrome_trace();
+
+  options_t options_;
+  uint64_t start_ns_;
+
+  // Stamps for the frame in flight
+  uint64_t read_start_;
+  uint64_t read_end_;
+  uint64_t last_mark_; // end of the previous frame's handler, or the end of the read
+  uint64_t frame_end_;
+  uint64_t publish_start_;
+  uint64_t publish_first_;
+  uint64_t publish_ns_;
+  uint32_t did_;
+  bool pending_;
+
+  uint8_t slot_of_[TRACE_MAX_DID];
+  uint32_t did_of_[TRACE_MAX_DIDS];
+  int slots_used_;
+  histogram_t histograms_[TRACE_MAX_DIDS][STAGE_COUNT];
+
+  // Chrome trace window
+  std::vector<trace_event_t> events_; // reserved up front
+  uint64_t chrome_start_ns_;
+  uint64_t chrome_end_ns_;
+  uint64_t frames_in_window_;
+  bool chrome_written_;
+};
+
+#endif // FRAME_TRACER_H
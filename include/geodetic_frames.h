@@ -0,0 +1,76 @@
+#ifndef GEODETIC_FRAMES_H
+#define GEODETIC_FRAMES_H
+
+#include <string>
+
+/**
+ * @brief Converts INS solutions to earth fixed and local frames, with what only depends
+ * on the reference computed once per reference
+ *
+ * For the reference (the uINS refLla) it caches the ECEF origin, the rotation from
+ * ECEF to the reference's NED frame and the UTM zone's central meridian.  A solution
+ * is turned into ECEF with one sine and cosine of latitude and longitude, and every
+ * frame asked for is filled from that in one convert() call: NED and ENU are the
+ * cached rotation applied to the offset from the origin, and UTM comes from the
+ * transverse Mercator series, which needs its own trig.  Orientations go from the
+ * local NED frame at the solution through ECEF into each frame, so they stay right
+ * however far the solution is from the reference.
+ */
+class GeodeticFrames
+{
+public:
+  enum { NED, ENU, ECEF, UTM, FRAMES };
+
+  // Lower case names, as in ~frames
+  static const char* name(int frame);
+  // -1 if unknown
+  static int frame(const std::string& name);
+  // Frames other than ECEF are relative to the reference
+  static bool needs_reference(int frame) { return frame != ECEF; }
+
+  typedef struct
+  {
+    double position[3];
+    double orientation[4]; // w, x, y, z, rotating body to frame
+    double rotation[9];    // from NED at the solution to frame, row major
+  } pose_t;
+
+  GeodeticFrames();
+
+  /**
+   * @brief set_reference
+   * @param lla - degrees, degrees, meters, all zero for none
+   * @param utm_zone - 1 to 60, negative in the southern hemisphere, 0 for the reference's
+   * @return true if the reference changed
+   */
+  bool set_reference(const double* lla, int utm_zone = 0);
+  bool has_reference() const { return has_reference_; }
+  const double* reference() const { return reference_; }
+  int utm_zone() const { return utm_zone_; }
+
+  /**
+   * @brief convert
+   * @param lla - solution, degrees, degrees, meters
+   * @param q_ned - attitude, w, x, y, z rotating body to NED
+   * @param frames - count frames to fill poses with, in order
+   */
+  void convert(const double* lla, const double* q_ned, const int* frames, int count, pose_t* poses) const;
+
+  // WGS84
+  static void lla_to_ecef(const double* lla, double* ecef);
+  // Easting and northing in the cached zone, and the angle from true north to grid north (radians, clockwise)
+  void lla_to_utm(double lat, double lon, double* en, double* convergence) const;
+
+private:
+  static void ecef_to_ned_rotation(double sin_lat, double cos_lat, double sin_lon, double cos_lon, double* r);
+
+  bool has_reference_;
+  double reference_[3];
+  double origin_[3];      // ECEF
+  double ned_ecef_[9];    // rotation from ECEF to the reference's NED, row major
+  int utm_zone_;
+  double utm_lon0_;       // radians
+  double utm_northing0_;
+};
+
+#endif // GEODETIC_FRAMES_H
@@ -0,0 +1,86 @@
+#ifndef IMU_HEALTH_H
+#define IMU_HEALTH_H
+
+#include <stdint.h>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "data_sets.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief Windowed statistics of both IMUs, checked against limits on every window
+ *
+ * Every dual_imu_t sample is spread over CHANNELS lanes: the twelve IMU axes
+ * (IMU1 gyro x, y, z and accelerometer x, y, z, then IMU2) followed by the six
+ * IMU1 - IMU2 differences.  Each lane keeps a sum and sum of squares (shifted by
+ * the window's first sample, so a 9.8 m/s^2 axis doesn't swamp its variance) and
+ * a saturation count in arrays of their own, so a sample is one branch-free
+ * pass over the lanes that the compiler vectorizes.
+ *
+ * When a window closes its mean and standard deviation are checked:
+ * an axis that didn't change at all is stuck, one over its standard deviation
+ * limit is noisy, a sample at the saturation limit is clipped, and a difference
+ * whose mean or standard deviation is over the disagreement limit means the
+ * IMUs don't agree (motion shows up in both, a failing sensor only in one).
+ * Problems are held until the next fill_diagnostics(), so one bad window between
+ * two diagnostics is still reported.
+ */
+class ImuHealth
+{
+public:
+  static const int AXES = 12;
+  static const int CHANNELS = AXES + 6;
+
+  typedef struct
+  {
+    double window = 1.0;                // seconds of samples per window
+    int imus = 2;                       // 1 for hardware with only IMU1, skips IMU2 and the differences
+    double gyro_saturation = 34.0;      // rad/s, just under the 2000 deg/s range
+    double acc_saturation = 156.0;      // m/s^2, just under the 16 g range
+    double gyro_std = 0;                // rad/s per axis, 0 to not check
+    double acc_std = 0;                 // m/s^2 per axis, 0 to not check
+    double gyro_disagreement = 0.05;    // rad/s, mean or standard deviation of IMU1 - IMU2
+    double acc_disagreement = 0.5;      // m/s^2
+  } options_t;
+
+  ImuHealth(const options_t& options);
+
+  void push(const dual_imu_t& imu);
+
+  /**
+   * @brief fill_diagnostics
+   * Append a status with the last window's statistics and the worst problems
+   * since the last call, which are then cleared
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id);
+
+private:
+  void close_window();
+
+  options_t options_;
+  std::string names_[CHANNELS];
+
+  // Window being accumulated, one lane per channel
+  double shift_[CHANNELS];
+  double sum_[CHANNELS];
+  double sum_sq_[CHANNELS];
+  float limit_[CHANNELS];      // saturation, infinite for the differences
+  uint32_t saturated_[CHANNELS];
+  uint32_t count_;
+  double start_;
+
+  // Last closed window and what was wrong since the last report, under mutex_
+  std::mutex mutex_;
+  double mean_[CHANNELS];
+  double std_[CHANNELS];
+  uint32_t last_saturated_[CHANNELS];
+  uint32_t last_count_;
+  uint64_t windows_;
+  uint64_t flagged_windows_;
+  int level_;
+  std::set<std::string> problems_;
+};
+
+#endif // IMU_HEALTH_H
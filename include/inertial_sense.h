@@ -1,11 +1,24 @@
+#ifndef INERTIAL_SENSE_H
+#define INERTIAL_SENSE_H
+
 #include <stdio.h>
 #include <iostream>
 #include <algorithm>
+#include <deque>
+#include <memory>
 #include <string>
+#include <functional>
+#include <map>
+#include <set>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "ISComm.h"
 //#include "serial.h"
 #include "serialPortPlatform.h"
+#include "serialPortNet.h"
+#include "shmRing.h"
 
 #include "ros/ros.h"
 #include "ros/timer.h"
@@ -14,16 +27,40 @@
 #include "sensor_msgs/FluidPressure.h"
 #include "inertial_sense/GPS.h"
 #include "inertial_sense/GPSInfo.h"
+#include "inertial_sense/GPSInfoEvents.h"
 #include "inertial_sense/PreIntIMU.h"
+#include "inertial_sense/RTCM.h"
 #include "nav_msgs/Odometry.h"
+#include "tf2_msgs/TFMessage.h"
 #include "std_srvs/Trigger.h"
+#include "inertial_sense/ConfigureStreams.h"
 #include "std_msgs/Header.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+#include "stream_stats.h"
+#include "bad_frame_log.h"
+#include "frame_tracer.h"
+#include "bandwidth_planner.h"
+#include "clock_sync.h"
+#include "raw_stream_server.h"
+#include "serial_writer.h"
+#include "aux_port.h"
+#include "realtime.h"
+#include "event_callback_queue.h"
+#include "publish_executor.h"
+#include "command_channel.h"
+#include "decimator.h"
+#include "allan_variance.h"
+#include "imu_health.h"
+#include "geodetic_frames.h"
+#include "satellite_store.h"
 
 # define GPS_UNIX_OFFSET 315964800 // GPS time started on 6/1/1980 while UNIX time started 1/1/1970 this is the difference between those in seconds
 # define LEAP_SECONDS 18 // GPS time does not have leap seconds, UNIX does (as of 1/1/2017 - next one is probably in 2020 sometime unless there is some crazy earthquake or nuclear blast) 
 # define UNIX_TO_GPS_OFFSET (GPS_UNIX_OFFSET - LEAP_SECONDS) 
 
-#define BUFFER_SIZE 512
+// Big enough for any data set, DID_GPS1_SAT alone is over 800 bytes
+#define BUFFER_SIZE PKT_BUF_SIZE
 
 
 class InertialSenseROS //: SerialListener
@@ -39,22 +76,170 @@ class InertialSenseROS //: SerialListener
   } NMEA_message_config_t;
       
 public:
-  InertialSenseROS();
+  /**
+   * @brief InertialSenseROS
+   * @param connect - open the serial port and configure the uINS.  When false the node only
+   *  decodes bytes handed to parse_bytes() with every stream enabled and no publishers
+   *  advertised (used by the benchmarks)
+   */
+  InertialSenseROS(bool connect = true);
+
+  /**
+   * @brief InertialSenseROS
+   * @param nh - node handle for topics and services
+   * @param nh_private - node handle for parameters
+   * @param connect - see above
+   */
+  InertialSenseROS(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private, bool connect = true);
+  ~InertialSenseROS();
   void callback(p_data_t* data);
-  void update();
+
+  /**
+   * @brief update
+   * Read whatever the uINS has sent and handle it
+   * @param timeout_ms - how long to wait for a full read, 0 to take only what is already there
+   */
+  void update(int timeout_ms = 1);
+
+  /**
+   * @brief spin
+   * Run the device until keep_going() returns false.  Sleeps in poll() on the port and on
+   * queue, which the node handles must be using, so the thread only wakes up when there is
+   * data to read, something to write or a ROS callback to run
+   */
+  void spin(EventCallbackQueue& queue, const std::function<bool()>& keep_going);
+
+  // For loops that poll the port themselves: whether to wait for POLLOUT too, and how long
+  // to sleep at most before calling update(0) anyway
+  bool write_pending() { return writer_.pending(); }
+  int poll_timeout_ms() const;
+  void parse_bytes(const uint8_t* buf, int len);
+
+  // File descriptor of the serial port, -1 when not connected or closed after an error
+  int fd();
+
+  // Sockets of the raw stream servers, appended to fds for loops that poll the port themselves,
+  // which call update() when any of them is ready
+  void raw_stream_fds(std::vector<struct pollfd>& fds) const;
+
+  /**
+   * @brief check_port
+   * For loops that poll the port themselves, with POLLRDHUP asked for too, after update():
+   * on POLLHUP, POLLRDHUP (the TCP peer closed), POLLERR or POLLNVAL from fd() it closes the
+   * port, which update() tries to reopen every second, asking for the streams again once it
+   * is back.  Otherwise poll() keeps returning right away with nothing to read
+   */
+  void check_port(short revents);
+
+  /**
+   * @brief set_clock_sync
+   * Stamp messages with device time mapped through a clock shared with other devices
+   * instead of the time they were read
+   * @param name - prefix for the clocks registered with sync
+   */
+  void set_clock_sync(ClockSync* sync, const std::string& name);
+
+  /**
+   * @brief enable_tracing
+   * Start timing every frame through read, parse, handler and publish (see FrameTracer).
+   * Histograms are exported by export_trace(), which also runs on destruction
+   */
+  void enable_tracing(const FrameTracer::options_t& options);
+  void export_trace(bool final = false);
+
+  /**
+   * @brief enable_imu_health
+   * Check windowed statistics of every IMU sample against limits, reported in diagnostics (see ImuHealth)
+   */
+  void enable_imu_health(const ImuHealth::options_t& options);
+
+  /**
+   * @brief enable_frames
+   * Also publish the INS solution in each of frames ("ned", "enu", "ecef", "utm") as
+   * ins/<frame>, converted by GeodeticFrames
+   * @param tf_frame - one of frames whose transform to the body goes out on /tf, "" for none
+   */
+  void enable_frames(const std::vector<std::string>& frames, const std::string& tf_frame);
+  // Reference of the frames other than ECEF, the uINS refLla.  All zero for none
+  void set_frames_reference(const double* lla);
+
+  /**
+   * @brief record_wakeup
+   * Count a wait for this device's port that timed out, for loops that poll the port
+   * themselves instead of calling update() with a timeout
+   */
+  void record_wakeup(double timeout_s, double elapsed_s) { wakeup_.add(timeout_s, elapsed_s); }
+
+  /**
+   * @brief take_rt_thread
+   * Hand the ~rt setup of the thread running update() to a loop that runs several devices,
+   * which sets that thread up once for all of them.  update() no longer does it afterwards
+   * @return false without ~rt
+   */
+  bool take_rt_thread(RealTime::thread_options_t& options, size_t& stack_bytes);
 
 private:
   
+  // What the uINS is asked to send, everything configure_streams can change
+  typedef struct
+  {
+    std::set<std::string> streams; // INS, IMU, GPS, GPS_info, mag, baro, preint_IMU, shm and allan
+    int NMEA_rate = 0;
+    int NMEA_configuration = 0;
+    int NMEA_ports = 0;
+    std::map<std::string, int> period_ms; // from ~<stream>_period_ms, 0 leaves the stream on RMC at its default rate
+    bool on(const std::string& stream) const { return streams.count(stream) > 0; }
+    int period(const std::string& stream) const
+    {
+      std::map<std::string, int>::const_iterator p = period_ms.find(stream);
+      return p == period_ms.end() ? 0 : p->second;
+    }
+  } stream_config_t;
+
+  // The requests that produce a stream_config_t, per link (0 is the main port, 1 is ~port2)
+  typedef struct
+  {
+    uint32_t rmc_bits[2] = { 0, 0 };
+    std::map<uint32_t, uint32_t> multiples[2]; // DIDs asked for on their own, as multiples of their native period
+  } did_requests_t;
+
   void initialize_uINS();
+  void read_bandwidth_params();
+  // Fill planner1 and planner2 with what the requests for config bring in on each link
+  void build_bandwidth_plan(int nav_dt_ms, const stream_config_t& config, BandwidthPlanner& planner1,
+                            BandwidthPlanner& planner2);
+  /**
+   * @brief plan_bandwidth
+   * Plan config against the links into planner1 and planner2 (~port2), following
+   * ~bandwidth_policy.  Streams the policy turns off are taken out of config
+   * @return false if it doesn't fit and the policy is to refuse
+   */
+  bool plan_bandwidth(int nav_dt_ms, stream_config_t& config, BandwidthPlanner& planner1, BandwidthPlanner& planner2);
+  did_requests_t did_requests(const stream_config_t& config, int nav_dt_ms) const;
+  /**
+   * @brief send_did_requests
+   * Send what changed from before to requests (everything if all), directly during start up and
+   * through commands_ once running
+   * @param sent - filled with a description of each request
+   */
+  void send_did_requests(const did_requests_t& requests, const did_requests_t& before, bool all,
+                         std::vector<std::string>& sent);
+  // Period the uINS produces did at with a period multiple of 1, which RMC also uses
+  static uint32_t native_period_ms(uint32_t did, int nav_dt_ms);
+  static uint32_t period_multiple(uint32_t did, int period_ms, int nav_dt_ms);
+  static ascii_msgs_t NMEA_messages(const stream_config_t& config);
+  void set_expected_periods();
   template<typename T> void set_vector_flash_config(std::string param_name, uint32_t size, uint32_t offset);
   template<typename T>  void set_flash_config(std::string param_name, uint32_t offset, T def);
   void get_flash_config();
   void reset_device();
   void flash_config_callback(const nvm_flash_cfg_t* const msg);
+  void handle_frame(uint32_t message_type, const uint8_t* data);
   // Serial Port Configuration
   std::string port_;
   int baudrate_;
   bool initialized_;
+  bool connected_;
 
   uint32_t insStatus_; // Current Status of INS estimator
 
@@ -66,6 +251,8 @@ private:
     bool enabled;
     ros::Publisher pub;
     ros::Publisher pub2;
+    PublishExecutor::Topic* queue = NULL; // owned by executor_, NULL to publish inline
+    PublishExecutor::Topic* queue2 = NULL; // for pub2
   } ros_stream_t;
 
   ros_stream_t INS_;
@@ -73,6 +260,18 @@ private:
   void INS2_callback(const ins_2_t* const msg);
   void INS_variance_callback(const inl2_variance_t* const msg);
 
+  // ins/<frame> topics from ~frames, and /tf for ~tf_frame.  Only changed from the read thread
+  GeodeticFrames geodetic_;
+  int utm_zone_ = 0;
+  std::vector<int> odom_frames_;
+  std::vector<std::string> odom_frame_ids_;
+  std::vector<ros_stream_t> odom_frame_streams_;
+  int tf_frame_ = -1; // index in odom_frames_
+  ros_stream_t tf_;
+  nav_msgs::Odometry frame_msg_; // reused, so converting doesn't allocate
+  tf2_msgs::TFMessage tf_msg_;
+  void publish_frames(const double* lla);
+
   ros_stream_t IMU_;
   void IMU_callback(const dual_imu_t* const msg);
 
@@ -81,6 +280,12 @@ private:
 
   ros_stream_t GPS_info_;
   void GPS_Info_callback(const gps_sat_t* const msg);
+  // Tracked satellites on gps/info every ~gps_info_full_every epochs, what changed on
+  // gps/info/events (pub2) every epoch.  From the read thread
+  SatelliteStore satellites_;
+  std::vector<SatelliteStore::event_t> sat_events_;
+  int gps_info_full_every_ = 10;
+  uint64_t gps_info_epochs_ = 0;
 
   ros_stream_t mag_;
   void mag_callback(const magnetometer_t* const msg, int mag_number);
@@ -90,16 +295,157 @@ private:
 
   ros_stream_t dt_vel_;
   void preint_IMU_callback(const preintegrated_imu_t * const msg);
+
+  // imu/<hz>hz topics from ~imu_decimation, filtered down from the IMU stream
+  std::vector<int> imu_decimation_hz_;
+  std::vector<ros_stream_t> imu_decimated_;
+  Decimator imu_decimator_;
+  int imu_period_ms(const did_requests_t& requests, int nav_dt_ms) const;
+  // Set the ratios for the IMU coming every period_ms, from the read loop once running
+  void setup_imu_decimation(int period_ms);
+
+  // ~allan_variance: noise characterization of both IMUs, fed from IMU_callback
+  AllanVariance* allan_ = NULL;
+  std::mutex allan_mutex_;
+  double allan_first_time_ = 0;
+  double allan_last_time_ = 0;
+  std::vector<std::string> allan_names_;
+  std::string allan_file_;
+  ros::Timer allan_timer_;
+  double allan_dt() const; // with allan_mutex_ held
+  void allan_timer_callback(const ros::TimerEvent& event);
+
+  // ~imu_health: limits checked on every IMU sample, from the read thread
+  ImuHealth* imu_health_ = NULL;
+
+  /**
+   * @brief advertise
+   * Advertise a stream's topic, and queue it on executor_ with the ~publish_policy/<name>
+   * and ~publish_depth/<name> settings
+   * @param second - on the stream's pub2 instead
+   */
+  template<typename T> void advertise(ros_stream_t& stream, const std::string& topic, const std::string& name,
+                                      const std::string& policy, int depth, bool second = false);
+  template<typename T> void publish(ros_stream_t& stream, const T& msg, bool second = false);
+  ros_stream_t* stream(const std::string& name);
+  void advertise_stream(const std::string& name, ros_stream_t& stream);
+
+  // As applied to the uINS.  Changed only by configure_streams, under reconfigure_mutex_.  The read
+  // loop also uses nav_dt_ms_ and did_requests_, so those change in a run_in_read_loop() task
+  stream_config_t stream_config_;
+  int nav_dt_ms_ = 0;
+  did_requests_t did_requests_;
+  bool NMEA_unconfirmed_ = false; // last ASCII_BCAST_PERIOD set failed, the uINS output is unknown
+  std::mutex reconfigure_mutex_;
+  ros::ServiceServer configure_streams_srv_;
+  bool configure_streams_srv_callback(inertial_sense::ConfigureStreams::Request & req, inertial_sense::ConfigureStreams::Response & res);
+
+  /**
+   * @brief run_in_read_loop
+   * Run task on the thread calling update(), between reads, and wait for it.  Safe to call from
+   * several threads at once, the tasks run in the order they came in
+   * @return false if the read loop didn't get to it within timeout_s, it then never runs
+   */
+  bool run_in_read_loop(const std::function<void()>& task, double timeout_s = 1.0);
+  // Queue task for the read loop without waiting, for threads that mustn't block on it
+  void post_to_read_loop(const std::function<void()>& task);
+  typedef struct
+  {
+    std::function<void()> run;
+    bool done;
+  } read_loop_task_t;
+  // Run with read_loop_task_mutex_ held, so a caller that times out finds its own task either
+  // done or still queued
+  std::mutex read_loop_task_mutex_;
+  std::condition_variable read_loop_task_done_;
+  std::deque<std::shared_ptr<read_loop_task_t>> read_loop_tasks_;
+  std::atomic<bool> read_loop_task_pending_{false};
+
+  // Publishing thread, NULL when ~publish_async is off or running disconnected
+  PublishExecutor* executor_ = NULL;
+
+  // Writes to the uINS once it is streaming go through here so they never block the read loop
+  SerialWriter writer_;
+  void send_config(int messageSize);
+  ros::Subscriber rtcm_sub_;
+  double rtcm_max_age_ = 10.0;
+  void rtcm_callback(const inertial_sense::RTCM::ConstPtr& msg);
   
-  void bad_data_callback(const uint8_t* buf);
+  BadFrameLog bad_frames_;
+  void bad_data_callback();
+  ros::ServiceServer bad_frames_srv_;
+  bool get_bad_frames_srv_callback(inertial_sense::GetBadFrames::Request & req, inertial_sense::GetBadFrames::Response & res);
 
-  ros::Publisher strobe_pub_;
+  // Read path: one read() per wakeup, sized from FIONREAD
+  std::vector<uint8_t> read_buffer_ = std::vector<uint8_t>(4096);
+  size_t read_buffer_max_ = 65536;
+  int read_min_bytes_ = 1;   // VMIN, how many bytes the tty waits for before poll() wakes us
+  int read_max_wait_ms_ = 2; // longest the tail of a burst waits below read_min_bytes_
+  bool network_port_ = false;
+  bool port_open_ = true;
+  ros::WallTime port_retry_; // next time to try reopening a closed port
+  bool reopen_port();
+
+  // Link statistics
+  StreamStats stats_;
+  uint32_t frame_bytes_ = 0; // bytes parsed since the last complete frame
+  ros::Publisher diagnostics_pub_;
+  ros::Timer diagnostics_timer_;
+  ros::WallTime last_diagnostics_;
+  void diagnostics_callback(const ros::TimerEvent& event);
+  BandwidthPlanner bandwidth_;
+  double bandwidth_capacity_ = 0; // usable bytes/s
+  BandwidthPlanner::policy_t bandwidth_policy_ = BandwidthPlanner::POLICY_WARN;
+  std::vector<std::string> bandwidth_priority_;
+
+  // Second link on the uINS's other UART, NULL unless ~port2 is set
+  AuxPort* port2_ = NULL;
+  std::vector<std::string> port2_streams_; // streams moved to the second link
+  BandwidthPlanner bandwidth2_;
+  double bandwidth2_capacity_ = 0;
+  double merge_window_ = 0.01; // longest a second link frame waits for a later one on the main link
+  double last_port1_time_ = -1; // device time of the last main link frame handled
+  bool on_port2(const std::string& stream) const;
+  void open_port2();
+  double merge_time(uint32_t did, const uint8_t* data) const;
+  void merge_port2(double before, AuxPort::steady_clock_t::time_point arrived_before);
+
+  // Shared memory rings for local consumers, unmapped unless ~shm is set
+  bool shm_enabled_ = false;
+  shm_ring_t shm_imu_ = {};
+  shm_ring_t shm_ins_ = {};
+  shm_ring_t shm_gps_ = {};
+  void open_shm_rings();
+
+  // Raw byte stream re-served to other local tools, NULL unless ~raw_stream_servers is set
+  RawStreamServer* raw_server_ = NULL;
+
+  // Real-time mode (~rt), the thread calling update() is set up on the first call once running
+  bool rt_pending_ = false;
+  RealTime::thread_options_t rt_thread_;
+  size_t rt_stack_bytes_ = 0;
+  WakeupStats wakeup_;
+  double wakeup_warn_us_ = 500.0;
+
+  // Stage tracing, NULL unless ~trace is set
+  FrameTracer* tracer_ = NULL;
+  ros::Timer trace_timer_;
+  void trace_timer_callback(const ros::TimerEvent& event);
+
+  ros_stream_t strobe_;
   void strobe_in_time_callback(const strobe_in_time_t * const msg);
 
+  // Confirmed commands once running, NULL when running disconnected.  The services that wait
+  // on them are served from command_queue_ by their own thread, never the read loop's
+  CommandChannel* commands_ = NULL;
+  ros::CallbackQueue command_queue_;
+  ros::AsyncSpinner* command_spinner_ = NULL;
+
   ros::ServiceServer mag_cal_srv_;
   ros::ServiceServer multi_mag_cal_srv_;
   bool perform_mag_cal_srv_callback(std_srvs::Trigger::Request & req, std_srvs::Trigger::Response & res);
   bool perform_multi_mag_cal_srv_callback(std_srvs::Trigger::Request & req, std_srvs::Trigger::Response & res);
+  bool start_mag_cal(uint32_t mode, std_srvs::Trigger::Response & res);
   
   
   /**
@@ -125,6 +471,9 @@ private:
    * @return equivalent ros::Time
    */
   ros::Time ros_time_from_tow(const double tow);
+  ClockSync* clock_sync_ = NULL;
+  int boot_clock_ = -1; // time since boot (IMU, magnetometer, barometer)
+  int tow_clock_ = -1;  // time of week (INS, GPS) before GPS time is known
   double GPS_towOffset_ = 0; // The offset between GPS time-of-week and local time on the uINS 
                              //  If this number is 0, then we have not yet got a fix
   uint64_t GPS_week_ = 0; // Week number to start of GPS_towOffset_ in GPS time
@@ -137,6 +486,7 @@ private:
   nav_msgs::Odometry odom_msg;
   inertial_sense::GPS gps_msg;
   inertial_sense::GPSInfo gps_info_msg;
+  inertial_sense::GPSInfoEvents gps_info_events_msg;
 
   ros::NodeHandle nh_;
   ros::NodeHandle nh_private_;
@@ -145,6 +495,7 @@ private:
 //  Serial* serial_;
   is_comm_instance_t comm_;
   uint8_t message_buffer_[BUFFER_SIZE];
+  uint8_t merge_buffer_[BUFFER_SIZE]; // main link frame held while the second link's are handled
   serial_port_t serial_;
   bool got_flash_config = false;
   nvm_flash_cfg_t flash_; // local copy of flash config
@@ -156,3 +507,4 @@ private:
 //  InertialSense inertialSenseInterface_;
 };
 
+#endif // INERTIAL_SENSE_H
@@ -0,0 +1,57 @@
+#ifndef INERTIAL_SENSE_MULTI_H
+#define INERTIAL_SENSE_MULTI_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ros/ros.h"
+#include "event_callback_queue.h"
+
+#include "inertial_sense.h"
+#include "clock_sync.h"
+
+/**
+ * @brief Runs several uINS units from one process
+ *
+ * Every entry of ~devices gets its own InertialSenseROS (and with it its own
+ * is_comm_instance_t and serial_port_t) under its namespace.  The ports are
+ * serviced from a single poll() loop, or split across a small pool of threads
+ * pinned to CPUs, and all devices share one ClockSync so their timestamps line up.
+ */
+class InertialSenseMulti
+{
+public:
+  InertialSenseMulti(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private);
+  ~InertialSenseMulti();
+
+  // Service the devices until ROS shuts down
+  void spin();
+
+private:
+  typedef struct
+  {
+    std::string ns;
+    ros::NodeHandle nh;
+    ros::NodeHandle nh_private;
+    EventCallbackQueue* queue;
+    InertialSenseROS* driver;
+  } device_t;
+
+  void add_device(XmlRpc::XmlRpcValue& config, XmlRpc::XmlRpcValue& shared);
+  void poll_loop(std::vector<device_t*> devices, bool spin_global);
+  static void set_affinity(int cpu);
+  static bool rt_options(const std::vector<device_t*>& devices, int cpu, RealTime::thread_options_t& options,
+                         size_t& stack_bytes);
+  static void setup_thread(bool rt, const RealTime::thread_options_t& options, size_t stack_bytes);
+
+  ros::NodeHandle nh_;
+  ros::NodeHandle nh_private_;
+  ClockSync clock_sync_;
+  std::vector<device_t*> devices_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> running_;
+};
+
+#endif // INERTIAL_SENSE_MULTI_H
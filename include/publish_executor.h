@@ -0,0 +1,160 @@
+#ifndef PUBLISH_EXECUTOR_H
+#define PUBLISH_EXECUTOR_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ros/ros.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief Publishes messages from its own thread, off the read loop
+ *
+ * The read loop hands each message to the topic's queue, which only copies it,
+ * and the executor thread does the serialization and the TCPROS / intraprocess
+ * hand off.  A slow subscriber can then only back up that topic's queue, what
+ * happens once it is full depends on the topic's policy:
+ *  - latest: only the newest message is kept, older unsent ones are replaced
+ *  - fifo: up to depth messages are kept, the oldest is dropped to make room
+ *  - lossless: nothing is dropped, the queue grows past depth (and diagnostics warn)
+ *
+ * Topics are served round robin, one message at a time, so a topic that backs
+ * up doesn't starve the others.
+ */
+class PublishExecutor
+{
+public:
+  typedef enum
+  {
+    POLICY_LATEST,
+    POLICY_FIFO,
+    POLICY_LOSSLESS
+  } policy_t;
+
+  // "latest", "fifo" or "lossless", false if it is none of those
+  static bool parse_policy(const std::string& name, policy_t& policy);
+  static const char* policy_name(policy_t policy);
+
+  class Topic
+  {
+  public:
+    Topic(const std::string& name, const ros::Publisher& pub, policy_t policy, size_t depth);
+    virtual ~Topic() {}
+
+  protected:
+    friend class PublishExecutor;
+
+    // Called with the executor's mutex held
+    virtual bool empty() const = 0;
+    virtual size_t depth() const = 0;
+    // Move the oldest message out, with the mutex held, then publish it without
+    virtual void take() = 0;
+    virtual void publish_taken() = 0;
+
+    std::string name_;
+    ros::Publisher pub_;
+    policy_t policy_;
+    size_t depth_;
+
+    uint64_t dropped_;
+    size_t max_depth_; // since the last diagnostics
+    uint64_t reported_drops_;
+  };
+
+  template <typename T>
+  class TopicQueue : public Topic
+  {
+  public:
+    TopicQueue(PublishExecutor* executor, const std::string& name, const ros::Publisher& pub, policy_t policy,
+               size_t depth) :
+      Topic(name, pub, policy, depth), executor_(executor)
+    {}
+
+    // From the read loop, never blocks on a subscriber
+    void push(const T& msg)
+    {
+      {
+        std::lock_guard<std::mutex> lock(executor_->mutex_);
+        if (policy_ != POLICY_LOSSLESS && queue_.size() >= depth_)
+        {
+          queue_.pop_front();
+          dropped_++;
+        }
+        queue_.push_back(msg);
+        max_depth_ = std::max(max_depth_, queue_.size());
+      }
+      executor_->ready_.notify_one();
+    }
+
+  protected:
+    bool empty() const { return queue_.empty(); }
+    size_t depth() const { return queue_.size(); }
+    void take()
+    {
+      taken_ = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    void publish_taken() { pub_.publish(taken_); }
+
+  private:
+    PublishExecutor* executor_;
+    std::deque<T> queue_;
+    T taken_; // executor thread only
+  };
+
+  PublishExecutor();
+  ~PublishExecutor();
+
+  /**
+   * @brief add
+   * Register a topic, before or after start()
+   * @param depth - messages kept for fifo, the diagnostics warning threshold for lossless
+   *  (latest always keeps one)
+   */
+  template <typename T>
+  TopicQueue<T>* add(const std::string& name, const ros::Publisher& pub, policy_t policy, size_t depth)
+  {
+    TopicQueue<T>* topic = new TopicQueue<T>(this, name, pub, policy, policy == POLICY_LATEST ? 1 : std::max<size_t>(depth, 1));
+    std::lock_guard<std::mutex> lock(mutex_);
+    topics_.emplace_back(topic);
+    return topic;
+  }
+
+  /**
+   * @brief remove
+   * Drop a topic and whatever it still has queued, once nothing pushes to it anymore.
+   * Waits if it is being published right now
+   */
+  void remove(Topic* topic);
+
+  void start();
+
+  // Publishes what is queued, then stops the thread
+  void stop();
+
+  /**
+   * @brief fill_diagnostics
+   * Append a status with every topic's queue depth and drops
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id);
+
+private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable published_; // signalled when busy_ is done
+  Topic* busy_; // being published, outside the mutex
+  std::vector<std::unique_ptr<Topic>> topics_;
+  size_t next_; // round robin position
+  bool running_;
+  std::thread thread_;
+};
+
+#endif // PUBLISH_EXECUTOR_H
@@ -0,0 +1,123 @@
+#ifndef RAW_STREAM_SERVER_H
+#define RAW_STREAM_SERVER_H
+
+#include <poll.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief Re-serves the raw serial stream to local TCP and Unix-domain socket clients
+ *
+ * Everything runs on the thread that reads the serial port and nothing blocks:
+ * sockets are non-blocking, and each client has its own output buffer.  When a
+ * client can't keep up its listener's drop policy decides what to lose, so a
+ * slow client never holds up parsing or the other clients.  Only whole frames
+ * (ISB packets and ASCII sentences) are dropped, and clients start at the first
+ * frame after they connect, so they never see a truncated one.
+ *
+ * Bytes sent by clients are forwarded to the uINS a whole packet (ISB frame or
+ * NMEA/ASCII sentence) at a time, so commands from several clients can't be
+ * interleaved mid-packet.
+ */
+class RawStreamServer
+{
+public:
+  typedef enum
+  {
+    DROP_OLDEST, // discard the oldest buffered frames to make room
+    DROP_NEWEST, // discard the frames that don't fit
+    DISCONNECT   // close the client
+  } policy_t;
+
+  /**
+   * @param buffer_size - bytes buffered per client before the drop policy applies
+   */
+  RawStreamServer(size_t buffer_size = 65536);
+  ~RawStreamServer();
+
+  /**
+   * @brief listen
+   * @param url - "tcp://host:port" ("tcp://:port" for every interface) or "unix:///path",
+   *  optionally followed by "?policy=drop_oldest|drop_newest|disconnect"
+   * @return false (after logging why) if the socket couldn't be opened
+   */
+  bool listen(const std::string& url);
+
+  // Send bytes read from the serial port to every client
+  void broadcast(const uint8_t* data, int len);
+
+  /**
+   * @brief poll_fds
+   * Append the listening sockets and the clients (for POLLOUT too while they have output
+   * buffered), so a poll() loop wakes up to accept, flush and forward commands
+   */
+  void poll_fds(std::vector<struct pollfd>& fds) const;
+
+  /**
+   * @brief service
+   * Accept new clients, flush buffered output and collect commands
+   * @param forward - called with each complete packet a client sent
+   */
+  void service(const std::function<void(const uint8_t*, int)>& forward);
+
+  bool listening() const { return !listeners_.empty(); }
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id) const;
+
+private:
+  typedef struct
+  {
+    int fd;
+    std::string url;
+    policy_t policy;
+  } listener_t;
+
+  typedef struct
+  {
+    int fd;
+    std::string name;
+    policy_t policy;
+    std::vector<uint8_t> out; // ring of pending output
+    size_t out_head;
+    size_t out_len;
+    uint64_t out_pos;            // bytes queued or sent so far, up to out_head
+    std::deque<uint64_t> starts; // out_pos of each frame starting in the ring
+    bool joined;                 // seen the start of a frame, nothing is sent before
+    bool skipping;               // dropping until the next frame starts
+    std::vector<uint8_t> in;  // partial command
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t commands;
+  } client_t;
+
+  bool send_pending(client_t& c);
+  // Find where frames start in data, into frame_starts_
+  void find_frames(const uint8_t* data, size_t len);
+  // Queue data[base...], the bytes of broadcast data from base on
+  void queue(client_t& c, const uint8_t* data, size_t len, size_t base);
+  void append(client_t& c, const uint8_t* data, size_t len);
+  void add_dropped(client_t& c, size_t bytes);
+  void read_commands(client_t& c, const std::function<void(const uint8_t*, int)>& forward);
+  void close_client(size_t i, const char* reason);
+
+  size_t buffer_size_;
+  std::vector<listener_t> listeners_;
+  std::vector<client_t> clients_;
+  bool in_packet_;                   // between an ISB start and end byte, across broadcasts
+  std::vector<size_t> frame_starts_; // offsets in the data being broadcast
+  std::vector<uint64_t> new_starts_; // the same as a client's out_pos
+
+  // Read by fill_diagnostics() from whichever thread runs the timer
+  std::atomic<int> client_count_;
+  std::atomic<uint64_t> sent_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> commands_;
+  std::atomic<uint64_t> disconnects_;
+};
+
+#endif // RAW_STREAM_SERVER_H
@@ -0,0 +1,96 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+#define WAKEUP_BUCKETS 24 // power of two microseconds, the last one catches everything from ~8 s up
+
+/**
+ * @brief Opt-in real-time setup for the threads that read and parse the ports
+ *
+ * Failures (usually missing CAP_SYS_NICE / CAP_IPC_LOCK or rtprio/memlock limits)
+ * are logged and otherwise ignored, the node still runs, just without the
+ * guarantees.
+ */
+class RealTime
+{
+public:
+  typedef struct
+  {
+    int cpu = -1;      // core to pin to, -1 to leave the affinity alone
+    int priority = 0;  // SCHED_FIFO priority 1-99, 0 to stay SCHED_OTHER
+  } thread_options_t;
+
+  /**
+   * @brief lock_memory
+   * mlockall() the process, keep freed heap in the process and fault in
+   * @param heap_bytes - heap to touch now so later allocations don't page fault
+   * @return false if the memory couldn't be locked
+   */
+  static bool lock_memory(size_t heap_bytes);
+
+  /**
+   * @brief configure_thread
+   * Pin and set the scheduling of the calling thread, and fault in its stack
+   * @param name - thread name for top/ps, at most 15 characters
+   * @param stack_bytes - stack to touch now
+   */
+  static void configure_thread(const char* name, const thread_options_t& options, size_t stack_bytes);
+};
+
+/**
+ * @brief How late a thread wakes up after a timed wait expires
+ *
+ * Every wait that ran out its timeout (a read or poll that returned without
+ * data) records how much longer than the timeout it took to get the CPU back,
+ * which is the scheduling latency the read loop sees.  Written by one thread,
+ * fill_diagnostics() may run on another.
+ */
+class WakeupStats
+{
+public:
+  WakeupStats();
+
+  static inline double now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  // Record a wait of timeout_s seconds that took elapsed_s
+  void add(double timeout_s, double elapsed_s);
+
+  /**
+   * @brief fill_diagnostics
+   * Append the wakeup delays since the previous call
+   * @param name - which thread, added to the status name
+   * @param warn_us - delay above which the status warns
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id, const std::string& name,
+                        double warn_us);
+
+private:
+  static inline void inc(std::atomic<uint64_t>& counter, uint64_t n)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_us_;
+  std::atomic<uint64_t> max_us_; // since the last fill_diagnostics(), reset there
+  std::atomic<uint64_t> buckets_[WAKEUP_BUCKETS];
+
+  // Diagnostics side only
+  uint64_t last_count_;
+  uint64_t last_sum_us_;
+  uint64_t last_buckets_[WAKEUP_BUCKETS];
+};
+
+#endif // REALTIME_H
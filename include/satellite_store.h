@@ -0,0 +1,104 @@
+#ifndef SATELLITE_STORE_H
+#define SATELLITE_STORE_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "data_sets.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief The satellites in DID_GPS1_SAT, by constellation and svId, with the
+ * carrier to noise ratio of each over the last HISTORY epochs
+ *
+ * Each update() turns the uINS's channel list into events: a satellite
+ * appeared (started being tracked, cno above 0), disappeared (not tracked for
+ * hold epochs) or its cno moved by cno_step or more since its last event.
+ * Most epochs only a few satellites change, so the events are a small
+ * fraction of the full list.
+ *
+ * Satellites live in fixed slots, looked up through a table indexed by
+ * constellation and svId.  Each field is an array over the slots, and the cno
+ * history is one row of SLOTS bytes per epoch in a ring, so an epoch is
+ * written as one row and a satellite's history read down a column.
+ */
+class SatelliteStore
+{
+public:
+  static const int SLOTS = 128;
+  static const int HISTORY = 64; // epochs, about a minute at the 1 Hz GPS1_SAT rate
+
+  enum { APPEARED, DISAPPEARED, CNO_CHANGED };
+
+  typedef struct
+  {
+    uint8_t type;
+    uint8_t gnss_id;
+    uint8_t sv_id;
+    uint8_t cno;
+  } event_t;
+
+  /**
+   * @param cno_step - dB-Hz a satellite's cno must move from its last event for another
+   * @param hold - epochs a satellite must go untracked before it disappears
+   */
+  SatelliteStore(int cno_step = 3, int hold = 2);
+  // Before the first update()
+  void set_thresholds(int cno_step, int hold);
+
+  /**
+   * @brief update
+   * Add an epoch
+   * @param events - replaced with what changed
+   */
+  void update(const gps_sat_t& sats, std::vector<event_t>& events);
+
+  // Satellites tracked in the last epoch, in slot order.  From the thread calling update()
+  bool tracked(int slot) const { return tracked_[slot]; }
+  uint8_t gnss_id(int slot) const { return gnss_id_[slot]; }
+  uint8_t sv_id(int slot) const { return sv_id_[slot]; }
+  uint8_t cno(int slot) const { return history_[head_][slot]; }
+  int tracked_count() const { return tracked_count_; }
+
+  /**
+   * @brief fill_diagnostics
+   * Append a status with each satellite's cno, and its mean and minimum over the history,
+   * nothing before the first epoch
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id);
+
+private:
+  static const int CONSTELLATIONS = 8;
+  static const uint8_t NO_SLOT = 0xFF;
+
+  // The satellite's slot, taking a free one if it has none (fresh), -1 with all taken
+  int slot_for(uint8_t gnss_id, uint8_t sv_id, bool& fresh);
+  void release(int slot);
+
+  int cno_step_;
+  int hold_;
+
+  uint8_t slot_of_[CONSTELLATIONS * 256];
+
+  // Per slot
+  bool used_[SLOTS];
+  bool tracked_[SLOTS];
+  uint8_t gnss_id_[SLOTS];
+  uint8_t sv_id_[SLOTS];
+  uint8_t reported_cno_[SLOTS]; // as of the last event
+  uint8_t missed_[SLOTS];       // epochs in a row untracked
+
+  // cno per epoch and slot, 0 when not tracked (columns are cleared when a slot is freed).
+  // Rows are a ring, head_ the newest
+  uint8_t history_[HISTORY][SLOTS];
+  int head_;
+  int tracked_count_;
+  uint64_t epochs_total_;
+  uint64_t overflows_;   // satellites dropped with every slot taken
+
+  std::mutex mutex_;     // between update() and fill_diagnostics()
+};
+
+#endif // SATELLITE_STORE_H
@@ -0,0 +1,103 @@
+#ifndef SERIAL_WRITER_H
+#define SERIAL_WRITER_H
+
+#include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "serialPort.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+/**
+ * @brief Prioritized, non-blocking queue of writes to the uINS
+ *
+ * Any thread may push() a packet.  The read loop calls service() after every
+ * read, which writes only as much as the port accepts without waiting, so a
+ * burst of corrections can never stall parsing.  Packets are written whole and
+ * in priority order: a packet that has started goes out before anything else,
+ * then the highest priority queue is drained first.
+ *
+ * Corrections age quickly, so when their queue is full the oldest ones are
+ * dropped.  Commands are refused when their queue is full, and configuration
+ * writes are never dropped.
+ */
+class SerialWriter
+{
+public:
+  typedef enum
+  {
+    PRIORITY_CORRECTION, // RTK/RTCM corrections
+    PRIORITY_COMMAND,    // packets forwarded from raw stream clients
+    PRIORITY_CONFIG,     // flash config and other settings from the node
+    PRIORITY_COUNT
+  } priority_t;
+
+  /**
+   * @param max_queue_bytes - limit for each of the correction and command queues
+   */
+  SerialWriter(size_t max_queue_bytes = 16384);
+  void set_max_queue_bytes(size_t bytes) { max_queue_bytes_ = bytes; }
+
+  /**
+   * @brief push
+   * @param stamp - ROS time (seconds) the data was generated, 0 if unknown.  Used for the
+   *  correction age
+   * @return false if the packet was refused
+   */
+  bool push(priority_t priority, const uint8_t* data, int len, double stamp = 0);
+
+  // Write what the port will take right now, from the read thread
+  void service(serial_port_t* port);
+
+  // Anything left to write, from the read thread
+  bool pending();
+
+  /**
+   * @brief fill_diagnostics
+   * Append a status for the corrections and writes since the previous call
+   * @param max_age - seconds after which the last correction counts as stale
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id, double max_age);
+
+private:
+  typedef std::chrono::steady_clock steady_clock_t;
+
+  typedef struct
+  {
+    std::vector<uint8_t> data;
+    size_t offset;
+    steady_clock_t::time_point received;
+    double stamp;
+    priority_t priority;
+  } packet_t;
+
+  typedef struct
+  {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t dropped;
+    double latency_sum; // push to write completion, seconds, since the last diagnostics
+    double latency_max;
+    uint64_t latency_count;
+  } counters_t;
+
+  void finished(const packet_t& p);
+
+  size_t max_queue_bytes_;
+  std::mutex mutex_;
+  std::deque<packet_t> queues_[PRIORITY_COUNT];
+  size_t queued_bytes_[PRIORITY_COUNT];
+  counters_t counters_[PRIORITY_COUNT];
+  double last_correction_stamp_; // ROS time of the newest correction written
+  bool got_correction_;
+  uint64_t reported_drops_; // corrections dropped as of the last diagnostics
+
+  // Read thread only
+  packet_t inflight_;
+  bool has_inflight_;
+};
+
+#endif // SERIAL_WRITER_H
@@ -0,0 +1,111 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "ISComm.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+#define STATS_MAX_DID 128
+
+/**
+ * @brief Link and per-DID counters for the serial stream
+ *
+ * Counters are written only by the thread that reads and parses the port and
+ * may be read from any thread, so they are relaxed atomics updated with plain
+ * load/store instead of locked read-modify-write instructions.
+ */
+class StreamStats
+{
+public:
+  StreamStats();
+
+  // Parser side
+  void add_read(int bytes)
+  {
+    inc(link_.read_calls, 1);
+    inc(link_.bytes, bytes);
+    if ((uint64_t)bytes > link_.max_read.load(std::memory_order_relaxed))
+      link_.max_read.store(bytes, std::memory_order_relaxed);
+  }
+  // poll(), ioctl() and other calls made to service the port besides read()
+  void add_syscalls(int n) { inc(link_.syscalls, n); }
+  // UDP datagrams dropped for not fitting the receive buffer
+  void add_truncated(int n) { inc(link_.truncated, n); }
+  void set_read_buffer(size_t bytes) { read_buffer_.store(bytes, std::memory_order_relaxed); }
+  void add_frame(uint32_t did, uint32_t bytes, const uint8_t* data);
+  void add_bad_frame()
+  {
+    inc(link_.bad_frames, 1);
+    in_error_ = true;
+  }
+
+  // Setup
+  void set_baudrate(int baudrate) { baudrate_ = baudrate; }
+  void set_expected_period(uint32_t did, double period_s);
+
+  /**
+   * @brief fill_diagnostics
+   * Append a status for the link and for every DID seen so far, with rates over the
+   * interval since the previous call
+   * @param dt - seconds since the previous call
+   */
+  void fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id, double dt);
+
+  // Device timestamp of a frame in seconds, or a negative number if the DID doesn't carry one
+  static double device_time(uint32_t did, const uint8_t* data);
+  static std::string did_name(uint32_t did);
+
+  uint64_t bytes() const { return link_.bytes.load(std::memory_order_relaxed); }
+  uint64_t frames() const { return link_.frames.load(std::memory_order_relaxed); }
+  uint64_t bad_frames() const { return link_.bad_frames.load(std::memory_order_relaxed); }
+  double byte_rate() const { return byte_rate_; } // as of the last fill_diagnostics()
+
+private:
+  typedef struct
+  {
+    std::atomic<uint64_t> read_calls;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> bad_frames;
+    std::atomic<uint64_t> resyncs;
+    std::atomic<uint64_t> syscalls;
+    std::atomic<uint64_t> truncated;
+    std::atomic<uint64_t> max_read; // since the last fill_diagnostics(), reset there
+  } link_counters_t;
+
+  typedef struct
+  {
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> dropped;
+    std::atomic<double> expected_period; // seconds, 0 = learn from the stream
+    std::atomic<double> min_period;      // shortest gap between device timestamps
+    double last_time;                    // parser thread only
+  } did_counters_t;
+
+  typedef struct
+  {
+    uint64_t read_calls, bytes, frames, bad_frames, resyncs, syscalls, truncated;
+    uint64_t did_frames[STATS_MAX_DID];
+    uint64_t did_dropped[STATS_MAX_DID];
+  } snapshot_t;
+
+  static inline void inc(std::atomic<uint64_t>& counter, uint64_t n)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  link_counters_t link_;
+  did_counters_t did_[STATS_MAX_DID];
+  bool in_error_;
+  int baudrate_;
+  std::atomic<size_t> read_buffer_;
+
+  snapshot_t last_; // diagnostics side only
+  double byte_rate_;
+};
+
+#endif // STREAM_STATS_H
@@ -0,0 +1,172 @@
+#ifndef UINS_SIMULATOR_H
+#define UINS_SIMULATOR_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "ISComm.h"
+
+/**
+ * @brief Stand-in for a uINS on the other end of a pseudo-terminal
+ *
+ * Opens a pty pair and behaves like the device on the master side: it answers
+ * flash config get/set, RMC and get-data stream requests, DID_CONFIG reset and
+ * mag-cal commands, and emits synthetic (or replayed) data at the requested
+ * rates.  The node connects to the slave side through its normal `port`
+ * parameter.  With options_t::listen set it serves a TCP or UDP socket instead,
+ * for exercising the network transports.
+ */
+class UINSSimulator
+{
+public:
+  typedef struct
+  {
+    std::string link;        // optional symlink to the slave side, e.g. /tmp/ttyUINS
+    std::string listen;      // tcp://host:port or udp://host:port[?local=port] to use instead of a pty
+    std::string replay_file; // raw capture to stream instead of synthetic data
+    int baudrate = 3000000;  // output is paced to this rate (0 = unpaced)
+
+    // Stream rate overrides in Hz (0 = use whatever the node asks for)
+    double ins_hz = 0;
+    double imu_hz = 0;
+    double gps_hz = 0;
+    double sat_hz = 0;
+    double mag_hz = 0;
+    double baro_hz = 0;
+    double strobe_hz = 0;
+
+    // Fault injection
+    double byte_error_rate = 0; // probability of flipping a bit in each outgoing byte
+    int stall_period_ms = 0;    // every stall_period_ms, stop output for stall_ms
+    int stall_ms = 0;
+    int reset_ms = 1000;        // time the device stays silent after a DID_CONFIG reset
+
+    bool verbose = false;
+  } options_t;
+
+  // Called for every synthetic frame right before it is encoded, so callers can stamp payloads
+  typedef std::function<void(uint32_t did, uint32_t seq, void* data, uint32_t size)> payload_hook_t;
+  // Called once the last byte of a frame has been written to the pty
+  typedef std::function<void(uint32_t did, uint32_t seq)> written_hook_t;
+
+  UINSSimulator(const options_t& options);
+  ~UINSSimulator();
+
+  bool open();
+  void close();
+  // pty slave device, or the listen url
+  const std::string& port() const { return slave_name_; }
+
+  /**
+   * @brief spin_once
+   * Service the pty for at most timeout_ms: handle requests, emit due frames
+   * and push queued bytes out at the configured baud rate
+   */
+  void spin_once(int timeout_ms);
+  void run();
+  void stop() { running_ = false; }
+
+  void set_payload_hook(payload_hook_t hook) { payload_hook_ = hook; }
+  void set_written_hook(written_hook_t hook) { written_hook_ = hook; }
+
+  /**
+   * @brief encode_data
+   * Encode a PID_DATA frame the way the uINS sends it
+   * @return number of bytes written to out, or 0 if it didn't fit
+   */
+  static int encode_data(uint32_t did, const void* data, uint32_t size, uint32_t offset,
+                         uint8_t counter, uint8_t* out, int out_size);
+
+  /**
+   * @brief synthesize
+   * Fill buf with a synthetic sample of did at t seconds after start
+   * @return size of the sample, 0 if did is not simulated
+   */
+  uint32_t synthesize(uint32_t did, double t, uint8_t* buf);
+
+  uint64_t bytes_written() const { return bytes_written_; }
+  uint64_t frames_written() const { return frames_written_; }
+
+private:
+  typedef struct
+  {
+    uint32_t did;
+    uint32_t base_period_ms; // device rate for a period multiple of 1
+    uint32_t period_ms;      // 0 = not streaming
+    double next_due;         // seconds since start
+    uint32_t seq;
+  } stream_t;
+
+  typedef struct
+  {
+    std::vector<uint8_t> bytes;
+    size_t pos;
+    uint32_t did;
+    uint32_t seq;
+  } out_frame_t;
+
+  void handle_rx(const uint8_t* buf, int len);
+  void handle_packet(uint8_t* pkt, int len);
+  void handle_get_data(const p_data_get_t* req);
+  void handle_set_data(const p_data_hdr_t* hdr, const uint8_t* data);
+  void set_rmc(uint64_t bits);
+  void stop_streams();
+  void reset_device();
+
+  stream_t* find_stream(uint32_t did);
+  double override_hz(uint32_t did) const;
+  void emit_due_streams();
+  void emit_replay();
+  void send_data(uint32_t did, const void* data, uint32_t size, uint32_t offset, uint32_t seq);
+  void flush_output();
+
+  double now() const;
+  bool stalled(double t) const;
+  bool open_network();
+  int read_input(uint8_t* buf, int len);
+  int write_output(const uint8_t* buf, int len);
+
+  options_t options_;
+  int master_fd_; // pty master, or the connected TCP client / UDP socket
+  int slave_fd_;
+  int listen_fd_; // TCP server socket
+  bool udp_;
+  struct sockaddr_storage peer_; // where UDP output goes
+  socklen_t peer_len_;
+  bool fixed_peer_;
+  std::string slave_name_;
+  bool running_;
+
+  std::vector<stream_t> streams_;
+  nvm_flash_cfg_t flash_;
+  mag_cal_t mag_cal_;
+  ascii_msgs_t ascii_;
+  double reset_until_;
+  double start_;
+
+  std::vector<uint8_t> rx_;
+  std::deque<out_frame_t> tx_;
+  double tx_budget_;
+  double tx_last_;
+  uint8_t pkt_counter_;
+
+  std::vector<uint8_t> replay_;
+  size_t replay_pos_;
+
+  std::mt19937 rng_;
+  std::uniform_real_distribution<double> uniform_;
+  std::normal_distribution<double> noise_;
+
+  payload_hook_t payload_hook_;
+  written_hook_t written_hook_;
+  uint64_t bytes_written_;
+  uint64_t frames_written_;
+};
+
+#endif // UINS_SIMULATOR_H
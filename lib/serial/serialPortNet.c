@@ -0,0 +1,460 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // recvmmsg
+#endif
+
+#include "serialPortNet.h"
+#include "serialPortPlatform.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define NET_CONNECT_TIMEOUT_MS	3000
+#define NET_UDP_BATCH			16		// datagrams per recvmmsg
+#define NET_UDP_DATAGRAM		2048	// largest datagram kept whole
+
+typedef struct
+{
+	// same first members as serialPortHandle in serialPortPlatform.c, so serialPortPlatformGetFd works
+	int blocking;
+	int fd;
+
+	int udp;
+	int closed;
+
+	// where udp writes go, fixed by the url or the last sender
+	struct sockaddr_storage peer;
+	socklen_t peerLen;
+	int fixedPeer;
+
+	// datagrams received by the last recvmmsg that have not been read yet
+	unsigned char rx[NET_UDP_BATCH][NET_UDP_DATAGRAM];
+	struct sockaddr_storage rxFrom[NET_UDP_BATCH];
+	struct mmsghdr rxMsgs[NET_UDP_BATCH];
+	struct iovec rxIov[NET_UDP_BATCH];
+	int rxCount;
+	int rxIndex;
+	int rxPos;
+
+	// datagrams longer than NET_UDP_DATAGRAM, dropped rather than passed on cut short
+	int truncated;
+} serialPortNetHandle;
+
+int serialPortIsNetworkUrl(const char* port)
+{
+	return port != 0 && (strncmp(port, "tcp://", 6) == 0 || strncmp(port, "udp://", 6) == 0);
+}
+
+// split scheme://host:port?local=port, host may be empty or a [bracketed] IPv6 address
+static int netParseUrl(const char* url, int* udp, char* host, int hostSize, char* port, int portSize, char* local, int localSize)
+{
+	if (!serialPortIsNetworkUrl(url))
+	{
+		return 0;
+	}
+	*udp = (url[0] == 'u');
+	const char* p = url + 6;
+	const char* query = strchr(p, '?');
+	const char* end = query ? query : p + strlen(p);
+	const char* colon = 0;
+	for (const char* c = p; c < end; c++)
+	{
+		if (*c == ':')
+		{
+			colon = c;
+		}
+	}
+	if (colon == 0 || colon + 1 >= end || colon - p >= hostSize || end - colon - 1 >= portSize)
+	{
+		return 0;
+	}
+	const char* h = p;
+	int hLen = (int)(colon - p);
+	if (hLen >= 2 && h[0] == '[' && h[hLen - 1] == ']')
+	{
+		h++;
+		hLen -= 2;
+	}
+	memcpy(host, h, hLen);
+	host[hLen] = '\0';
+	memcpy(port, colon + 1, end - colon - 1);
+	port[end - colon - 1] = '\0';
+
+	local[0] = '\0';
+	if (query)
+	{
+		if (strncmp(query, "?local=", 7) != 0 || (int)strlen(query + 7) >= localSize)
+		{
+			return 0;
+		}
+		strcpy(local, query + 7);
+	}
+	return 1;
+}
+
+static int netConnectTcp(const char* host, const char* port)
+{
+	struct addrinfo hints, *res = 0, *ai;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host[0] ? host : "localhost", port, &hints, &res) != 0)
+	{
+		return -1;
+	}
+
+	int fd = -1;
+	for (ai = res; ai != 0 && fd < 0; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+		{
+			continue;
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+		{
+			int error = errno;
+			if (error == EINPROGRESS)
+			{
+				struct pollfd pfd;
+				pfd.fd = fd;
+				pfd.events = POLLOUT;
+				socklen_t len = sizeof(error);
+				if (poll(&pfd, 1, NET_CONNECT_TIMEOUT_MS) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+				{
+					error = ETIMEDOUT;
+				}
+			}
+			if (error != 0)
+			{
+				close(fd);
+				fd = -1;
+				errno = error;
+				continue;
+			}
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int netOpenUdp(serialPortNetHandle* handle, const char* host, const char* port, const char* local)
+{
+	struct addrinfo hints, *res = 0;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	int family = AF_INET;
+	if (host[0])
+	{
+		if (getaddrinfo(host, port, &hints, &res) != 0)
+		{
+			return -1;
+		}
+		memcpy(&handle->peer, res->ai_addr, res->ai_addrlen);
+		handle->peerLen = res->ai_addrlen;
+		handle->fixedPeer = 1;
+		family = res->ai_family;
+		freeaddrinfo(res);
+	}
+
+	hints.ai_family = family;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(0, local[0] ? local : port, &hints, &res) != 0)
+	{
+		return -1;
+	}
+	int fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
+	int one = 1;
+	if (fd >= 0)
+	{
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+	if (fd >= 0 && bind(fd, res->ai_addr, res->ai_addrlen) != 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int serialPortOpenNet(serial_port_t* serialPort, const char* port, int baudRate, int blocking)
+{
+	(void)baudRate;
+	if (serialPort->handle != 0)
+	{
+		// already open
+		return 0;
+	}
+	serialPortSetPort(serialPort, port);
+
+	int udp;
+	char host[256], service[32], local[32];
+	if (!netParseUrl(port, &udp, host, sizeof(host), service, sizeof(service), local, sizeof(local)))
+	{
+		return 0;
+	}
+
+	serialPortNetHandle* handle = (serialPortNetHandle*)calloc(sizeof(serialPortNetHandle), 1);
+	handle->blocking = blocking;
+	handle->udp = udp;
+	handle->fd = udp ? netOpenUdp(handle, host, service, local) : netConnectTcp(host, service);
+	if (handle->fd < 0)
+	{
+		free(handle);
+		return 0;
+	}
+	for (int i = 0; i < NET_UDP_BATCH; i++)
+	{
+		handle->rxIov[i].iov_base = handle->rx[i];
+		handle->rxIov[i].iov_len = NET_UDP_DATAGRAM;
+	}
+	serialPort->handle = handle;
+	return 1;
+}
+
+static int serialPortIsOpenNet(serial_port_t* serialPort)
+{
+	serialPortNetHandle* handle = (serialPortNetHandle*)serialPort->handle;
+	return handle != 0 && !handle->closed;
+}
+
+static int serialPortCloseNet(serial_port_t* serialPort)
+{
+	serialPortNetHandle* handle = (serialPortNetHandle*)serialPort->handle;
+	if (handle == 0)
+	{
+		// not open, no close needed
+		return 0;
+	}
+	close(handle->fd);
+	free(handle);
+	serialPort->handle = 0;
+	return 1;
+}
+
+// copy out whatever has already arrived, returns bytes copied or -1 if the connection is gone
+static int netReadAvailable(serialPortNetHandle* handle, unsigned char* buffer, int readCount)
+{
+	if (!handle->udp)
+	{
+		int n = (int)recv(handle->fd, buffer, readCount, MSG_DONTWAIT);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		{
+			handle->closed = 1;
+			return -1;
+		}
+		return n < 0 ? 0 : n;
+	}
+
+	int total = 0;
+	while (total < readCount)
+	{
+		if (handle->rxIndex >= handle->rxCount)
+		{
+			// one syscall for everything that is queued, up to NET_UDP_BATCH datagrams
+			for (int i = 0; i < NET_UDP_BATCH; i++)
+			{
+				memset(&handle->rxMsgs[i].msg_hdr, 0, sizeof(handle->rxMsgs[i].msg_hdr));
+				handle->rxMsgs[i].msg_hdr.msg_iov = &handle->rxIov[i];
+				handle->rxMsgs[i].msg_hdr.msg_iovlen = 1;
+				handle->rxMsgs[i].msg_hdr.msg_name = &handle->rxFrom[i];
+				handle->rxMsgs[i].msg_hdr.msg_namelen = sizeof(handle->rxFrom[i]);
+			}
+			int n = recvmmsg(handle->fd, handle->rxMsgs, NET_UDP_BATCH, MSG_DONTWAIT, 0);
+			if (n <= 0)
+			{
+				break;
+			}
+			handle->rxCount = n;
+			handle->rxIndex = 0;
+			handle->rxPos = 0;
+			for (int i = 0; i < n; i++)
+			{
+				// the rest of the datagram is gone, and half a frame would only fail its checksum
+				if (handle->rxMsgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+				{
+					handle->rxMsgs[i].msg_len = 0;
+					handle->truncated++;
+				}
+			}
+			if (!handle->fixedPeer)
+			{
+				memcpy(&handle->peer, &handle->rxFrom[n - 1], handle->rxMsgs[n - 1].msg_hdr.msg_namelen);
+				handle->peerLen = handle->rxMsgs[n - 1].msg_hdr.msg_namelen;
+			}
+		}
+
+		int i = handle->rxIndex;
+		int left = (int)handle->rxMsgs[i].msg_len - handle->rxPos;
+		int n = (left < readCount - total ? left : readCount - total);
+		memcpy(buffer + total, handle->rx[i] + handle->rxPos, n);
+		total += n;
+		handle->rxPos += n;
+		if (handle->rxPos >= (int)handle->rxMsgs[i].msg_len)
+		{
+			handle->rxIndex++;
+			handle->rxPos = 0;
+		}
+	}
+	return total;
+}
+
+static int serialPortReadTimeoutNet(serial_port_t* serialPort, unsigned char* buffer, int readCount, int timeoutMilliseconds)
+{
+	serialPortNetHandle* handle = (serialPortNetHandle*)serialPort->handle;
+	if (timeoutMilliseconds < 0)
+	{
+		timeoutMilliseconds = (handle->blocking ? SERIAL_PORT_DEFAULT_TIMEOUT : 0);
+	}
+
+	int totalRead = 0;
+	unsigned long long start = serialPortPlatformMonotonicMs();
+	while (1)
+	{
+		int n = netReadAvailable(handle, buffer + totalRead, readCount - totalRead);
+		if (n < 0)
+		{
+			break;
+		}
+		totalRead += n;
+		if (totalRead >= readCount || timeoutMilliseconds <= 0)
+		{
+			break;
+		}
+
+		int remainingMilliseconds = serialPortPlatformRemainingMs(start, timeoutMilliseconds);
+		if (remainingMilliseconds <= 0)
+		{
+			break;
+		}
+		struct pollfd pfd;
+		pfd.fd = handle->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, remainingMilliseconds) <= 0)
+		{
+			break;
+		}
+	}
+	return totalRead;
+}
+
+static int serialPortAsyncReadNet(serial_port_t* serialPort, unsigned char* buffer, int readCount, pfnSerialPortAsyncReadCompletion completion)
+{
+	// no support for async, just call the completion right away
+	int n = netReadAvailable((serialPortNetHandle*)serialPort->handle, buffer, readCount);
+	completion(serialPort, buffer, (n < 0 ? 0 : n), (n >= 0 ? 0 : n));
+	return 1;
+}
+
+static int serialPortWriteNet(serial_port_t* serialPort, const unsigned char* buffer, int writeCount)
+{
+	serialPortNetHandle* handle = (serialPortNetHandle*)serialPort->handle;
+	if (handle->udp)
+	{
+		if (handle->peerLen == 0)
+		{
+			// nobody to send to until the first datagram arrives
+			return 0;
+		}
+		int n = (int)sendto(handle->fd, buffer, writeCount, MSG_DONTWAIT, (struct sockaddr*)&handle->peer, handle->peerLen);
+		return n < 0 ? 0 : n;
+	}
+
+	int written = 0;
+	while (written < writeCount)
+	{
+		int n = (int)send(handle->fd, buffer + written, writeCount - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			written += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			handle->closed = 1;
+		}
+		// with the socket buffer full, return what went out rather than wait on the peer; the
+		// caller keeps the rest and polls for POLLOUT
+		break;
+	}
+	return written;
+}
+
+static int serialPortFlushNet(serial_port_t* serialPort)
+{
+	serialPortNetHandle* handle = (serialPortNetHandle*)serialPort->handle;
+	unsigned char discard[1024];
+	handle->rxIndex = handle->rxCount = 0;
+	while (netReadAvailable(handle, discard, sizeof(discard)) > 0)
+	{
+	}
+	return 1;
+}
+
+static int serialPortGetByteCountAvailableToReadNet(serial_port_t* serialPort)
+{
+	serialPortNetHandle* handle = (serialPortNetHandle*)serialPort->handle;
+	int bytesAvailable = 0;
+	ioctl(handle->fd, FIONREAD, &bytesAvailable);
+	for (int i = handle->rxIndex; i < handle->rxCount; i++)
+	{
+		bytesAvailable += (int)handle->rxMsgs[i].msg_len - (i == handle->rxIndex ? handle->rxPos : 0);
+	}
+	return bytesAvailable;
+}
+
+static int serialPortGetByteCountAvailableToWriteNet(serial_port_t* serialPort)
+{
+	(void)serialPort;
+	return 65536;
+}
+
+static int serialPortSleepNet(serial_port_t* serialPort, int sleepMilliseconds)
+{
+	(void)serialPort;
+	usleep(sleepMilliseconds * 1000);
+	return 1;
+}
+
+int serialPortNetTakeTruncated(serial_port_t* serialPort)
+{
+	serialPortNetHandle* handle = (serialPortNetHandle*)serialPort->handle;
+	if (serialPort->pfnRead != serialPortReadTimeoutNet || handle == 0)
+	{
+		return 0;
+	}
+	int truncated = handle->truncated;
+	handle->truncated = 0;
+	return truncated;
+}
+
+int serialPortNetInit(serial_port_t* serialPort)
+{
+	serialPort->pfnClose = serialPortCloseNet;
+	serialPort->pfnFlush = serialPortFlushNet;
+	serialPort->pfnOpen = serialPortOpenNet;
+	serialPort->pfnIsOpen = serialPortIsOpenNet;
+	serialPort->pfnRead = serialPortReadTimeoutNet;
+	serialPort->pfnAsyncRead = serialPortAsyncReadNet;
+	serialPort->pfnWrite = serialPortWriteNet;
+	serialPort->pfnGetByteCountAvailableToRead = serialPortGetByteCountAvailableToReadNet;
+	serialPort->pfnGetByteCountAvailableToWrite = serialPortGetByteCountAvailableToWriteNet;
+	serialPort->pfnSleep = serialPortSleepNet;
+	return 1;
+}
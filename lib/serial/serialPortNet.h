@@ -0,0 +1,29 @@
+#ifndef __IS_SERIALPORT_NET_H
+#define __IS_SERIALPORT_NET_H
+
+#include "serialPort.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// returns 1 if port is a network url (tcp://... or udp://...) rather than a device path
+	int serialPortIsNetworkUrl(const char* port);
+
+	// assign function pointers for a network transport, the url is then passed to serialPortOpen:
+	//  tcp://host:port - connect to a TCP server such as ser2net, with TCP_NODELAY
+	//  udp://host:port[?local=port] - exchange datagrams with host:port, received on the local port
+	//   (same number as the remote one by default), udp://:port only listens and replies to the last sender
+	// the baud rate passed to serialPortOpen is ignored, serialPortPlatformGetFd works on these ports too
+	// returns 1 if success
+	int serialPortNetInit(serial_port_t* serialPort);
+
+	// udp datagrams dropped since the last call because they were longer than the receive buffer
+	// (2048 bytes), returns 0 for tcp and for ports that aren't network ports
+	int serialPortNetTakeTruncated(serial_port_t* serialPort);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __IS_SERIALPORT_NET_H
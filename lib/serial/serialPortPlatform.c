@@ -22,6 +22,7 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <errno.h>
@@ -481,22 +482,22 @@ static int serialPortReadTimeoutPlatformWindows(serialPortHandle* handle, unsign
 static int serialPortReadTimeoutPlatformLinux(serialPortHandle* handle, unsigned char* buffer, int readCount, int timeoutMilliseconds)
 {
 	int totalRead = 0;
-	int dtMs;
 	int n;
-	struct timeval start, curr;
+	int remainingMilliseconds = timeoutMilliseconds;
+	unsigned long long start = 0;
 	if (timeoutMilliseconds > 0)
 	{
-		gettimeofday(&start, NULL);
+		start = serialPortPlatformMonotonicMs();
 	}
 
 	while (1)
 	{
-		if (timeoutMilliseconds > 0)
+		if (remainingMilliseconds > 0)
 		{
 			struct pollfd fds[1];
 			fds[0].fd = handle->fd;
 			fds[0].events = POLLIN;
-			int pollrc = poll(fds, 1, timeoutMilliseconds);
+			int pollrc = poll(fds, 1, remainingMilliseconds);
 			if (pollrc <= 0 || !(fds[0].revents & POLLIN))
 			{
 				break;
@@ -514,15 +515,12 @@ static int serialPortReadTimeoutPlatformLinux(serialPortHandle* handle, unsigned
 		}
 		if (timeoutMilliseconds > 0 && totalRead < readCount)
 		{
-			gettimeofday(&curr, NULL);
-			dtMs = ((curr.tv_sec - start.tv_sec) * 1000) + ((curr.tv_usec - start.tv_usec) / 1000);
-			if (dtMs >= timeoutMilliseconds)
+			// try for another loop around with what is left of the timeout
+			remainingMilliseconds = serialPortPlatformRemainingMs(start, timeoutMilliseconds);
+			if (remainingMilliseconds <= 0)
 			{
 				break;
 			}
-
-			// try for another loop around with a lower timeout
-			timeoutMilliseconds = _MAX(0, timeoutMilliseconds - dtMs);
 		}
 		else
 		{
@@ -710,3 +708,73 @@ int serialPortPlatformInit(serial_port_t* serialPort)
 	serialPort->pfnSleep = serialPortSleepPlatform;
 	return 0;
 }
+
+int serialPortPlatformSetReadThreshold(serial_port_t* serialPort, int minBytes)
+{
+	int fd = serialPortPlatformGetFd(serialPort);
+
+#if PLATFORM_IS_WINDOWS
+
+	(void)fd;
+	(void)minBytes;
+	return 0;
+
+#else
+
+	struct termios tty;
+	if (fd < 0 || !isatty(fd) || tcgetattr(fd, &tty) != 0)
+	{
+		return 0;
+	}
+
+	// with VTIME 0, poll() only reports the port readable once VMIN bytes are waiting
+	tty.c_cc[VMIN] = (cc_t)_MAX(1, _MIN(minBytes, 255));
+	tty.c_cc[VTIME] = 0;
+	return tcsetattr(fd, TCSANOW, &tty) == 0;
+
+#endif
+
+}
+
+unsigned long long serialPortPlatformMonotonicMs(void)
+{
+
+#if PLATFORM_IS_WINDOWS
+
+	return GetTickCount64();
+
+#else
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+#endif
+
+}
+
+int serialPortPlatformRemainingMs(unsigned long long startMs, int timeoutMilliseconds)
+{
+	unsigned long long elapsed = serialPortPlatformMonotonicMs() - startMs;
+	return (elapsed >= (unsigned long long)timeoutMilliseconds ? 0 : timeoutMilliseconds - (int)elapsed);
+}
+
+int serialPortPlatformGetFd(serial_port_t* serialPort)
+{
+	serialPortHandle* handle = (serialPortHandle*)serialPort->handle;
+	if (handle == 0)
+	{
+		return -1;
+	}
+
+#if PLATFORM_IS_WINDOWS
+
+	return -1;
+
+#else
+
+	return handle->fd;
+
+#endif
+
+}
@@ -23,6 +23,21 @@ extern "C" {
 	// returns non-zero if success, 0 if platform not implemented
 	int serialPortPlatformInit(serial_port_t* serialPort);
 
+	// file descriptor of an open port, for use with poll/select
+	// returns -1 if the port is not open or the platform has no file descriptors
+	int serialPortPlatformGetFd(serial_port_t* serialPort);
+
+	// let the tty driver batch input: poll() reports the port readable only once minBytes (1-255)
+	// are waiting, reads on the non-blocking port still return whatever is there
+	// works on any tty opened by serialPortOpen, returns 1 if success, 0 if not a tty
+	int serialPortPlatformSetReadThreshold(serial_port_t* serialPort, int minBytes);
+
+	// monotonic clock in milliseconds, so a clock step can't end a timeout early or stretch it out
+	unsigned long long serialPortPlatformMonotonicMs(void);
+
+	// milliseconds left of timeoutMilliseconds since startMs (from serialPortPlatformMonotonicMs), 0 once it has run out
+	int serialPortPlatformRemainingMs(unsigned long long startMs, int timeoutMilliseconds);
+
 #ifdef __cplusplus
 }
 #endif
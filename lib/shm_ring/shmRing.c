@@ -0,0 +1,270 @@
+#include "shmRing.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_RING_LINE	64
+
+static shm_ring_slot_t* shmRingSlot(const shm_ring_t* ring, uint64_t seq)
+{
+	const shm_ring_header_t* h = ring->header;
+	return (shm_ring_slot_t*)((uint8_t*)ring->map + sizeof(shm_ring_header_t) + (size_t)(seq & (h->slotCount - 1)) * h->slotSize);
+}
+
+static size_t shmRingMapSize(uint32_t slotSize, uint32_t slotCount)
+{
+	return sizeof(shm_ring_header_t) + (size_t)slotSize * slotCount;
+}
+
+int shmRingCreate(shm_ring_t* ring, const char* name, uint32_t did, uint32_t recordSize, uint32_t slotCount)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+
+	uint32_t count = 1;
+	while (count < slotCount)
+	{
+		count <<= 1;
+	}
+	uint32_t slotSize = (uint32_t)((sizeof(shm_ring_slot_t) + recordSize + SHM_RING_LINE - 1) / SHM_RING_LINE * SHM_RING_LINE);
+	size_t mapSize = shmRingMapSize(slotSize, count);
+
+	// start from a fresh object so readers still mapping an old one never see it change shape
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	if (ftruncate(fd, (off_t)mapSize) != 0)
+	{
+		close(fd);
+		shm_unlink(name);
+		return 0;
+	}
+	void* map = mmap(0, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		close(fd);
+		shm_unlink(name);
+		return 0;
+	}
+
+	// ftruncate zero filled it, so every slot starts out as "not written"
+	shm_ring_header_t* h = (shm_ring_header_t*)map;
+	h->version = SHM_RING_VERSION;
+	h->did = did;
+	h->recordSize = recordSize;
+	h->slotSize = slotSize;
+	h->slotCount = count;
+	h->writerOpen = 1;
+	h->head = 0;
+	__atomic_store_n(&h->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+	ring->fd = fd;
+	ring->map = map;
+	ring->mapSize = mapSize;
+	ring->header = h;
+	ring->writer = 1;
+	return 1;
+}
+
+void shmRingWrite(shm_ring_t* ring, const void* data, uint32_t size, double rosTime, double deviceTime)
+{
+	shm_ring_header_t* h = ring->header;
+	uint64_t seq = h->head;
+	shm_ring_slot_t* slot = shmRingSlot(ring, seq);
+	if (size > h->recordSize)
+	{
+		size = h->recordSize;
+	}
+
+	__atomic_store_n(&slot->seq, 2 * seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->rosTime = rosTime;
+	slot->deviceTime = deviceTime;
+	slot->size = size;
+	memcpy(slot + 1, data, size);
+	__atomic_store_n(&slot->seq, 2 * seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&h->head, seq + 1, __ATOMIC_RELEASE);
+}
+
+int shmRingOpen(shm_ring_t* ring, const char* name)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(shm_ring_header_t))
+	{
+		close(fd);
+		return 0;
+	}
+	void* map = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		close(fd);
+		return 0;
+	}
+
+	shm_ring_header_t* h = (shm_ring_header_t*)map;
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || h->version != SHM_RING_VERSION ||
+		h->slotCount == 0 || (h->slotCount & (h->slotCount - 1)) != 0 ||
+		shmRingMapSize(h->slotSize, h->slotCount) > (size_t)st.st_size)
+	{
+		munmap(map, (size_t)st.st_size);
+		close(fd);
+		return 0;
+	}
+
+	ring->fd = fd;
+	ring->map = map;
+	ring->mapSize = (size_t)st.st_size;
+	ring->header = h;
+	ring->writer = 0;
+	return 1;
+}
+
+void shmRingClose(shm_ring_t* ring)
+{
+	if (ring->map == 0)
+	{
+		return;
+	}
+	if (ring->writer)
+	{
+		__atomic_store_n(&ring->header->writerOpen, 0, __ATOMIC_RELEASE);
+	}
+	munmap(ring->map, ring->mapSize);
+	close(ring->fd);
+	ring->map = 0;
+	ring->header = 0;
+	ring->fd = -1;
+}
+
+uint64_t shmRingHead(const shm_ring_t* ring)
+{
+	return __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+}
+
+int shmRingWriterOpen(const shm_ring_t* ring)
+{
+	return __atomic_load_n(&ring->header->writerOpen, __ATOMIC_ACQUIRE) != 0;
+}
+
+int shmRingRead(const shm_ring_t* ring, uint64_t seq, void* data, uint32_t size, shm_ring_info_t* info)
+{
+	shm_ring_slot_t* slot = shmRingSlot(ring, seq);
+	uint64_t expected = 2 * seq + 2;
+	uint64_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (before != expected)
+	{
+		return before < expected ? SHM_RING_NOT_READY : SHM_RING_OVERWRITTEN;
+	}
+
+	double rosTime = slot->rosTime;
+	double deviceTime = slot->deviceTime;
+	uint32_t n = slot->size;
+	if (n > size)
+	{
+		n = size;
+	}
+	if (n > ring->header->recordSize)
+	{
+		n = ring->header->recordSize;
+	}
+	memcpy(data, slot + 1, n);
+
+	// anything the writer started after our first look bumps the version
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != before)
+	{
+		return SHM_RING_OVERWRITTEN;
+	}
+
+	if (info)
+	{
+		info->seq = seq;
+		info->rosTime = rosTime;
+		info->deviceTime = deviceTime;
+	}
+	return SHM_RING_OK;
+}
+
+int shmRingLatest(const shm_ring_t* ring, void* data, uint32_t size, shm_ring_info_t* info)
+{
+	for (;;)
+	{
+		uint64_t head = shmRingHead(ring);
+		if (head == 0)
+		{
+			return 0;
+		}
+		// only fails when the writer wraps the whole ring mid copy, then there is a newer one
+		if (shmRingRead(ring, head - 1, data, size, info) == SHM_RING_OK)
+		{
+			return 1;
+		}
+	}
+}
+
+int shmRingNext(const shm_ring_t* ring, uint64_t* cursor, void* data, uint32_t size, shm_ring_info_t* info, uint64_t* missed)
+{
+	for (;;)
+	{
+		int result = shmRingRead(ring, *cursor, data, size, info);
+		if (result == SHM_RING_OK)
+		{
+			(*cursor)++;
+			return SHM_RING_OK;
+		}
+		if (result == SHM_RING_NOT_READY)
+		{
+			return SHM_RING_NOT_READY;
+		}
+
+		// lapped, skip to the oldest record with a little headroom so we don't race the writer for it
+		uint64_t head = shmRingHead(ring);
+		uint64_t count = ring->header->slotCount;
+		uint64_t oldest = head > count ? head - count + (count > 4 ? count / 4 : 0) : 0;
+		if (oldest <= *cursor)
+		{
+			oldest = *cursor + 1;
+		}
+		if (missed)
+		{
+			*missed += oldest - *cursor;
+		}
+		*cursor = oldest;
+	}
+}
+
+const void* shmRingPeek(const shm_ring_t* ring, uint64_t seq, shm_ring_info_t* info)
+{
+	shm_ring_slot_t* slot = shmRingSlot(ring, seq);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != 2 * seq + 2)
+	{
+		return 0;
+	}
+	if (info)
+	{
+		info->seq = seq;
+		info->rosTime = slot->rosTime;
+		info->deviceTime = slot->deviceTime;
+	}
+	return slot + 1;
+}
+
+int shmRingStillValid(const shm_ring_t* ring, uint64_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&shmRingSlot(ring, seq)->seq, __ATOMIC_RELAXED) == 2 * seq + 2;
+}
@@ -0,0 +1,190 @@
+#ifndef __IS_SHMRING_H
+#define __IS_SHMRING_H
+
+// Single writer, many reader ring of fixed size records in POSIX shared memory.
+//
+// Every slot carries a seqlock style version: the writer sets it to 2n+1 while record n is being
+// written and to 2n+2 once it is complete.  A reader checks the version before and after copying a
+// record, so it never blocks the writer, never makes a syscall and never sees a torn record.
+// Readers that fall more than slotCount records behind lose the oldest records and are told so.
+//
+// Only this file and shmRing.c are needed to read a ring from a non-ROS process
+// (link with -lrt on older glibc).  The record types are the uINS structs from data_sets.h.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC		0x49534852	// "ISHR"
+#define SHM_RING_VERSION	1
+
+// suffixes the ROS node appends to ~shm_name for each ring
+#define SHM_RING_IMU		".imu"		// dual_imu_t, deviceTime is time since boot
+#define SHM_RING_INS		".ins"		// ins_2_t, deviceTime is GPS time of week
+#define SHM_RING_GPS		".gps"		// gps_nav_t, deviceTime is GPS time of week
+
+// results of shmRingRead and shmRingNext
+#define SHM_RING_OK				1
+#define SHM_RING_NOT_READY		0	// record has not been written yet
+#define SHM_RING_OVERWRITTEN	-1	// writer has already reused the slot
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t did;			// uINS data id of the records
+	uint32_t recordSize;	// bytes of payload in each slot
+	uint32_t slotSize;		// bytes from one slot to the next
+	uint32_t slotCount;		// power of two
+	uint32_t writerOpen;	// cleared when the writer closes the ring
+	uint32_t reserved[9];
+
+	// sequence number of the next record to be written, on its own cache line
+	uint64_t head;
+	uint64_t reserved2[7];
+} shm_ring_header_t;
+
+typedef struct
+{
+	uint64_t seq;			// 2n+1 while record n is written, 2n+2 once it is complete
+	double rosTime;			// ROS time the record was stamped with, seconds
+	double deviceTime;		// time carried in the record, seconds
+	uint32_t size;
+	uint32_t reserved;
+} shm_ring_slot_t;
+
+typedef struct
+{
+	uint64_t seq;			// record number, increases by one per record
+	double rosTime;
+	double deviceTime;
+} shm_ring_info_t;
+
+typedef struct
+{
+	int fd;
+	void* map;
+	size_t mapSize;
+	shm_ring_header_t* header;
+	int writer;
+} shm_ring_t;
+
+// create (or replace) the ring called name, e.g. "/inertial_sense.imu", and map it for writing
+// slotCount is rounded up to a power of two, returns 1 if success, 0 if failure
+int shmRingCreate(shm_ring_t* ring, const char* name, uint32_t did, uint32_t recordSize, uint32_t slotCount);
+
+// append a record, only one thread may write a ring
+void shmRingWrite(shm_ring_t* ring, const void* data, uint32_t size, double rosTime, double deviceTime);
+
+// open an existing ring read only, returns 1 if success, 0 if failure
+int shmRingOpen(shm_ring_t* ring, const char* name);
+
+// unmap the ring, when the writer closes it readers see shmRingWriterOpen go to 0 but can still read
+// the records left in it until the next shmRingCreate replaces it
+void shmRingClose(shm_ring_t* ring);
+
+// number of records written so far, the newest is head - 1
+uint64_t shmRingHead(const shm_ring_t* ring);
+
+// returns 1 while the writer still has the ring open
+int shmRingWriterOpen(const shm_ring_t* ring);
+
+// copy record seq into data (at most size bytes), returns SHM_RING_OK, SHM_RING_NOT_READY or SHM_RING_OVERWRITTEN
+int shmRingRead(const shm_ring_t* ring, uint64_t seq, void* data, uint32_t size, shm_ring_info_t* info);
+
+// copy the newest record, returns 1 if there was one, 0 if nothing has been written
+int shmRingLatest(const shm_ring_t* ring, void* data, uint32_t size, shm_ring_info_t* info);
+
+// copy the record at *cursor and advance it, for streaming every record in order
+// if the writer has lapped the reader, *cursor jumps to the oldest record still in the ring and
+// the number of records skipped is added to *missed (which may be null)
+// returns SHM_RING_OK or SHM_RING_NOT_READY
+int shmRingNext(const shm_ring_t* ring, uint64_t* cursor, void* data, uint32_t size, shm_ring_info_t* info, uint64_t* missed);
+
+// zero copy access: pointer to record seq inside the ring, or null if it is not there (yet or any more)
+// the contents may change underneath the caller, so anything read from it is only good if
+// shmRingStillValid(ring, seq) returns 1 afterwards
+const void* shmRingPeek(const shm_ring_t* ring, uint64_t seq, shm_ring_info_t* info);
+int shmRingStillValid(const shm_ring_t* ring, uint64_t seq);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+
+/**
+ * @brief Typed reader for a ring of T
+ *
+ *   ShmRingReader<dual_imu_t> imu;
+ *   if (imu.open("/inertial_sense" SHM_RING_IMU))
+ *     while (running)
+ *       while (imu.next(sample, &info))
+ *         ...
+ */
+template<typename T>
+class ShmRingReader
+{
+public:
+  ShmRingReader() : cursor_(0), missed_(0) { ring_.map = 0; }
+  ~ShmRingReader() { close(); }
+
+  // Open the ring and start streaming from the newest record, false if it is missing or not of T
+  bool open(const std::string& name)
+  {
+    close();
+    if (!shmRingOpen(&ring_, name.c_str()))
+      return false;
+    if (ring_.header->recordSize != sizeof(T))
+    {
+      close();
+      return false;
+    }
+    cursor_ = shmRingHead(&ring_);
+    missed_ = 0;
+    return true;
+  }
+
+  void close()
+  {
+    if (ring_.map)
+      shmRingClose(&ring_);
+    ring_.map = 0;
+  }
+
+  bool is_open() const { return ring_.map != 0; }
+  bool writer_open() const { return shmRingWriterOpen(&ring_); }
+
+  // Newest record, false if nothing has been written yet
+  bool latest(T& data, shm_ring_info_t* info = 0) const
+  {
+    return shmRingLatest(&ring_, &data, sizeof(T), info) == 1;
+  }
+
+  // Next record in order, false when caught up with the writer
+  bool next(T& data, shm_ring_info_t* info = 0)
+  {
+    return shmRingNext(&ring_, &cursor_, &data, sizeof(T), info, &missed_) == SHM_RING_OK;
+  }
+
+  // Rewind to the oldest record still in the ring
+  void rewind()
+  {
+    uint64_t head = shmRingHead(&ring_);
+    cursor_ = head > ring_.header->slotCount ? head - ring_.header->slotCount : 0;
+  }
+
+  // Records next() has skipped because the writer lapped us
+  uint64_t missed() const { return missed_; }
+
+private:
+  shm_ring_t ring_;
+  uint64_t cursor_;
+  uint64_t missed_;
+};
+
+#endif // __cplusplus
+
+#endif // __IS_SHMRING_H
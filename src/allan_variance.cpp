@@ -0,0 +1,259 @@
+#include "allan_variance.h"
+#include "diagnostics_util.h"
+
+#include <math.h>
+#include <algorithm>
+
+void AllanVariance::dual_imu_sample(const dual_imu_t& imu, float* sample)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    for (int a = 0; a < 3; a++)
+    {
+      sample[6 * i + a] = imu.I[i].pqr[a];
+      sample[6 * i + 3 + a] = imu.I[i].acc[a];
+    }
+  }
+}
+
+std::vector<std::string> AllanVariance::dual_imu_names()
+{
+  std::vector<std::string> names;
+  for (int i = 1; i <= 2; i++)
+  {
+    for (int sensor = 0; sensor < 2; sensor++)
+    {
+      for (int a = 0; a < 3; a++)
+        names.push_back("imu" + std::to_string(i) + (sensor ? "_acc_" : "_gyro_") + "xyz"[a]);
+    }
+  }
+  return names;
+}
+
+AllanVariance::AllanVariance(int channels, int overlap, int levels) :
+  channels_(channels), overlap_(1), levels_(std::min(std::max(levels, 1), 62))
+{
+  while (overlap_ < overlap)
+    overlap_ *= 2;
+
+  ring_.resize(levels_);
+  for (int j = 0; j < levels_; j++)
+  {
+    uint64_t m = cluster(j);
+    uint64_t stride = std::max<uint64_t>(m / overlap_, 1);
+    ring_[j].resize((2 * m / stride + 1) * channels_);
+  }
+  head_.resize(levels_);
+  filled_.resize(levels_);
+  sum_.resize(levels_ * channels_);
+  count_.resize(levels_);
+  offset_.resize(channels_);
+  theta_.resize(channels_);
+  reset();
+}
+
+void AllanVariance::reset(uint64_t first)
+{
+  first_ = n_ = first;
+  from_ = 0;
+  until_ = UINT64_MAX;
+  offset_set_ = false;
+  std::fill(theta_.begin(), theta_.end(), 0.0);
+  std::fill(head_.begin(), head_.end(), 0);
+  std::fill(filled_.begin(), filled_.end(), 0);
+  std::fill(sum_.begin(), sum_.end(), 0.0);
+  std::fill(count_.begin(), count_.end(), 0);
+}
+
+void AllanVariance::set_window(uint64_t from, uint64_t until)
+{
+  from_ = from;
+  until_ = until;
+}
+
+void AllanVariance::set_offset(const float* offset)
+{
+  for (int c = 0; c < channels_; c++)
+    offset_[c] = offset[c];
+  offset_set_ = true;
+}
+
+void AllanVariance::push(const float* sample)
+{
+  if (!offset_set_)
+    set_offset(sample);
+
+  store(n_);
+  double* theta = theta_.data();
+  const double* offset = offset_.data();
+  for (int c = 0; c < channels_; c++)
+    theta[c] += sample[c] - offset[c];
+  n_++;
+}
+
+void AllanVariance::finish()
+{
+  store(n_);
+}
+
+void AllanVariance::store(uint64_t index)
+{
+  const int C = channels_;
+  for (int j = 0; j < levels_; j++)
+  {
+    // Strided by the absolute index, so engines over different ranges agree on which clusters exist.
+    // Strides are powers of two that only grow, so the first level skipped ends the pass
+    uint64_t m = cluster(j);
+    uint64_t stride = std::max<uint64_t>(m / overlap_, 1);
+    if (index & (stride - 1))
+      break;
+
+    std::vector<double>& ring = ring_[j];
+    int slots = ring.size() / C;
+    int newest = head_[j];
+    std::copy(theta_.begin(), theta_.end(), ring.begin() + newest * C);
+    head_[j] = newest + 1 < slots ? newest + 1 : 0;
+    if (filled_[j] < slots)
+      filled_[j]++;
+    if (filled_[j] < slots)
+      continue;
+
+    uint64_t start = index - 2 * m;
+    if (start < from_ || start >= until_)
+      continue;
+
+    // With the ring full the oldest slot is the one written next
+    int middle = newest - (int)(m / stride);
+    if (middle < 0)
+      middle += slots;
+    const double* a = &ring[newest * C];
+    const double* b = &ring[middle * C];
+    const double* o = &ring[head_[j] * C];
+    double* sum = &sum_[j * C];
+    for (int c = 0; c < C; c++)
+    {
+      double d = a[c] - 2.0 * b[c] + o[c];
+      sum[c] += d * d;
+    }
+    count_[j]++;
+  }
+}
+
+void AllanVariance::merge(const AllanVariance& other)
+{
+  for (size_t i = 0; i < sum_.size() && i < other.sum_.size(); i++)
+    sum_[i] += other.sum_[i];
+  for (size_t j = 0; j < count_.size() && j < other.count_.size(); j++)
+    count_[j] += other.count_[j];
+}
+
+void AllanVariance::curve(int channel, double dt, std::vector<point_t>& points) const
+{
+  points.clear();
+  for (int j = 0; j < levels_; j++)
+  {
+    if (count_[j] == 0)
+      continue;
+    double m = cluster(j);
+    uint64_t stride = std::max<uint64_t>(cluster(j) / overlap_, 1);
+    point_t p;
+    p.tau = m * dt;
+    p.adev = sqrt(sum_[j * channels_ + channel] / (2.0 * m * m * count_[j]));
+    p.clusters = count_[j] * stride / m;
+    points.push_back(p);
+  }
+}
+
+AllanVariance::noise_t AllanVariance::fit(const std::vector<point_t>& all)
+{
+  noise_t noise = {};
+  std::vector<point_t> points;
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].clusters >= 8 && all[i].adev > 0)
+      points.push_back(all[i]);
+  }
+  if (points.size() < 3)
+    return noise;
+  noise.valid = true;
+
+  // Log-log slope at each point, from its neighbours
+  std::vector<double> slope(points.size());
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    size_t a = i > 0 ? i - 1 : i;
+    size_t b = i + 1 < points.size() ? i + 1 : i;
+    slope[i] = log(points[b].adev / points[a].adev) / log(points[b].tau / points[a].tau);
+  }
+
+  size_t min = 0;
+  for (size_t i = 1; i < points.size(); i++)
+  {
+    if (points[i].adev < points[min].adev)
+      min = i;
+  }
+  noise.bias_instability = points[min].adev / 0.664;
+  noise.bias_instability_tau = points[min].tau;
+
+  // Nearest point to tau on the slope, extended along it
+  int white = -1;
+  int walk = -1;
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    double distance = fabs(log(points[i].tau));
+    if (i <= min && fabs(slope[i] + 0.5) < 0.25 && (white < 0 || distance < fabs(log(points[white].tau))))
+      white = i;
+    distance = fabs(log(points[i].tau / 3.0));
+    if (i >= min && fabs(slope[i] - 0.5) < 0.25 && (walk < 0 || distance < fabs(log(points[walk].tau / 3.0))))
+      walk = i;
+  }
+
+  // Without a clear -1/2 slope the shortest clusters are still mostly white noise
+  if (white < 0)
+    white = 0;
+  noise.white_noise = points[white].adev * sqrt(points[white].tau);
+  if (walk >= 0)
+    noise.random_walk = points[walk].adev * sqrt(3.0 / points[walk].tau);
+  return noise;
+}
+
+void AllanVariance::write_csv(FILE* file, const std::vector<std::string>& names,
+                              const std::vector<std::vector<point_t> >& curves, const std::vector<noise_t>& noise)
+{
+  fprintf(file, "channel,tau_s,adev,clusters,white_noise,bias_instability,bias_instability_tau_s,random_walk\n");
+  for (size_t c = 0; c < curves.size(); c++)
+  {
+    for (size_t i = 0; i < curves[c].size(); i++)
+    {
+      const point_t& p = curves[c][i];
+      fprintf(file, "%s,%.6g,%.6g,%.0f,%.6g,%.6g,%.6g,%.6g\n", names[c].c_str(), p.tau, p.adev, p.clusters,
+              noise[c].white_noise, noise[c].bias_instability, noise[c].bias_instability_tau, noise[c].random_walk);
+    }
+  }
+}
+
+void AllanVariance::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id,
+                                     const std::vector<std::string>& names, double dt) const
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: allan";
+  status.hardware_id = hardware_id;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.1f h of samples", samples() * dt / 3600.0);
+  status.message = buf;
+
+  std::vector<point_t> points;
+  for (int c = 0; c < channels_ && c < (int)names.size(); c++)
+  {
+    curve(c, dt, points);
+    noise_t noise = fit(points);
+    if (!noise.valid)
+      continue;
+    status.values.push_back(key_value(names[c] + " white noise", noise.white_noise, "%.4g"));
+    status.values.push_back(key_value(names[c] + " bias instability", noise.bias_instability, "%.4g"));
+    status.values.push_back(key_value(names[c] + " bias instability tau", noise.bias_instability_tau, "%.4g"));
+    status.values.push_back(key_value(names[c] + " random walk", noise.random_walk, "%.4g"));
+  }
+  msg.status.push_back(status);
+}
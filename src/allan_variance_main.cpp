@@ -0,0 +1,211 @@
+#include "allan_variance.h"
+#include "ISComm.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+static void usage(const char* name)
+{
+  printf("Usage: %s [options] CAPTURE...\n"
+         "Overlapping Allan deviation of all twelve axes of DID_DUAL_IMU in raw uINS captures\n"
+         "(read in the order given, as one record), with white noise, bias instability and\n"
+         "random walk read off each curve.  Curves go to the CSV output, the fits to stderr.\n\n"
+         "  --output FILE           CSV output (default stdout)\n"
+         "  --threads N             worker threads (default: all cores)\n"
+         "  --ranges N              time ranges per axis to split the work into (default: enough\n"
+         "                          to give every thread an axis and range)\n"
+         "  --overlap N             clusters started per cluster length (default 64)\n"
+         "  --dt SECONDS            sample period, instead of the one from the IMU timestamps\n", name);
+}
+
+typedef struct
+{
+  int channel;
+  uint64_t from;
+  uint64_t until;
+} work_t;
+
+int main(int argc, char** argv)
+{
+  const char* output = NULL;
+  int threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+  int ranges = 0;
+  int overlap = 64;
+  double dt = 0;
+
+  static struct option long_options[] = {
+    { "output", required_argument, 0, 'o' },
+    { "threads", required_argument, 0, 't' },
+    { "ranges", required_argument, 0, 'r' },
+    { "overlap", required_argument, 0, 'v' },
+    { "dt", required_argument, 0, 'd' },
+    { "help", no_argument, 0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "o:t:", long_options, NULL)) != -1)
+  {
+    switch (c)
+    {
+    case 'o': output = optarg; break;
+    case 't': threads = std::max(atoi(optarg), 1); break;
+    case 'r': ranges = std::max(atoi(optarg), 1); break;
+    case 'v': overlap = std::max(atoi(optarg), 1); break;
+    case 'd': dt = atof(optarg); break;
+    default:
+      usage(argv[0]);
+      return c == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Samples are kept channel by channel, each worker reads one channel front to back
+  const int C = AllanVariance::DUAL_IMU_CHANNELS;
+  std::vector<std::vector<float> > samples(C);
+  std::vector<double> times;
+  uint8_t buffer[PKT_BUF_SIZE];
+  is_comm_instance_t comm;
+  comm.buffer = buffer;
+  comm.bufferSize = sizeof(buffer);
+  is_comm_init(&comm);
+  for (int f = optind; f < argc; f++)
+  {
+    FILE* file = fopen(argv[f], "rb");
+    if (!file)
+    {
+      fprintf(stderr, "allan_variance: unable to read \"%s\"\n", argv[f]);
+      return 1;
+    }
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        if (is_comm_parse(&comm, chunk[i]) != DID_DUAL_IMU)
+          continue;
+        const dual_imu_t* imu = (const dual_imu_t*)buffer;
+        float sample[C];
+        AllanVariance::dual_imu_sample(*imu, sample);
+        for (int ch = 0; ch < C; ch++)
+          samples[ch].push_back(sample[ch]);
+        times.push_back(imu->time);
+      }
+    }
+    fclose(file);
+  }
+
+  uint64_t n = times.size();
+  if (n < 16)
+  {
+    fprintf(stderr, "allan_variance: only %llu DID_DUAL_IMU records\n", (unsigned long long)n);
+    return 1;
+  }
+  if (dt <= 0)
+    dt = (times.back() - times.front()) / (n - 1);
+
+  // The variance assumes evenly spaced samples, gaps bias the longer clusters
+  uint64_t gaps = 0;
+  for (uint64_t i = 1; i < n; i++)
+  {
+    if (times[i] - times[i - 1] > 1.5 * dt)
+      gaps++;
+  }
+  fprintf(stderr, "allan_variance: %llu samples, dt %.6f s, %.2f h", (unsigned long long)n, dt, n * dt / 3600.0);
+  if (gaps)
+    fprintf(stderr, ", %llu gaps (dropped frames)", (unsigned long long)gaps);
+  fprintf(stderr, "\n");
+
+  // Cluster sizes up to an eighth of the record, anything longer has too few clusters to mean much
+  int levels = 1;
+  while ((uint64_t(1) << levels) <= n / 8)
+    levels++;
+  uint64_t longest = uint64_t(1) << (levels - 1);
+
+  // Each range is read with the longest cluster's worth of samples past its end, so fewer
+  // ranges are cheaper when there are enough axes to go around
+  if (ranges == 0)
+    ranges = std::max((threads + C - 1) / C, 1);
+  std::vector<work_t> work;
+  for (int ch = 0; ch < C; ch++)
+  {
+    for (int r = 0; r < ranges; r++)
+    {
+      work_t w = { ch, n * r / ranges, n * (r + 1) / ranges };
+      work.push_back(w);
+    }
+  }
+
+  std::vector<AllanVariance> results(work.size(), AllanVariance(1, overlap, levels));
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++)
+  {
+    workers.push_back(std::thread([&]()
+    {
+      size_t i;
+      while ((i = next.fetch_add(1)) < work.size())
+      {
+        const work_t& w = work[i];
+        const std::vector<float>& x = samples[w.channel];
+        AllanVariance& engine = results[i];
+        engine.reset(w.from);
+        engine.set_offset(&x[0]);
+        engine.set_window(w.from, w.until);
+        uint64_t end = std::min(n, w.until + 2 * longest);
+        for (uint64_t k = w.from; k < end; k++)
+          engine.push(&x[k]);
+        if (end == n)
+          engine.finish();
+      }
+    }));
+  }
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  std::vector<std::string> names = AllanVariance::dual_imu_names();
+  std::vector<std::vector<AllanVariance::point_t> > curves(C);
+  std::vector<AllanVariance::noise_t> noise(C);
+  for (int ch = 0; ch < C; ch++)
+  {
+    AllanVariance total(1, overlap, levels);
+    for (size_t i = 0; i < work.size(); i++)
+    {
+      if (work[i].channel == ch)
+        total.merge(results[i]);
+    }
+    total.curve(0, dt, curves[ch]);
+    noise[ch] = AllanVariance::fit(curves[ch]);
+  }
+
+  FILE* file = output ? fopen(output, "w") : stdout;
+  if (!file)
+  {
+    fprintf(stderr, "allan_variance: unable to write \"%s\"\n", output);
+    return 1;
+  }
+  AllanVariance::write_csv(file, names, curves, noise);
+  if (output)
+    fclose(file);
+
+  fprintf(stderr, "%-14s %14s %14s %10s %14s\n", "channel", "white noise", "bias instab.", "at tau s", "random walk");
+  for (int ch = 0; ch < C; ch++)
+  {
+    if (!noise[ch].valid)
+      fprintf(stderr, "%-14s (too short)\n", names[ch].c_str());
+    else
+      fprintf(stderr, "%-14s %14.4g %14.4g %10.3g %14.4g\n", names[ch].c_str(), noise[ch].white_noise,
+              noise[ch].bias_instability, noise[ch].bias_instability_tau, noise[ch].random_walk);
+  }
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include "aux_port.h"
+#include "diagnostics_util.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "serialPortPlatform.h"
+#include "serialPortNet.h"
+#include "ros/ros.h"
+
+AuxPort::AuxPort(size_t buffer_size, size_t queue_frames) :
+  buffer_(buffer_size), frame_bytes_(0), storage_(buffer_size * queue_frames), frames_(queue_frames),
+  head_(0), tail_(0), running_(false), rt_(false), rt_stack_bytes_(0), baudrate_(0), port_open_(false), dropped_(0),
+  late_(0)
+{
+  memset(&serial_, 0, sizeof(serial_));
+  comm_.buffer = buffer_.data();
+  comm_.bufferSize = buffer_.size();
+  is_comm_init(&comm_);
+  for (size_t i = 0; i < frames_.size(); i++)
+    frames_[i].data = &storage_[i * buffer_size];
+}
+
+AuxPort::~AuxPort()
+{
+  running_ = false;
+  if (thread_.joinable())
+    thread_.join();
+  if (serial_.handle && port_open_)
+    serialPortClose(&serial_);
+}
+
+bool AuxPort::open(const std::string& port, int baudrate)
+{
+  name_ = port;
+  baudrate_ = baudrate;
+  if (serialPortIsNetworkUrl(port.c_str()))
+    serialPortNetInit(&serial_);
+  else
+    serialPortPlatformInit(&serial_);
+  if (serialPortOpen(&serial_, port.c_str(), baudrate, true) != 1)
+  {
+    ROS_ERROR("inertialsense: Unable to open second serial port \"%s\", at %d baud", port.c_str(), baudrate);
+    return false;
+  }
+  port_open_ = true;
+  stats_.set_baudrate(baudrate);
+  ROS_INFO("Connected to the second uINS port on \"%s\", at %d baud", port.c_str(), baudrate);
+  return true;
+}
+
+void AuxPort::start(const RealTime::thread_options_t* rt, size_t stack_bytes)
+{
+  rt_ = rt != NULL;
+  if (rt)
+    rt_options_ = *rt;
+  rt_stack_bytes_ = stack_bytes;
+  running_ = true;
+  thread_ = std::thread(&AuxPort::read_loop, this);
+}
+
+void AuxPort::read_loop()
+{
+  if (rt_)
+    RealTime::configure_thread("is_port2", rt_options_, rt_stack_bytes_);
+
+  uint8_t buffer[512];
+  while (running_)
+  {
+    if (!port_open_ && !reopen())
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+
+    // Short timeout so the destructor doesn't wait long on a quiet port
+    double start = WakeupStats::now();
+    int bytes_read = serialPortReadTimeout(&serial_, buffer, sizeof(buffer), 10);
+    if (bytes_read <= 0)
+    {
+      // A port that hung up reads nothing straight away, only poll() tells it from a quiet one
+      if (check_port())
+        continue;
+      if (bytes_read == 0)
+        wakeup_.add(0.010, WakeupStats::now() - start);
+    }
+    stats_.add_read(std::max(bytes_read, 0));
+    stats_.add_truncated(serialPortNetTakeTruncated(&serial_));
+    for (int i = 0; i < bytes_read; i++)
+    {
+      uint32_t did = is_comm_parse(&comm_, buffer[i]);
+      frame_bytes_++;
+      if (did == (uint32_t)-1)
+      {
+        stats_.add_bad_frame();
+        frame_bytes_ = 0;
+      }
+      else if (did != DID_NULL)
+      {
+        stats_.add_frame(did, frame_bytes_, buffer_.data());
+        frame_bytes_ = 0;
+        push(did);
+      }
+    }
+  }
+}
+
+bool AuxPort::check_port()
+{
+  struct pollfd fd = { serialPortPlatformGetFd(&serial_), POLLIN | POLLRDHUP, 0 };
+  if (poll(&fd, 1, 0) <= 0 || !(fd.revents & (POLLHUP | POLLRDHUP | POLLERR | POLLNVAL)))
+    return false;
+  ROS_ERROR("inertialsense: lost second port \"%s\" (%s), reopening it every second", name_.c_str(),
+            (fd.revents & POLLNVAL) ? "invalid descriptor" : (fd.revents & POLLERR) ? "error" : "hung up");
+  serialPortClose(&serial_);
+  port_open_ = false;
+  port_retry_ = steady_clock_t::now();
+  return true;
+}
+
+bool AuxPort::reopen()
+{
+  steady_clock_t::time_point now = steady_clock_t::now();
+  if (now < port_retry_)
+    return false;
+  port_retry_ = now + std::chrono::seconds(1);
+  if (serialPortOpen(&serial_, name_.c_str(), baudrate_, true) != 1)
+    return false;
+
+  ROS_INFO("inertialsense: reopened second port \"%s\"", name_.c_str());
+  port_open_ = true;
+  // A partial frame from before is of no use
+  is_comm_init(&comm_);
+  frame_bytes_ = 0;
+  return true;
+}
+
+void AuxPort::push(uint32_t did)
+{
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) >= frames_.size())
+  {
+    dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return;
+  }
+  frame_t& f = frames_[tail % frames_.size()];
+  f.did = did;
+  f.arrival = steady_clock_t::now();
+  memcpy((uint8_t*)f.data, buffer_.data(), buffer_.size());
+  tail_.store(tail + 1, std::memory_order_release);
+}
+
+const AuxPort::frame_t* AuxPort::front() const
+{
+  size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire))
+    return NULL;
+  return &frames_[head % frames_.size()];
+}
+
+void AuxPort::pop()
+{
+  head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void AuxPort::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, double wakeup_warn_us)
+{
+  wakeup_.fill_diagnostics(msg, name_, "port2 read", wakeup_warn_us);
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: port merge";
+  status.hardware_id = name_;
+  uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  status.level = dropped ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = dropped ? "frames dropped, read loop too slow" : "OK";
+  status.values.push_back(key_value("queued", tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_relaxed)));
+  status.values.push_back(key_value("dropped", dropped));
+  status.values.push_back(key_value("out of order", late_.load(std::memory_order_relaxed)));
+  msg.status.push_back(status);
+}
@@ -0,0 +1,74 @@
+#include "bad_frame_log.h"
+
+#include <string.h>
+#include <algorithm>
+
+BadFrameLog::BadFrameLog() :
+  length_(0), last_(0), head_(0), stored_(0)
+{
+  for (int i = 0; i < 3; i++)
+    counts_[i] = 0;
+}
+
+uint8_t BadFrameLog::bad_frame(uint32_t max_length)
+{
+  uint8_t error;
+  uint32_t captured = std::min<uint32_t>(length_, BAD_FRAME_CAPTURE_SIZE);
+  if (length_ > max_length)
+    error = inertial_sense::BadFrame::LENGTH;
+  else if (length_ < 2 || raw_[0] != PSC_START_BYTE || last_ != PSC_END_BYTE)
+    error = inertial_sense::BadFrame::FRAMING;
+  else
+    error = inertial_sense::BadFrame::CHECKSUM;
+  counts_[error].store(counts_[error].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry_t& e = history_[head_];
+    e.stamp = ros::Time::now();
+    e.error = error;
+    e.length = length_;
+    memcpy(e.data, raw_, captured);
+    head_ = (head_ + 1) % BAD_FRAME_HISTORY;
+    stored_ = std::min<uint32_t>(stored_ + 1, BAD_FRAME_HISTORY);
+  }
+
+  length_ = 0;
+  return error;
+}
+
+const char* BadFrameLog::error_name(uint8_t error)
+{
+  switch (error)
+  {
+  case inertial_sense::BadFrame::CHECKSUM: return "checksum";
+  case inertial_sense::BadFrame::LENGTH:   return "length";
+  case inertial_sense::BadFrame::FRAMING:  return "framing";
+  default:                                 return "unknown";
+  }
+}
+
+uint64_t BadFrameLog::total() const
+{
+  return count(inertial_sense::BadFrame::CHECKSUM) + count(inertial_sense::BadFrame::LENGTH)
+      + count(inertial_sense::BadFrame::FRAMING);
+}
+
+void BadFrameLog::get(uint32_t count, inertial_sense::GetBadFrames::Response& res)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t n = (count == 0) ? stored_ : std::min(count, stored_);
+  res.frames.resize(n);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    const entry_t& e = history_[(head_ + BAD_FRAME_HISTORY - n + i) % BAD_FRAME_HISTORY];
+    inertial_sense::BadFrame& f = res.frames[i];
+    f.stamp = e.stamp;
+    f.error = e.error;
+    f.length = e.length;
+    f.data.assign(e.data, e.data + std::min<uint32_t>(e.length, BAD_FRAME_CAPTURE_SIZE));
+  }
+  res.checksum_errors = this->count(inertial_sense::BadFrame::CHECKSUM);
+  res.length_errors = this->count(inertial_sense::BadFrame::LENGTH);
+  res.framing_errors = this->count(inertial_sense::BadFrame::FRAMING);
+}
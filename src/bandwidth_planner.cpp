@@ -0,0 +1,230 @@
+#include "bandwidth_planner.h"
+#include "diagnostics_util.h"
+
+#include <stdio.h>
+#include <map>
+#include "ros/ros.h"
+
+bool BandwidthPlanner::parse_policy(const std::string& name, policy_t& policy)
+{
+  if (name == "warn")
+    policy = POLICY_WARN;
+  else if (name == "degrade")
+    policy = POLICY_DEGRADE;
+  else if (name == "refuse")
+    policy = POLICY_REFUSE;
+  else
+    return false;
+  return true;
+}
+
+double BandwidthPlanner::frame_bytes(uint32_t payload_size)
+{
+  return (payload_size + IS_FRAME_OVERHEAD) * IS_ESCAPE_FACTOR;
+}
+
+void BandwidthPlanner::add_stream(const std::string& name, bool enabled, bool required)
+{
+  stream_t s;
+  s.name = name;
+  s.enabled = enabled;
+  s.required = required;
+  streams_.push_back(s);
+}
+
+void BandwidthPlanner::add_did(const std::string& stream, uint32_t did, uint32_t size, double period_s)
+{
+  int i = find(stream);
+  if (i < 0 || period_s <= 0)
+    return;
+  item_t item;
+  item.stream = i;
+  item.did = did;
+  item.bytes_per_s = frame_bytes(size) / period_s;
+  items_.push_back(item);
+}
+
+void BandwidthPlanner::add_ascii(const std::string& stream, uint32_t bytes, double period_s)
+{
+  int i = find(stream);
+  if (i < 0 || period_s <= 0)
+    return;
+  item_t item;
+  item.stream = i;
+  item.did = 0;
+  item.bytes_per_s = bytes / period_s;
+  items_.push_back(item);
+}
+
+int BandwidthPlanner::find(const std::string& stream) const
+{
+  for (size_t i = 0; i < streams_.size(); i++)
+  {
+    if (streams_[i].name == stream)
+      return i;
+  }
+  return -1;
+}
+
+bool BandwidthPlanner::enabled(const std::string& stream) const
+{
+  int i = find(stream);
+  return i >= 0 && streams_[i].enabled;
+}
+
+// A DID requested by several streams comes out once, at the fastest of their rates
+static void max_rate(std::map<uint32_t, double>& rates, uint32_t did, double bytes_per_s)
+{
+  double& rate = rates[did];
+  if (bytes_per_s > rate)
+    rate = bytes_per_s;
+}
+
+double BandwidthPlanner::bytes_per_second() const
+{
+  std::map<uint32_t, double> rates;
+  double total = 0;
+  for (size_t i = 0; i < items_.size(); i++)
+  {
+    const item_t& item = items_[i];
+    if (!streams_[item.stream].enabled)
+      continue;
+    if (item.did)
+      max_rate(rates, item.did, item.bytes_per_s);
+    else
+      total += item.bytes_per_s;
+  }
+  for (std::map<uint32_t, double>::const_iterator it = rates.begin(); it != rates.end(); ++it)
+    total += it->second;
+  return total;
+}
+
+// What a stream adds on top of the DIDs the other enabled streams already bring in, including
+// the extra rate of a DID it wants faster than they do
+double BandwidthPlanner::stream_bytes_per_second(int stream) const
+{
+  std::map<uint32_t, double> shared, own;
+  double total = 0;
+  for (size_t i = 0; i < items_.size(); i++)
+  {
+    const item_t& item = items_[i];
+    if (item.stream == stream)
+    {
+      if (item.did)
+        max_rate(own, item.did, item.bytes_per_s);
+      else
+        total += item.bytes_per_s;
+    }
+    else if (streams_[item.stream].enabled && item.did)
+      max_rate(shared, item.did, item.bytes_per_s);
+  }
+  for (std::map<uint32_t, double>::const_iterator it = own.begin(); it != own.end(); ++it)
+  {
+    std::map<uint32_t, double>::const_iterator other = shared.find(it->first);
+    if (other == shared.end())
+      total += it->second;
+    else if (it->second > other->second)
+      total += it->second - other->second;
+  }
+  return total;
+}
+
+bool BandwidthPlanner::plan(double capacity, policy_t policy, const std::vector<std::string>& priority,
+                            std::vector<std::string>& disabled)
+{
+  double planned = bytes_per_second();
+  if (planned <= capacity)
+    return true;
+
+  if (policy == POLICY_WARN)
+  {
+    ROS_WARN("inertialsense: requested streams need %.0f bytes/s but the link only carries %.0f, expect dropped data",
+             planned, capacity);
+    return true;
+  }
+  if (policy == POLICY_REFUSE)
+  {
+    ROS_FATAL("inertialsense: requested streams need %.0f bytes/s but the link only carries %.0f", planned, capacity);
+    return false;
+  }
+
+  // Lowest priority first: unlisted streams in reverse order, then the list from the bottom up
+  std::vector<int> order;
+  for (int i = streams_.size() - 1; i >= 0; i--)
+  {
+    bool listed = false;
+    for (size_t j = 0; j < priority.size(); j++)
+      listed |= (priority[j] == streams_[i].name);
+    if (!listed)
+      order.push_back(i);
+  }
+  for (int j = priority.size() - 1; j >= 0; j--)
+  {
+    int i = find(priority[j]);
+    if (i >= 0)
+      order.push_back(i);
+    else
+      ROS_WARN("inertialsense: unknown stream \"%s\" in bandwidth_priority", priority[j].c_str());
+  }
+
+  for (size_t k = 0; k < order.size() && planned > capacity; k++)
+  {
+    stream_t& s = streams_[order[k]];
+    if (!s.enabled || s.required)
+      continue;
+    s.enabled = false;
+    disabled.push_back(s.name);
+    planned = bytes_per_second();
+    ROS_WARN("inertialsense: disabled stream \"%s\" to fit the link (%.0f of %.0f bytes/s)", s.name.c_str(),
+             planned, capacity);
+  }
+  if (planned > capacity)
+    ROS_WARN("inertialsense: required streams alone need %.0f bytes/s but the link only carries %.0f",
+             planned, capacity);
+  return true;
+}
+
+void BandwidthPlanner::log_plan(double capacity) const
+{
+  double total = bytes_per_second();
+  ROS_INFO("Serial bandwidth plan: %.0f bytes/s of %.0f (%.1f%%)", total, capacity,
+           capacity > 0 ? 100.0 * total / capacity : 0.0);
+  for (size_t i = 0; i < streams_.size(); i++)
+  {
+    if (streams_[i].enabled)
+      ROS_INFO("  %-12s %8.0f bytes/s", streams_[i].name.c_str(), stream_bytes_per_second(i));
+  }
+}
+
+void BandwidthPlanner::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id,
+                                        double capacity, double measured) const
+{
+  double planned = bytes_per_second();
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: bandwidth";
+  status.hardware_id = hardware_id;
+  if (measured > capacity)
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = "Measured throughput exceeds the link budget";
+  }
+  else if (planned > 0 && (measured > 1.25 * planned || measured < 0.75 * planned))
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = "Measured throughput differs from the plan";
+  }
+  else
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = "OK";
+  }
+  status.values.push_back(key_value("planned bytes/s", planned));
+  status.values.push_back(key_value("measured bytes/s", measured));
+  status.values.push_back(key_value("budget bytes/s", capacity));
+  for (size_t i = 0; i < streams_.size(); i++)
+  {
+    if (streams_[i].enabled)
+      status.values.push_back(key_value(streams_[i].name + " planned bytes/s", stream_bytes_per_second(i)));
+  }
+  msg.status.push_back(status);
+}
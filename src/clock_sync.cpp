@@ -0,0 +1,67 @@
+#include "clock_sync.h"
+
+#include <math.h>
+#include <algorithm>
+
+ClockSync::ClockSync(double window) :
+  window_(window)
+{}
+
+int ClockSync::add_clock(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  device_clock_t c;
+  c.name = name;
+  c.valid = false;
+  c.current_min = c.previous_min = 0;
+  c.window_start = 0;
+  c.jumps = 0;
+  clocks_.push_back(c);
+  return clocks_.size() - 1;
+}
+
+ros::Time ClockSync::to_ros(int clock, double device_time, const ros::Time& arrival)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  device_clock_t& c = clocks_[clock];
+  double now = arrival.toSec();
+  double sample = now - device_time;
+
+  // A device reset or clock jump shows up as every sample being far off, a single late frame doesn't
+  if (c.valid && fabs(sample - std::min(c.current_min, c.previous_min)) > 1.0)
+  {
+    if (++c.jumps >= 10)
+    {
+      ROS_WARN("inertialsense: clock \"%s\" jumped by %.3f s, resynchronizing", c.name.c_str(),
+               sample - std::min(c.current_min, c.previous_min));
+      c.valid = false;
+    }
+    else
+      return ros::Time(device_time + std::min(c.current_min, c.previous_min));
+  }
+  c.jumps = 0;
+
+  if (!c.valid)
+  {
+    c.valid = true;
+    c.current_min = c.previous_min = sample;
+    c.window_start = now;
+  }
+  else if (now - c.window_start > window_)
+  {
+    c.previous_min = c.current_min;
+    c.current_min = sample;
+    c.window_start = now;
+  }
+  else
+    c.current_min = std::min(c.current_min, sample);
+
+  return ros::Time(device_time + std::min(c.current_min, c.previous_min));
+}
+
+double ClockSync::offset(int clock)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  const device_clock_t& c = clocks_[clock];
+  return std::min(c.current_min, c.previous_min);
+}
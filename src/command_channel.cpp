@@ -0,0 +1,200 @@
+#include "command_channel.h"
+#include "diagnostics_util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ros/ros.h"
+
+CommandChannel::CommandChannel(SerialWriter& writer) :
+  writer_(writer), timeout_(0.5), retries_(3), outstanding_(0), sent_(0), retried_(0), failed_(0), running_(true)
+{
+  comm_.buffer = buffer_;
+  comm_.bufferSize = sizeof(buffer_);
+  is_comm_init(&comm_);
+  thread_ = std::thread(&CommandChannel::run, this);
+}
+
+CommandChannel::~CommandChannel()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  changed_.notify_one();
+  thread_.join();
+}
+
+void CommandChannel::set_options(double timeout, int retries)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  timeout_ = timeout;
+  retries_ = std::max(retries, 0);
+}
+
+std::shared_future<CommandChannel::result_t> CommandChannel::set_data(uint32_t did, uint32_t offset, uint32_t size,
+                                                                     const void* data, const callback_t& done)
+{
+  return submit(true, did, offset, size, data, done);
+}
+
+std::shared_future<CommandChannel::result_t> CommandChannel::get_data(uint32_t did, uint32_t offset, uint32_t size,
+                                                                     const callback_t& done)
+{
+  return submit(false, did, offset, size, NULL, done);
+}
+
+std::shared_future<CommandChannel::result_t> CommandChannel::submit(bool set, uint32_t did, uint32_t offset,
+                                                                   uint32_t size, const void* data,
+                                                                   const callback_t& done)
+{
+  command_t command;
+  command.set = set;
+  command.did = did;
+  command.offset = offset;
+  command.data.resize(size);
+  if (set)
+    memcpy(command.data.data(), data, size);
+  command.attempts = 0;
+  command.promise = std::make_shared<std::promise<result_t>>();
+  command.done = done;
+  command.finished = false;
+  std::shared_future<result_t> future = command.promise->get_future().share();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  commands_.push_back(command);
+  send(commands_.back());
+  outstanding_.fetch_add(1, std::memory_order_release);
+  changed_.notify_one();
+  return future;
+}
+
+void CommandChannel::post(const std::function<int(is_comm_instance_t*)>& encode)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  int messageSize = encode(&comm_);
+  writer_.push(SerialWriter::PRIORITY_CONFIG, buffer_, messageSize);
+  sent_++;
+}
+
+void CommandChannel::send(command_t& command)
+{
+  // With the mutex held
+  int messageSize;
+  if (command.set)
+  {
+    messageSize = is_comm_set_data(&comm_, command.did, command.offset, command.data.size(), command.data.data());
+    writer_.push(SerialWriter::PRIORITY_CONFIG, buffer_, messageSize);
+  }
+
+  // The whole data set, which is what the read loop's handlers expect to see
+  messageSize = is_comm_get_data(&comm_, command.did, 0, 0, 0);
+  writer_.push(SerialWriter::PRIORITY_CONFIG, buffer_, messageSize);
+
+  command.attempts++;
+  command.deadline = steady_clock_t::now() + std::chrono::duration_cast<steady_clock_t::duration>(
+                                                 std::chrono::duration<double>(timeout_));
+  sent_++;
+}
+
+void CommandChannel::match(uint32_t did, const uint8_t* data)
+{
+  bool any = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::list<command_t>::iterator c = commands_.begin(); c != commands_.end(); ++c)
+    {
+      if (c->finished || c->did != did)
+        continue;
+
+      // A set that hasn't taken effect yet (the reply may have been sent before it arrived)
+      // waits for the next reply or the timeout
+      const uint8_t* reported = data + c->offset;
+      if (c->set && memcmp(reported, c->data.data(), c->data.size()) != 0)
+        continue;
+
+      c->result.success = true;
+      c->result.message = c->attempts > 1 ? "confirmed after " + std::to_string(c->attempts) + " attempts" : "confirmed";
+      c->result.data.assign(reported, reported + c->data.size());
+      c->finished = true;
+      outstanding_.fetch_sub(1, std::memory_order_release);
+      any = true;
+    }
+  }
+  if (any)
+    changed_.notify_one();
+}
+
+void CommandChannel::run()
+{
+  pthread_setname_np(pthread_self(), "is_commands");
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_ || !commands_.empty())
+  {
+    steady_clock_t::time_point now = steady_clock_t::now();
+    steady_clock_t::time_point wake = now + std::chrono::seconds(1);
+    for (std::list<command_t>::iterator c = commands_.begin(); c != commands_.end();)
+    {
+      if (!c->finished && (now >= c->deadline || !running_))
+      {
+        if (c->attempts <= retries_ && running_)
+        {
+          retried_++;
+          send(*c);
+        }
+        else
+        {
+          char buf[96];
+          snprintf(buf, sizeof(buf), "no reply for DID %u after %d attempts", c->did, c->attempts);
+          c->result.success = false;
+          c->result.message = running_ ? buf : "shutting down";
+          c->finished = true;
+          outstanding_.fetch_sub(1, std::memory_order_release);
+          failed_++;
+          last_failure_ = c->result.message;
+        }
+      }
+
+      if (!c->finished)
+      {
+        wake = std::min(wake, c->deadline);
+        ++c;
+        continue;
+      }
+
+      // Hand the result over without the lock, callbacks may take a while
+      command_t command = *c;
+      c = commands_.erase(c);
+      lock.unlock();
+      command.promise->set_value(command.result);
+      if (command.done)
+        command.done(command.result);
+      lock.lock();
+
+      // Commands may have been added meanwhile, start over
+      now = steady_clock_t::now();
+      wake = now + std::chrono::seconds(1);
+      c = commands_.begin();
+    }
+
+    if (running_)
+      changed_.wait_until(lock, wake);
+  }
+}
+
+void CommandChannel::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: commands";
+  status.hardware_id = hardware_id;
+  status.level = failed_ ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = failed_ ? last_failure_ : "OK";
+  status.values.push_back(key_value("outstanding", outstanding_.load(std::memory_order_relaxed)));
+  status.values.push_back(key_value("sent", sent_));
+  status.values.push_back(key_value("retried", retried_));
+  status.values.push_back(key_value("failed", failed_));
+  msg.status.push_back(status);
+}
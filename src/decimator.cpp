@@ -0,0 +1,114 @@
+#include "decimator.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+Decimator::Decimator() :
+  length_(0), pos_(0), count_(0)
+{}
+
+int Decimator::add_output(int ratio)
+{
+  output_t output = {};
+  outputs_.push_back(output);
+  set_ratio(outputs_.size() - 1, ratio);
+  return outputs_.size() - 1;
+}
+
+void Decimator::set_ratio(int index, int ratio)
+{
+  output_t& output = outputs_[index];
+  output.ratio = std::max(ratio, 1);
+  design(output.ratio, output.taps);
+  output.phase = 0;
+  output.ready = false;
+  resize_history();
+}
+
+void Decimator::design(int ratio, std::vector<float>& taps)
+{
+  // Passing everything through is a single tap
+  int n = ratio > 1 ? TAPS_PER_RATIO * ratio + 1 : 1;
+  taps.resize(n);
+  double cutoff = 0.8 * 0.5 / ratio; // cycles per input sample
+  double sum = 0;
+  for (int k = 0; k < n; k++)
+  {
+    double m = k - (n - 1) / 2.0;
+    double sinc = m == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * m) / (M_PI * m);
+    double window = n > 1 ? 0.42 - 0.5 * cos(2 * M_PI * k / (n - 1)) + 0.08 * cos(4 * M_PI * k / (n - 1)) : 1.0;
+    taps[k] = sinc * window;
+    sum += taps[k];
+  }
+
+  // Unity gain at DC
+  for (int k = 0; k < n; k++)
+    taps[k] /= sum;
+}
+
+void Decimator::resize_history()
+{
+  int length = 1;
+  for (size_t i = 0; i < outputs_.size(); i++)
+    length = std::max<int>(length, outputs_[i].taps.size());
+  if (length != length_)
+  {
+    length_ = length;
+    history_.assign(2 * length_ * LANES, 0.0f);
+    times_.assign(length_, 0.0);
+  }
+  clear();
+}
+
+void Decimator::clear()
+{
+  pos_ = 0;
+  count_ = 0;
+  for (size_t i = 0; i < outputs_.size(); i++)
+  {
+    outputs_[i].phase = 0;
+    outputs_[i].ready = false;
+  }
+}
+
+bool Decimator::push(const float* sample, int channels, double t)
+{
+  channels = std::min(channels, (int)LANES);
+  pos_ = (pos_ + 1) % length_;
+  float* slot = &history_[pos_ * LANES];
+  float* mirror = &history_[(pos_ + length_) * LANES];
+  for (int l = 0; l < LANES; l++)
+    slot[l] = mirror[l] = l < channels ? sample[l] : 0.0f;
+  times_[pos_] = t;
+  count_ = std::min(count_ + 1, length_);
+
+  bool any = false;
+  for (size_t i = 0; i < outputs_.size(); i++)
+  {
+    output_t& output = outputs_[i];
+    output.ready = false;
+    if (++output.phase < output.ratio)
+      continue;
+    output.phase = 0;
+
+    int n = output.taps.size();
+    if (count_ < n)
+      continue;
+
+    // The newest n samples, oldest first
+    const float* x = &history_[(pos_ + length_ - n + 1) * LANES];
+    const float* h = output.taps.data();
+    float acc[LANES] = {};
+    for (int k = 0; k < n; k++)
+    {
+      for (int l = 0; l < LANES; l++)
+        acc[l] += h[k] * x[k * LANES + l];
+    }
+    memcpy(output.value, acc, sizeof(acc));
+    output.time = times_[(pos_ + length_ - (n - 1) / 2) % length_];
+    output.ready = true;
+    any = true;
+  }
+  return any;
+}
@@ -0,0 +1,37 @@
+#include "event_callback_queue.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "ros/ros.h"
+
+EventCallbackQueue::EventCallbackQueue()
+{
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd_ < 0)
+    ROS_FATAL("inertialsense: unable to create eventfd: %s", strerror(errno));
+}
+
+EventCallbackQueue::~EventCallbackQueue()
+{
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+void EventCallbackQueue::addCallback(const ros::CallbackInterfacePtr& callback, uint64_t owner_id)
+{
+  ros::CallbackQueue::addCallback(callback, owner_id);
+  uint64_t one = 1;
+  if (write(fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    ROS_ERROR_THROTTLE(1.0, "inertialsense: unable to signal callback queue: %s", strerror(errno));
+}
+
+void EventCallbackQueue::call_signalled()
+{
+  uint64_t count;
+  if (read(fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    ROS_ERROR_THROTTLE(1.0, "inertialsense: unable to read callback queue signal: %s", strerror(errno));
+  callAvailable();
+}
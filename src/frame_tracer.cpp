@@ -0,0 +1,207 @@
+#include "frame_tracer.h"
+#include "stream_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "ros/ros.h"
+
+#define TRACE_MAX_EVENTS 200000
+
+FrameTracer::FrameTracer(const options_t& options) :
+  options_(options), read_start_(0), read_end_(0), last_mark_(0), frame_end_(0), publish_start_(0),
+  publish_first_(0), publish_ns_(0), did_(0), pending_(false), slots_used_(0), frames_in_window_(0),
+  chrome_written_(false)
+{
+  memset(slot_of_, 0xFF, sizeof(slot_of_));
+  memset(did_of_, 0, sizeof(did_of_));
+  memset(histograms_, 0, sizeof(histograms_));
+
+  start_ns_ = now_ns();
+  chrome_start_ns_ = start_ns_ + (uint64_t)(options_.chrome_start * 1e9);
+  chrome_end_ns_ = chrome_start_ns_ + (uint64_t)(options_.chrome_duration * 1e9);
+  if (options_.chrome_sample < 1)
+    options_.chrome_sample = 1;
+  if (!options_.chrome_file.empty())
+    events_.reserve(TRACE_MAX_EVENTS);
+}
+
+// HDR-style log-linear buckets: exact below 16 ns, then 16 buckets per power of two
+uint32_t FrameTracer::bucket(uint64_t ns)
+{
+  if (ns < TRACE_SUB_BUCKETS)
+    return (uint32_t)ns;
+  int msb = 63 - __builtin_clzll(ns);
+  int shift = msb - TRACE_SUB_BITS;
+  uint32_t b = (shift + 1) * TRACE_SUB_BUCKETS + ((ns >> shift) & (TRACE_SUB_BUCKETS - 1));
+  return b < TRACE_BUCKETS ? b : TRACE_BUCKETS - 1;
+}
+
+// Lowest value that lands in a bucket
+uint64_t FrameTracer::bucket_value(uint32_t bucket)
+{
+  if (bucket < TRACE_SUB_BUCKETS)
+    return bucket;
+  int shift = bucket / TRACE_SUB_BUCKETS - 1;
+  return (uint64_t)(bucket % TRACE_SUB_BUCKETS + TRACE_SUB_BUCKETS) << shift;
+}
+
+const char* FrameTracer::stage_name(int stage)
+{
+  static const char* names[STAGE_COUNT] = { "read", "queue", "parse", "handler", "publish", "total" };
+  return (stage >= 0 && stage < STAGE_COUNT) ? names[stage] : "unknown";
+}
+
+void FrameTracer::frame_handled()
+{
+  if (!pending_)
+    return;
+  pending_ = false;
+  uint64_t handled = now_ns();
+
+  if (did_ >= TRACE_MAX_DID)
+    did_ = TRACE_MAX_DID - 1;
+  uint8_t slot = slot_of_[did_];
+  if (slot == 0xFF)
+  {
+    slot = (slots_used_ < TRACE_MAX_DIDS) ? slots_used_++ : TRACE_MAX_DIDS - 1;
+    slot_of_[did_] = slot;
+    did_of_[slot] = did_;
+  }
+
+  // Frames fed straight to parse_bytes() (benchmarks) have no read around them
+  if (last_mark_ == 0 || last_mark_ > frame_end_)
+    last_mark_ = frame_end_;
+  uint64_t read_end = read_end_ ? read_end_ : last_mark_;
+
+  record(slot, STAGE_READ, read_end_ - read_start_);
+  record(slot, STAGE_QUEUE, last_mark_ - read_end);
+  record(slot, STAGE_PARSE, frame_end_ - last_mark_);
+  record(slot, STAGE_HANDLER, handled - frame_end_ - publish_ns_);
+  record(slot, STAGE_PUBLISH, publish_ns_);
+  record(slot, STAGE_TOTAL, handled - read_end);
+
+  if (!options_.chrome_file.empty() && !chrome_written_)
+  {
+    if (handled >= chrome_start_ns_ && handled < chrome_end_ns_)
+    {
+      if (frames_in_window_++ % options_.chrome_sample == 0)
+      {
+        trace(slot, STAGE_READ, read_start_, read_end_);
+        trace(slot, STAGE_QUEUE, read_end, last_mark_);
+        trace(slot, STAGE_PARSE, last_mark_, frame_end_);
+        trace(slot, STAGE_HANDLER, frame_end_, handled);
+        if (publish_first_)
+          trace(slot, STAGE_PUBLISH, publish_first_, publish_first_ + publish_ns_);
+      }
+    }
+    else if (handled >= chrome_end_ns_ || events_.size() >= TRACE_MAX_EVENTS)
+      write_chrome_trace();
+  }
+
+  last_mark_ = handled;
+}
+
+void FrameTracer::record(int slot, int stage, uint64_t ns)
+{
+  histogram_t& h = histograms_[slot][stage];
+  h.counts[bucket(ns)]++;
+  h.n++;
+  h.sum_ns += ns;
+  if (ns > h.max_ns)
+    h.max_ns = ns;
+}
+
+void FrameTracer::trace(int slot, int stage, uint64_t start_ns, uint64_t end_ns)
+{
+  if (start_ns == 0 || end_ns < start_ns || events_.size() >= TRACE_MAX_EVENTS)
+    return;
+  trace_event_t e;
+  e.start_ns = start_ns;
+  e.duration_ns = (uint32_t)std::min<uint64_t>(end_ns - start_ns, UINT32_MAX);
+  e.stage = stage;
+  e.slot = slot;
+  events_.push_back(e);
+}
+
+uint64_t FrameTracer::percentile(const histogram_t& h, double p) const
+{
+  if (h.n == 0)
+    return 0;
+  uint64_t target = (uint64_t)(p * (h.n - 1)) + 1;
+  uint64_t seen = 0;
+  for (uint32_t b = 0; b < TRACE_BUCKETS; b++)
+  {
+    seen += h.counts[b];
+    if (seen >= target)
+      return std::min(bucket_value(b), h.max_ns);
+  }
+  return h.max_ns;
+}
+
+void FrameTracer::export_histograms(bool final)
+{
+  FILE* file = NULL;
+  if (!options_.histogram_file.empty())
+  {
+    file = fopen(options_.histogram_file.c_str(), "w");
+    if (!file)
+      ROS_ERROR("inertialsense: unable to write trace histograms to \"%s\"", options_.histogram_file.c_str());
+    else
+      fprintf(file, "did,stage,count,mean_us,p50_us,p90_us,p99_us,p99.9_us,max_us\n");
+  }
+
+  ROS_INFO("%-22s %-8s %10s %9s %9s %9s %9s %9s", "frame trace (us)", "stage", "count", "mean", "p50", "p99",
+           "p99.9", "max");
+  for (int slot = 0; slot < slots_used_; slot++)
+  {
+    std::string name = StreamStats::did_name(did_of_[slot]);
+    if (slot == TRACE_MAX_DIDS - 1 && slots_used_ == TRACE_MAX_DIDS)
+      name += "+";
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+      const histogram_t& h = histograms_[slot][stage];
+      if (h.n == 0)
+        continue;
+      double mean = h.sum_ns * 1e-3 / h.n;
+      double p50 = percentile(h, 0.5) * 1e-3, p90 = percentile(h, 0.9) * 1e-3;
+      double p99 = percentile(h, 0.99) * 1e-3, p999 = percentile(h, 0.999) * 1e-3;
+      double max = h.max_ns * 1e-3;
+      ROS_INFO("%-22s %-8s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f", name.c_str(), stage_name(stage),
+               (unsigned long long)h.n, mean, p50, p99, p999, max);
+      if (file)
+        fprintf(file, "%s,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", name.c_str(), stage_name(stage),
+                (unsigned long long)h.n, mean, p50, p90, p99, p999, max);
+    }
+  }
+  if (file)
+    fclose(file);
+
+  // Shutting down inside the window still gets a trace
+  if (final && !options_.chrome_file.empty() && !chrome_written_ && !events_.empty())
+    write_chrome_trace();
+}
+
+void FrameTracer::write_chrome_trace()
+{
+  chrome_written_ = true;
+  FILE* file = fopen(options_.chrome_file.c_str(), "w");
+  if (!file)
+  {
+    ROS_ERROR("inertialsense: unable to write frame trace to \"%s\"", options_.chrome_file.c_str());
+    return;
+  }
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < events_.size(); i++)
+  {
+    const trace_event_t& e = events_[i];
+    fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}\n",
+            i ? "," : "", stage_name(e.stage), StreamStats::did_name(did_of_[e.slot]).c_str(),
+            (e.start_ns - start_ns_) * 1e-3, e.duration_ns * 1e-3);
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  ROS_INFO("inertialsense: wrote %zu trace events to \"%s\"", events_.size(), options_.chrome_file.c_str());
+
+  std::vector<trace_event_t>().swap(events_);
+}
@@ -0,0 +1,270 @@
+#include "geodetic_frames.h"
+
+#include <math.h>
+#include <string.h>
+
+// WGS84
+static const double A = 6378137.0;
+static const double F = 1.0 / 298.257223563;
+static const double E2 = F * (2.0 - F);
+
+// UTM, the Krueger series to third order in n (about a millimetre in the zone)
+static const double K0 = 0.9996;
+static const double FALSE_EASTING = 500000.0;
+static const double N = F / (2.0 - F);
+static const double RECTIFYING_RADIUS = A / (1.0 + N) * (1.0 + N * N / 4.0 + N * N * N * N / 64.0);
+static const double ALPHA[3] = {
+  N / 2.0 - 2.0 / 3.0 * N * N + 5.0 / 16.0 * N * N * N,
+  13.0 / 48.0 * N * N - 3.0 / 5.0 * N * N * N,
+  61.0 / 240.0 * N * N * N
+};
+
+static const double DEG2RAD = M_PI / 180.0;
+
+static const char* frame_names[] = { "ned", "enu", "ecef", "utm" };
+
+const char* GeodeticFrames::name(int frame)
+{
+  return frame >= 0 && frame < FRAMES ? frame_names[frame] : "";
+}
+
+int GeodeticFrames::frame(const std::string& name)
+{
+  for (int f = 0; f < FRAMES; f++)
+  {
+    if (strcasecmp(name.c_str(), frame_names[f]) == 0)
+      return f;
+  }
+  return -1;
+}
+
+GeodeticFrames::GeodeticFrames() :
+  has_reference_(false), utm_zone_(0), utm_lon0_(0), utm_northing0_(0)
+{
+  memset(reference_, 0, sizeof(reference_));
+  memset(origin_, 0, sizeof(origin_));
+  memset(ned_ecef_, 0, sizeof(ned_ecef_));
+}
+
+bool GeodeticFrames::set_reference(const double* lla, int utm_zone)
+{
+  bool none = lla[0] == 0 && lla[1] == 0 && lla[2] == 0;
+  if (none == !has_reference_ && memcmp(lla, reference_, sizeof(reference_)) == 0 &&
+      (utm_zone == 0 || utm_zone == utm_zone_))
+    return false;
+
+  memcpy(reference_, lla, sizeof(reference_));
+  has_reference_ = !none;
+  lla_to_ecef(lla, origin_);
+  double lat = lla[0] * DEG2RAD;
+  double lon = lla[1] * DEG2RAD;
+  ecef_to_ned_rotation(sin(lat), cos(lat), sin(lon), cos(lon), ned_ecef_);
+
+  // Without one given, the zone of the reference, kept however far the solution goes
+  if (utm_zone == 0)
+  {
+    utm_zone = (int)floor((lla[1] + 180.0) / 6.0) % 60 + 1;
+    if (lla[0] < 0)
+      utm_zone = -utm_zone;
+  }
+  utm_zone_ = utm_zone;
+  utm_lon0_ = (6.0 * abs(utm_zone) - 183.0) * DEG2RAD;
+  utm_northing0_ = utm_zone < 0 ? 10000000.0 : 0.0;
+  return true;
+}
+
+void GeodeticFrames::lla_to_ecef(const double* lla, double* ecef)
+{
+  double lat = lla[0] * DEG2RAD;
+  double lon = lla[1] * DEG2RAD;
+  double sin_lat = sin(lat);
+  double cos_lat = cos(lat);
+  double n = A / sqrt(1.0 - E2 * sin_lat * sin_lat);
+  ecef[0] = (n + lla[2]) * cos_lat * cos(lon);
+  ecef[1] = (n + lla[2]) * cos_lat * sin(lon);
+  ecef[2] = (n * (1.0 - E2) + lla[2]) * sin_lat;
+}
+
+void GeodeticFrames::ecef_to_ned_rotation(double sin_lat, double cos_lat, double sin_lon, double cos_lon, double* r)
+{
+  // Rows are north, east and down in ECEF
+  r[0] = -sin_lat * cos_lon; r[1] = -sin_lat * sin_lon; r[2] = cos_lat;
+  r[3] = -sin_lon;           r[4] = cos_lon;            r[5] = 0.0;
+  r[6] = -cos_lat * cos_lon; r[7] = -cos_lat * sin_lon; r[8] = -sin_lat;
+}
+
+void GeodeticFrames::lla_to_utm(double lat, double lon, double* en, double* convergence) const
+{
+  double e = 2.0 * sqrt(N) / (1.0 + N);
+  double sin_lat = sin(lat);
+  double dlon = lon - utm_lon0_;
+  double sin_dlon = sin(dlon);
+  double cos_dlon = cos(dlon);
+  double t = sinh(atanh(sin_lat) - e * atanh(e * sin_lat));
+  double xi = atan2(t, cos_dlon);
+  double eta = atanh(sin_dlon / sqrt(1.0 + t * t));
+
+  // sin, cos of 2j xi and sinh, cosh of 2j eta by the multiple angle recurrences
+  double s2 = sin(2.0 * xi);
+  double c2 = cos(2.0 * xi);
+  double e2 = exp(2.0 * eta);
+  double s = s2, c = c2, ej = e2;
+  double x = xi;
+  double y = eta;
+  double sigma = 1.0;
+  double tau = 0.0;
+  for (int j = 1; j <= 3; j++)
+  {
+    double sh = 0.5 * (ej - 1.0 / ej);
+    double ch = 0.5 * (ej + 1.0 / ej);
+    x += ALPHA[j - 1] * s * ch;
+    y += ALPHA[j - 1] * c * sh;
+    sigma += 2.0 * j * ALPHA[j - 1] * c * ch;
+    tau += 2.0 * j * ALPHA[j - 1] * s * sh;
+
+    double next = s * c2 + c * s2;
+    c = c * c2 - s * s2;
+    s = next;
+    ej *= e2;
+  }
+  en[0] = FALSE_EASTING + K0 * RECTIFYING_RADIUS * y;
+  en[1] = utm_northing0_ + K0 * RECTIFYING_RADIUS * x;
+
+  double r = sqrt(1.0 + t * t);
+  *convergence = atan2(tau * r * cos_dlon + sigma * t * sin_dlon, sigma * r * cos_dlon - tau * t * sin_dlon);
+}
+
+// Rotation matrix (row major) to quaternion (w, x, y, z)
+static void matrix_to_quaternion(const double* m, double* q)
+{
+  double trace = m[0] + m[4] + m[8];
+  if (trace > 0)
+  {
+    double s = 0.5 / sqrt(trace + 1.0);
+    q[0] = 0.25 / s;
+    q[1] = (m[7] - m[5]) * s;
+    q[2] = (m[2] - m[6]) * s;
+    q[3] = (m[3] - m[1]) * s;
+  }
+  else if (m[0] > m[4] && m[0] > m[8])
+  {
+    double s = 2.0 * sqrt(1.0 + m[0] - m[4] - m[8]);
+    q[0] = (m[7] - m[5]) / s;
+    q[1] = 0.25 * s;
+    q[2] = (m[1] + m[3]) / s;
+    q[3] = (m[2] + m[6]) / s;
+  }
+  else if (m[4] > m[8])
+  {
+    double s = 2.0 * sqrt(1.0 + m[4] - m[0] - m[8]);
+    q[0] = (m[2] - m[6]) / s;
+    q[1] = (m[1] + m[3]) / s;
+    q[2] = 0.25 * s;
+    q[3] = (m[5] + m[7]) / s;
+  }
+  else
+  {
+    double s = 2.0 * sqrt(1.0 + m[8] - m[0] - m[4]);
+    q[0] = (m[3] - m[1]) / s;
+    q[1] = (m[2] + m[6]) / s;
+    q[2] = (m[5] + m[7]) / s;
+    q[3] = 0.25 * s;
+  }
+}
+
+static void quaternion_multiply(const double* a, const double* b, double* q)
+{
+  q[0] = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+  q[1] = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+  q[2] = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+  q[3] = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+}
+
+// c = a * b^T, 3x3 row major
+static void multiply_transposed(const double* a, const double* b, double* c)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++)
+      c[3 * i + j] = a[3 * i] * b[3 * j] + a[3 * i + 1] * b[3 * j + 1] + a[3 * i + 2] * b[3 * j + 2];
+  }
+}
+
+void GeodeticFrames::convert(const double* lla, const double* q_ned, const int* frames, int count, pose_t* poses) const
+{
+  // Shared by every frame: one sine and cosine each, the ECEF position and the local NED axes
+  double lat = lla[0] * DEG2RAD;
+  double lon = lla[1] * DEG2RAD;
+  double sin_lat = sin(lat);
+  double cos_lat = cos(lat);
+  double sin_lon = sin(lon);
+  double cos_lon = cos(lon);
+  double n = A / sqrt(1.0 - E2 * sin_lat * sin_lat);
+  double ecef[3] = { (n + lla[2]) * cos_lat * cos_lon, (n + lla[2]) * cos_lat * sin_lon,
+                     (n * (1.0 - E2) + lla[2]) * sin_lat };
+  double ned_ecef[9];
+  ecef_to_ned_rotation(sin_lat, cos_lat, sin_lon, cos_lon, ned_ecef);
+
+  // Offset and rotation from the reference, for NED and ENU
+  double d[3] = { ecef[0] - origin_[0], ecef[1] - origin_[1], ecef[2] - origin_[2] };
+  double ned[3];
+  for (int a = 0; a < 3; a++)
+    ned[a] = ned_ecef_[3 * a] * d[0] + ned_ecef_[3 * a + 1] * d[1] + ned_ecef_[3 * a + 2] * d[2];
+  double ref_ned[9]; // local NED to the reference's
+  multiply_transposed(ned_ecef_, ned_ecef, ref_ned);
+
+  for (int i = 0; i < count; i++)
+  {
+    pose_t& pose = poses[i];
+    double* r = pose.rotation;
+    switch (frames[i])
+    {
+    case ECEF:
+      memcpy(pose.position, ecef, sizeof(ecef));
+      for (int a = 0; a < 3; a++)
+      {
+        for (int b = 0; b < 3; b++)
+          r[3 * a + b] = ned_ecef[3 * b + a];
+      }
+      break;
+
+    case NED:
+      memcpy(pose.position, ned, sizeof(ned));
+      memcpy(r, ref_ned, sizeof(ref_ned));
+      break;
+
+    case ENU:
+      pose.position[0] = ned[1];
+      pose.position[1] = ned[0];
+      pose.position[2] = -ned[2];
+      for (int b = 0; b < 3; b++)
+      {
+        r[b] = ref_ned[3 + b];
+        r[3 + b] = ref_ned[b];
+        r[6 + b] = -ref_ned[6 + b];
+      }
+      break;
+
+    case UTM:
+    {
+      double convergence;
+      lla_to_utm(lat, lon, pose.position, &convergence);
+      pose.position[2] = lla[2];
+      // Local east, north, up turned by the convergence onto the grid
+      double s = sin(convergence);
+      double c = cos(convergence);
+      r[0] = -s; r[1] = c;  r[2] = 0.0;
+      r[3] = c;  r[4] = s;  r[5] = 0.0;
+      r[6] = 0.0; r[7] = 0.0; r[8] = -1.0;
+      break;
+    }
+
+    default:
+      continue;
+    }
+
+    double q_frame[4];
+    matrix_to_quaternion(r, q_frame);
+    quaternion_multiply(q_frame, q_ned, pose.orientation);
+  }
+}
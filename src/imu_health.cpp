@@ -0,0 +1,158 @@
+#include "imu_health.h"
+#include "diagnostics_util.h"
+
+#include <math.h>
+#include <algorithm>
+
+ImuHealth::ImuHealth(const options_t& options) :
+  options_(options), count_(0), start_(0), last_count_(0), windows_(0), flagged_windows_(0),
+  level_(diagnostic_msgs::DiagnosticStatus::OK)
+{
+  for (int c = 0; c < CHANNELS; c++)
+  {
+    std::string axis = std::string(c % 6 < 3 ? "gyro_" : "acc_") + "xyz"[c % 3];
+    names_[c] = c < AXES ? "imu" + std::to_string(c / 6 + 1) + "_" + axis : "imu1-imu2_" + axis;
+    limit_[c] = c >= AXES ? INFINITY : c % 6 < 3 ? options_.gyro_saturation : options_.acc_saturation;
+    mean_[c] = std_[c] = 0;
+    last_saturated_[c] = 0;
+  }
+  std::fill(sum_, sum_ + CHANNELS, 0.0);
+  std::fill(sum_sq_, sum_sq_ + CHANNELS, 0.0);
+  std::fill(saturated_, saturated_ + CHANNELS, 0);
+  std::fill(shift_, shift_ + CHANNELS, 0.0);
+}
+
+void ImuHealth::push(const dual_imu_t& imu)
+{
+  float x[CHANNELS];
+  for (int i = 0; i < 2; i++)
+  {
+    for (int a = 0; a < 3; a++)
+    {
+      x[6 * i + a] = imu.I[i].pqr[a];
+      x[6 * i + 3 + a] = imu.I[i].acc[a];
+    }
+  }
+  for (int c = 0; c < 6; c++)
+    x[AXES + c] = x[c] - x[6 + c];
+
+  if (count_ == 0)
+  {
+    for (int c = 0; c < CHANNELS; c++)
+      shift_[c] = x[c];
+    start_ = imu.time;
+  }
+
+  for (int c = 0; c < CHANNELS; c++)
+  {
+    double d = x[c] - shift_[c];
+    sum_[c] += d;
+    sum_sq_[c] += d * d;
+    saturated_[c] += fabsf(x[c]) >= limit_[c];
+  }
+  count_++;
+
+  // By device time, so the window is the same length at any IMU rate (and restarts with the device)
+  if (imu.time - start_ >= options_.window || imu.time < start_)
+    close_window();
+}
+
+void ImuHealth::close_window()
+{
+  if (count_ >= 2)
+  {
+    double n = count_;
+    double mean[CHANNELS];
+    double sd[CHANNELS];
+    for (int c = 0; c < CHANNELS; c++)
+    {
+      mean[c] = shift_[c] + sum_[c] / n;
+      sd[c] = sqrt(std::max((sum_sq_[c] - sum_[c] * sum_[c] / n) / (n - 1), 0.0));
+    }
+
+    int level = diagnostic_msgs::DiagnosticStatus::OK;
+    std::set<std::string> problems;
+    int checked = options_.imus >= 2 ? CHANNELS : 6;
+    for (int c = 0; c < checked; c++)
+    {
+      bool gyro = c % 6 < 3;
+      if (c >= AXES)
+      {
+        double limit = gyro ? options_.gyro_disagreement : options_.acc_disagreement;
+        if (limit > 0 && (fabs(mean[c]) > limit || sd[c] > limit))
+        {
+          level = std::max<int>(level, diagnostic_msgs::DiagnosticStatus::WARN);
+          problems.insert(names_[c] + " disagree");
+        }
+        continue;
+      }
+
+      // Nothing differed from the first sample, a live sensor always has some noise
+      double limit = gyro ? options_.gyro_std : options_.acc_std;
+      if (sum_sq_[c] == 0)
+      {
+        level = diagnostic_msgs::DiagnosticStatus::ERROR;
+        problems.insert(names_[c] + " stuck");
+      }
+      else if (limit > 0 && sd[c] > limit)
+      {
+        level = std::max<int>(level, diagnostic_msgs::DiagnosticStatus::WARN);
+        problems.insert(names_[c] + " noisy");
+      }
+      if (saturated_[c])
+      {
+        level = std::max<int>(level, diagnostic_msgs::DiagnosticStatus::WARN);
+        problems.insert(names_[c] + " saturated");
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::copy(mean, mean + CHANNELS, mean_);
+    std::copy(sd, sd + CHANNELS, std_);
+    std::copy(saturated_, saturated_ + CHANNELS, last_saturated_);
+    last_count_ = count_;
+    windows_++;
+    if (level != diagnostic_msgs::DiagnosticStatus::OK)
+    {
+      flagged_windows_++;
+      level_ = std::max(level_, level);
+      problems_.insert(problems.begin(), problems.end());
+    }
+  }
+
+  count_ = 0;
+  std::fill(sum_, sum_ + CHANNELS, 0.0);
+  std::fill(sum_sq_, sum_sq_ + CHANNELS, 0.0);
+  std::fill(saturated_, saturated_ + CHANNELS, 0);
+}
+
+void ImuHealth::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: imu health";
+  status.hardware_id = hardware_id;
+  status.level = level_;
+  if (windows_ == 0)
+    status.message = "No IMU samples yet";
+  else if (problems_.empty())
+    status.message = "OK";
+  for (std::set<std::string>::const_iterator p = problems_.begin(); p != problems_.end(); ++p)
+    status.message += (p == problems_.begin() ? "" : ", ") + *p;
+
+  status.values.push_back(key_value("windows", windows_, "%.0f"));
+  status.values.push_back(key_value("windows flagged", flagged_windows_, "%.0f"));
+  status.values.push_back(key_value("samples per window", last_count_, "%.0f"));
+  int channels = options_.imus >= 2 ? CHANNELS : 6;
+  for (int c = 0; c < channels; c++)
+  {
+    status.values.push_back(key_value(names_[c] + " mean", mean_[c], "%.4g"));
+    status.values.push_back(key_value(names_[c] + " std", std_[c], "%.4g"));
+    if (c < AXES)
+      status.values.push_back(key_value(names_[c] + " saturated", last_saturated_[c], "%.0f"));
+  }
+  msg.status.push_back(status);
+
+  level_ = diagnostic_msgs::DiagnosticStatus::OK;
+  problems_.clear();
+}
@@ -1,21 +1,112 @@
 #include "inertial_sense.h"
 #include <chrono>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
 #include <stddef.h>
 #include <unistd.h>
 #include <tf/tf.h>
 #include <ros/console.h>
 
-InertialSenseROS::InertialSenseROS() :
-  nh_(), nh_private_("~"), initialized_(false)
+// Streams that can be turned on and off, by the names used in ~stream_<name> and the bandwidth plan
+static const char* stream_names[] = { "INS", "IMU", "GPS", "GPS_info", "mag", "baro", "preint_IMU" };
+
+// The data sets each stream needs, and the RMC bit for each
+static const struct
+{
+  const char* stream;
+  uint32_t did;
+  uint32_t rmc_bit;
+} stream_dids[] = {
+  { "INS", DID_INS_1, RMC_BITS_INS1 },
+  { "INS", DID_INS_2, RMC_BITS_INS2 },
+  { "INS", DID_DUAL_IMU, RMC_BITS_DUAL_IMU },
+  { "IMU", DID_INS_1, RMC_BITS_INS1 },
+  { "IMU", DID_INS_2, RMC_BITS_INS2 },
+  { "IMU", DID_DUAL_IMU, RMC_BITS_DUAL_IMU },
+  { "GPS_info", DID_GPS1_SAT, RMC_BITS_GPS1_SAT },
+  { "mag", DID_MAGNETOMETER_1, RMC_BITS_MAGNETOMETER1 },
+  { "baro", DID_BAROMETER, RMC_BITS_BAROMETER },
+  { "preint_IMU", DID_PREINTEGRATED_IMU, RMC_BITS_PREINTEGRATED_IMU },
+  { "shm", DID_INS_2, RMC_BITS_INS2 },
+  { "shm", DID_DUAL_IMU, RMC_BITS_DUAL_IMU },
+  { "allan", DID_DUAL_IMU, RMC_BITS_DUAL_IMU },
+};
+
+// ~ins_period_ms, ~imu_period_ms, ~gps_info_period_ms...
+static std::string period_param(const std::string& stream)
 {
+  std::string name = stream;
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  return name + "_period_ms";
+}
+
+InertialSenseROS::InertialSenseROS(bool connect) :
+  InertialSenseROS(ros::NodeHandle(), ros::NodeHandle("~"), connect)
+{}
+
+InertialSenseROS::InertialSenseROS(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private, bool connect) :
+  nh_(nh), nh_private_(nh_private), initialized_(false), connected_(connect)
+{
+  comm_.buffer = message_buffer_;
+  comm_.bufferSize = sizeof(message_buffer_);
+  is_comm_init(&comm_);
+
+  if (!connected_)
+  {
+    frame_id_ = "body_inertial";
+    INS_.enabled = IMU_.enabled = GPS_.enabled = GPS_info_.enabled = true;
+    mag_.enabled = baro_.enabled = dt_vel_.enabled = true;
+    initialized_ = true;
+    return;
+  }
+
   nh_private_.param<std::string>("port", port_, "/dev/ttyUSB0");
   nh_private_.param<int>("baudrate", baudrate_, 3000000);
   nh_private_.param<std::string>("frame_id", frame_id_, "body_inertial");
 
+  if (nh_private_.param<bool>("trace", false))
+  {
+    FrameTracer::options_t trace_options;
+    nh_private_.param<std::string>("trace_file", trace_options.histogram_file, "");
+    nh_private_.param<std::string>("trace_chrome_file", trace_options.chrome_file, "");
+    nh_private_.param<double>("trace_chrome_start", trace_options.chrome_start, 5.0);
+    nh_private_.param<double>("trace_chrome_duration", trace_options.chrome_duration, 1.0);
+    nh_private_.param<int>("trace_chrome_sample", trace_options.chrome_sample, 1);
+    enable_tracing(trace_options);
+    double trace_period = nh_private_.param<double>("trace_export_period", 10.0);
+    if (trace_period > 0)
+      trace_timer_ = nh_.createTimer(ros::Duration(trace_period), &InertialSenseROS::trace_timer_callback, this);
+  }
+
+  // Lock memory before connecting so the buffers allocated from here on are already resident
+  RealTime::thread_options_t port2_thread;
+  if (nh_private_.param<bool>("rt", false))
+  {
+    RealTime::lock_memory(nh_private_.param<int>("rt_prefault_heap", 8 << 20));
+    rt_stack_bytes_ = nh_private_.param<int>("rt_prefault_stack", 256 << 10);
+    nh_private_.param<int>("rt_cpu", rt_thread_.cpu, -1);
+    nh_private_.param<int>("rt_priority", rt_thread_.priority, 80);
+    nh_private_.param<int>("rt_port2_cpu", port2_thread.cpu, -1);
+    nh_private_.param<int>("rt_port2_priority", port2_thread.priority, rt_thread_.priority);
+    rt_pending_ = true;
+  }
+  nh_private_.param<double>("rt_wakeup_warn_us", wakeup_warn_us_, 500.0);
+
+  read_buffer_.resize(std::max(64, nh_private_.param<int>("read_buffer_size", 4096)));
+  read_buffer_max_ = std::max<size_t>(read_buffer_.size(), nh_private_.param<int>("read_buffer_max", 65536));
+  stats_.set_read_buffer(read_buffer_.size());
+  nh_private_.param<int>("read_min_bytes", read_min_bytes_, 1);
+  nh_private_.param<int>("read_max_wait_ms", read_max_wait_ms_, 2);
+
   /// Connect to the uINS
 
   memset(&serial_, 0, sizeof(serial_));
-  serialPortPlatformInit(&serial_);
+  network_port_ = serialPortIsNetworkUrl(port_.c_str());
+  if (network_port_)
+    serialPortNetInit(&serial_);
+  else
+    serialPortPlatformInit(&serial_);
   ROS_INFO("Connecting to serial port \"%s\", at %d baud", port_.c_str(), baudrate_);
   if (serialPortOpen(&serial_, port_.c_str(), baudrate_, true) != 1)
   {
@@ -25,14 +116,24 @@ InertialSenseROS::InertialSenseROS() :
   else
     ROS_INFO("Connected to uINS on \"%s\", at %d baud", port_.c_str(), baudrate_);
 
-  // Initialize the IS parser
-  comm_.buffer = message_buffer_;
-  comm_.bufferSize = sizeof(message_buffer_);
-  is_comm_init(&comm_);
+  // Let cltool, loggers etc. share the port through us
+  std::vector<std::string> raw_stream_servers;
+  if (nh_private_.getParam("raw_stream_servers", raw_stream_servers) && !raw_stream_servers.empty())
+  {
+    raw_server_ = new RawStreamServer(nh_private_.param<int>("raw_stream_buffer", 65536));
+    for (size_t i = 0; i < raw_stream_servers.size(); i++)
+      raw_server_->listen(raw_stream_servers[i]);
+    if (!raw_server_->listening())
+    {
+      delete raw_server_;
+      raw_server_ = NULL;
+    }
+  }
+
   get_flash_config();
 
   // Make sure the navigation rate is right, if it's not, then we need to change and reset it.
-  int nav_dt_ms;
+  int nav_dt_ms = flash_.startupNavDtMs;
   if (nh_private_.getParam("navigation_dt_ms", nav_dt_ms))
   {
     if (nav_dt_ms != flash_.startupNavDtMs)
@@ -51,10 +152,17 @@ InertialSenseROS::InertialSenseROS() :
         ROS_INFO("Set navigation rate to %dms", flash_.startupNavDtMs);
     }
   }
+  nav_dt_ms_ = flash_.startupNavDtMs;
 
   /// Start Up ROS service servers
-  mag_cal_srv_ = nh_.advertiseService("single_axis_mag_cal", &InertialSenseROS::perform_mag_cal_srv_callback, this);
-  multi_mag_cal_srv_ = nh_.advertiseService("multi_axis_mag_cal", &InertialSenseROS::perform_multi_mag_cal_srv_callback, this);
+  commands_ = new CommandChannel(writer_);
+  commands_->set_options(nh_private_.param<double>("command_timeout", 0.5), nh_private_.param<int>("command_retries", 3));
+  ros::NodeHandle nh_commands(nh_);
+  nh_commands.setCallbackQueue(&command_queue_);
+  mag_cal_srv_ = nh_commands.advertiseService("single_axis_mag_cal", &InertialSenseROS::perform_mag_cal_srv_callback, this);
+  multi_mag_cal_srv_ = nh_commands.advertiseService("multi_axis_mag_cal", &InertialSenseROS::perform_multi_mag_cal_srv_callback, this);
+  configure_streams_srv_ = nh_commands.advertiseService("configure_streams", &InertialSenseROS::configure_streams_srv_callback, this);
+  bad_frames_srv_ = nh_.advertiseService("bad_frames", &InertialSenseROS::get_bad_frames_srv_callback, this);
 
   // Stop all broadcasts
   uint32_t messageSize = is_comm_stop_broadcasts(&comm_);
@@ -67,99 +175,706 @@ InertialSenseROS::InertialSenseROS() :
   set_vector_flash_config<float>("INS_xyz", 3, offsetof(nvm_flash_cfg_t, insOffset));
   set_vector_flash_config<float>("GPS_ant_xyz", 3, offsetof(nvm_flash_cfg_t, gps1AntOffset));
   set_vector_flash_config<double>("GPS_ref_lla", 3, offsetof(nvm_flash_cfg_t, refLla));
+  std::vector<double> ref_lla(3, 0.0);
+  nh_private_.getParam("GPS_ref_lla", ref_lla);
+  nh_private_.param<int>("utm_zone", utm_zone_, 0);
+  if (ref_lla.size() == 3)
+    set_frames_reference(ref_lla.data());
 
   set_flash_config<float>("inclination", offsetof(nvm_flash_cfg_t, magInclination), 1.14878541071f);
   set_flash_config<float>("declination", offsetof(nvm_flash_cfg_t, magDeclination), 0.20007290992f);
   set_flash_config<int>("dynamic_model", offsetof(nvm_flash_cfg_t, insDynModel), 8);
   set_flash_config<int>("ser1_baud_rate", offsetof(nvm_flash_cfg_t, ser1BaudRate), 115200);
 
+  open_port2();
 
   /////////////////////////////////////////////////////////
   /// DATA STREAMS CONFIGURATION
   /////////////////////////////////////////////////////////
 
-  uint32_t rmcBits = RMC_BITS_GPS_NAV | RMC_BITS_STROBE_IN_TIME; // we always need GPS for time synchronization
-  nh_private_.param<bool>("stream_INS", INS_.enabled, true);
-  if (INS_.enabled)
+  stream_config_t& config = stream_config_;
+  auto stream_param = [&](const char* name, bool def)
   {
-    INS_.pub = nh_.advertise<nav_msgs::Odometry>("ins", 1);
-    rmcBits |= RMC_BITS_DUAL_IMU | RMC_BITS_INS1 | RMC_BITS_INS2;
-
-    // Request covariance information
-    messageSize = is_comm_get_data(&comm_, DID_INL2_VARIANCE, 0, 0, nav_dt_ms);
-    serialPortWrite(&serial_, message_buffer_, messageSize);
+    if (nh_private_.param<bool>(std::string("stream_") + name, def))
+      config.streams.insert(name);
+  };
+  stream_param("INS", true);
+  stream_param("IMU", false);
+  stream_param("GPS", false);
+  stream_param("GPS_info", false);
+  stream_param("mag", false);
+  stream_param("baro", false);
+  stream_param("preint_IMU", false);
+  if (nh_private_.param<bool>("shm", false))
+    config.streams.insert("shm");
+  if (nh_private_.param<bool>("allan_variance", false))
+    config.streams.insert("allan");
+  config.NMEA_rate = nh_private_.param<int>("NMEA_rate", 0);
+  config.NMEA_configuration = nh_private_.param<int>("NMEA_configuration", 0x00);
+  config.NMEA_ports = nh_private_.param<int>("NMEA_ports", 0x00);
+  for (size_t i = 0; i < sizeof(stream_names) / sizeof(stream_names[0]); i++)
+  {
+    // GPS stays at its default rate, time synchronization depends on it
+    int period = 0;
+    if (strcmp(stream_names[i], "GPS") != 0 && nh_private_.getParam(period_param(stream_names[i]), period) && period > 0)
+      config.period_ms[stream_names[i]] = period;
   }
 
-  // Set up the IMU ROS stream
-  nh_private_.param<bool>("stream_IMU", IMU_.enabled, false);
-  if (IMU_.enabled)
+  // Make sure it all fits down the serial link, may turn off streams
+  read_bandwidth_params();
+  if (!plan_bandwidth(nav_dt_ms_, config, bandwidth_, bandwidth2_))
+    exit(0);
+
+  // Publishing runs on its own thread unless ~publish_async is off
+  if (nh_private_.param<bool>("publish_async", true))
   {
-    IMU_.pub = nh_.advertise<sensor_msgs::Imu>("imu", 1);
-//    IMU_.pub2 = nh_.advertise<sensor_msgs::Imu>("imu2", 1);
-    rmcBits |= RMC_BITS_DUAL_IMU | RMC_BITS_INS1 | RMC_BITS_INS2;
+    executor_ = new PublishExecutor();
+    executor_->start();
   }
 
-  // Set up the GPS ROS stream - we always need GPS information for time sync, just don't always need to publish it
-  nh_private_.param<bool>("stream_GPS", GPS_.enabled, false);
-  if (GPS_.enabled)
+  // Publishers go up before the uINS is asked for their data
+  for (size_t i = 0; i < sizeof(stream_names) / sizeof(stream_names[0]); i++)
   {
-    GPS_.pub = nh_.advertise<inertial_sense::GPS>("gps", 1);
+    ros_stream_t* s = stream(stream_names[i]);
+    s->enabled = config.on(stream_names[i]);
+    if (s->enabled)
+      advertise_stream(stream_names[i], *s);
   }
 
-  // Set up the GPS info ROS stream
-  nh_private_.param<bool>("stream_GPS_info", GPS_info_.enabled, false);
-  if (GPS_info_.enabled)
+  // The INS solution in other frames, converted here once instead of by every consumer
+  std::vector<std::string> frames;
+  nh_private_.getParam("frames", frames);
+  enable_frames(frames, nh_private_.param<std::string>("tf_frame", ""));
+  for (size_t i = 0; i < odom_frames_.size(); i++)
   {
-    GPS_info_.pub = nh_.advertise<inertial_sense::GPSInfo>("gps/info", 1);
-    rmcBits |= RMC_BITS_GPS1_SAT;
+    std::string param = std::string(GeodeticFrames::name(odom_frames_[i])) + "_frame_id";
+    nh_private_.param<std::string>(param, odom_frame_ids_[i], odom_frame_ids_[i]);
   }
 
-  // Set up the magnetometer ROS stream
-  nh_private_.param<bool>("stream_mag", mag_.enabled, false);
-  if (mag_.enabled)
+  // Local consumers get the raw IMU, INS and GPS structs through shared memory
+  shm_enabled_ = config.on("shm");
+  if (shm_enabled_)
+    open_shm_rings();
+
+  did_requests_ = did_requests(config, nav_dt_ms_);
+  std::vector<std::string> sent;
+  send_did_requests(did_requests_, did_requests_t(), true, sent);
+
+  // Lower rate IMU topics are filtered here from the one IMU stream, for whoever doesn't want it at full rate
+  std::vector<int> decimation_hz;
+  nh_private_.getParam("imu_decimation", decimation_hz);
+  for (size_t i = 0; i < decimation_hz.size(); i++)
   {
-    mag_.pub = nh_.advertise<sensor_msgs::MagneticField>("mag", 1);
-//    mag_.pub2 = nh_.advertise<sensor_msgs::MagneticField>("mag2", 1);
-    rmcBits |= RMC_BITS_MAGNETOMETER1;
+    if (decimation_hz[i] <= 0)
+      continue;
+    std::string hz = std::to_string(decimation_hz[i]) + "hz";
+    ros_stream_t s;
+    s.enabled = true;
+    advertise<sensor_msgs::Imu>(s, "imu/" + hz, "IMU_" + hz, "fifo", 4);
+    imu_decimation_hz_.push_back(decimation_hz[i]);
+    imu_decimated_.push_back(s);
+    imu_decimator_.add_output(1);
   }
+  setup_imu_decimation(imu_period_ms(did_requests_, nav_dt_ms_));
 
-  // Set up the barometer ROS stream
-  nh_private_.param<bool>("stream_baro", baro_.enabled, false);
-  if (baro_.enabled)
+  // Noise characterization runs on the IMU data set for as long as the node does
+  if (config.on("allan"))
   {
-    baro_.pub = nh_.advertise<sensor_msgs::FluidPressure>("baro", 1);
-    rmcBits |= RMC_BITS_BAROMETER;
+    allan_ = new AllanVariance(AllanVariance::DUAL_IMU_CHANNELS, nh_private_.param<int>("allan_overlap", 64));
+    allan_names_ = AllanVariance::dual_imu_names();
+    nh_private_.param<std::string>("allan_file", allan_file_, "");
+    double allan_period = nh_private_.param<double>("allan_export_period", 60.0);
+    if (!allan_file_.empty() && allan_period > 0)
+      allan_timer_ = nh_.createTimer(ros::Duration(allan_period), &InertialSenseROS::allan_timer_callback, this);
   }
 
-  // Set up the preintegrated IMU (coning and sculling integral) ROS stream
-  nh_private_.param<bool>("stream_preint_IMU", dt_vel_.enabled, false);
-  if (dt_vel_.enabled)
+  satellites_.set_thresholds(nh_private_.param<int>("gps_info_cno_step", 3), nh_private_.param<int>("gps_info_hold", 2));
+  gps_info_full_every_ = std::max(nh_private_.param<int>("gps_info_full_every", 10), 1);
+
+  if (nh_private_.param<bool>("imu_health", true))
   {
-    dt_vel_.pub = nh_.advertise<inertial_sense::PreIntIMU>("preint_imu", 1);
-    rmcBits |= RMC_BITS_PREINTEGRATED_IMU;
+    ImuHealth::options_t health_options;
+    nh_private_.param<double>("imu_health_window", health_options.window, health_options.window);
+    nh_private_.param<int>("imu_health_imus", health_options.imus, health_options.imus);
+    nh_private_.param<double>("imu_health_gyro_saturation", health_options.gyro_saturation, health_options.gyro_saturation);
+    nh_private_.param<double>("imu_health_acc_saturation", health_options.acc_saturation, health_options.acc_saturation);
+    nh_private_.param<double>("imu_health_gyro_std", health_options.gyro_std, health_options.gyro_std);
+    nh_private_.param<double>("imu_health_acc_std", health_options.acc_std, health_options.acc_std);
+    nh_private_.param<double>("imu_health_gyro_disagreement", health_options.gyro_disagreement,
+                              health_options.gyro_disagreement);
+    nh_private_.param<double>("imu_health_acc_disagreement", health_options.acc_disagreement,
+                              health_options.acc_disagreement);
+    enable_imu_health(health_options);
   }
 
-  messageSize = is_comm_get_data_rmc(&comm_, rmcBits);
-  serialPortWrite(&serial_, message_buffer_, messageSize);
+  if (port2_)
+    port2_->start(rt_pending_ ? &port2_thread : NULL, rt_stack_bytes_);
+
+  /////////////////////////////////////////////////////////
+  /// LINK DIAGNOSTICS
+  /////////////////////////////////////////////////////////
+
+  stats_.set_baudrate(baudrate_);
+  set_expected_periods();
+
+  double diagnostics_period = nh_private_.param<double>("diagnostics_period", 1.0);
+  if (diagnostics_period > 0)
+  {
+    diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 1);
+    last_diagnostics_ = ros::WallTime::now();
+    diagnostics_timer_ = nh_.createTimer(ros::Duration(diagnostics_period), &InertialSenseROS::diagnostics_callback, this);
+  }
 
   /////////////////////////////////////////////////////////
   /// ASCII OUTPUT CONFIGURATION
   /////////////////////////////////////////////////////////
 
-  int NMEA_rate = nh_private_.param<int>("NMEA_rate", 0);
-  int NMEA_message_configuration = nh_private_.param<int>("NMEA_configuration", 0x00);
-  int NMEA_message_ports = nh_private_.param<int>("NMEA_ports", 0x00);
-  ascii_msgs_t msgs = {};
-  msgs.options = (NMEA_message_ports & NMEA_SER0) ? RMC_OPTIONS_PORT_SER0 : 0; // output on serial 0
-  msgs.options |= (NMEA_message_ports & NMEA_SER1) ? RMC_OPTIONS_PORT_SER1 : 0; // output on serial 1
-  msgs.gpgga = (NMEA_message_configuration & NMEA_GPGGA) ? NMEA_rate : 0;
-  msgs.gpgll = (NMEA_message_configuration & NMEA_GPGLL) ? NMEA_rate : 0;
-  msgs.gpgsa = (NMEA_message_configuration & NMEA_GPGSA) ? NMEA_rate : 0;
-  msgs.gprmc = (NMEA_message_configuration & NMEA_GPRMC) ? NMEA_rate : 0;
+  ascii_msgs_t msgs = NMEA_messages(config);
   messageSize = is_comm_set_data(&comm_, DID_ASCII_BCAST_PERIOD, 0, sizeof(ascii_msgs_t), &msgs);
   serialPortWrite(&serial_, message_buffer_, messageSize);
 
+  /////////////////////////////////////////////////////////
+  /// CORRECTIONS
+  /////////////////////////////////////////////////////////
+
+  std::string rtcm_topic = nh_private_.param<std::string>("rtcm_topic", "rtcm");
+  writer_.set_max_queue_bytes(nh_private_.param<int>("rtcm_queue_bytes", 16384));
+  nh_private_.param<double>("rtcm_max_age", rtcm_max_age_, 10.0);
+  if (!rtcm_topic.empty())
+    rtcm_sub_ = nh_.subscribe(rtcm_topic, 16, &InertialSenseROS::rtcm_callback, this, ros::TransportHints().tcpNoDelay());
+
+  // Only now, the replies during start up are waited for with short timeouts
+  if (read_min_bytes_ > 1 && !serialPortPlatformSetReadThreshold(&serial_, read_min_bytes_))
+    ROS_WARN("inertialsense: ~read_min_bytes only applies to serial ports");
+
   initialized_ = true;
+
+  // Commands only go out through writer_ from here on, so the services can start
+  command_spinner_ = new ros::AsyncSpinner(1, &command_queue_);
+  command_spinner_->start();
+}
+
+InertialSenseROS::~InertialSenseROS()
+{
+  if (command_spinner_)
+    command_spinner_->stop();
+  delete command_spinner_;
+  delete commands_;
+  delete executor_;
+  delete allan_;
+  delete imu_health_;
+  delete raw_server_;
+  delete port2_;
+  shmRingClose(&shm_imu_);
+  shmRingClose(&shm_ins_);
+  shmRingClose(&shm_gps_);
+  if (tracer_)
+  {
+    export_trace(true);
+    delete tracer_;
+  }
+}
+
+void InertialSenseROS::open_shm_rings()
+{
+  // Default to a name per namespace so several devices don't fight over one ring
+  std::string ns = nh_.getNamespace();
+  std::replace(ns.begin(), ns.end(), '/', '_');
+  std::string name = "/inertial_sense" + (ns == "_" ? "" : ns);
+  nh_private_.param<std::string>("shm_name", name, name);
+  if (name.empty() || name[0] != '/')
+    name = "/" + name;
+  int slots = nh_private_.param<int>("shm_slots", 1024);
+
+  if (!shmRingCreate(&shm_imu_, (name + SHM_RING_IMU).c_str(), DID_DUAL_IMU, sizeof(dual_imu_t), slots) ||
+      !shmRingCreate(&shm_ins_, (name + SHM_RING_INS).c_str(), DID_INS_2, sizeof(ins_2_t), slots) ||
+      !shmRingCreate(&shm_gps_, (name + SHM_RING_GPS).c_str(), DID_GPS_NAV, sizeof(gps_nav_t), slots))
+  {
+    ROS_ERROR("inertialsense: unable to create shared memory rings \"%s.*\": %s", name.c_str(), strerror(errno));
+    shmRingClose(&shm_imu_);
+    shmRingClose(&shm_ins_);
+    shmRingClose(&shm_gps_);
+    return;
+  }
+  ROS_INFO("inertialsense: writing IMU, INS and GPS to shared memory \"%s.{imu,ins,gps}\"", name.c_str());
+}
+
+void InertialSenseROS::open_port2()
+{
+  std::string port = nh_private_.param<std::string>("port2", "");
+  if (port.empty())
+    return;
+
+  // The uINS's other UART runs at ser1_baud_rate
+  int baudrate = nh_private_.param<int>("port2_baudrate", nh_private_.param<int>("ser1_baud_rate", 115200));
+  port2_ = new AuxPort(sizeof(message_buffer_), nh_private_.param<int>("port2_queue", 64));
+  if (!port2_->open(port, baudrate))
+  {
+    delete port2_;
+    port2_ = NULL;
+    return;
+  }
+
+  if (!nh_private_.getParam("port2_streams", port2_streams_))
+  {
+    const char* defaults[] = { "GPS_info", "mag", "baro", "preint_IMU" };
+    port2_streams_.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+  }
+  std::vector<std::string>::iterator gps = std::find(port2_streams_.begin(), port2_streams_.end(), "GPS");
+  if (gps != port2_streams_.end())
+  {
+    ROS_WARN("inertialsense: GPS stays on the main port for time synchronization");
+    port2_streams_.erase(gps);
+  }
+  nh_private_.param<double>("port2_merge_window", merge_window_, 0.01);
+
+  // Stop anything it was left streaming
+  int messageSize = is_comm_stop_broadcasts(&comm_);
+  serialPortWrite(port2_->port(), message_buffer_, messageSize);
+}
+
+bool InertialSenseROS::on_port2(const std::string& stream) const
+{
+  return port2_ && std::find(port2_streams_.begin(), port2_streams_.end(), stream) != port2_streams_.end();
+}
+
+double InertialSenseROS::merge_time(uint32_t did, const uint8_t* data) const
+{
+  // Put everything on the time since boot clock: time of week is boot time plus towOffset
+  // (0 before the first fix)
+  double t = StreamStats::device_time(did, data);
+  switch (did)
+  {
+  case DID_INS_1:
+  case DID_INS_2:
+  case DID_INL2_VARIANCE:
+  case DID_GPS_NAV:
+  case DID_GPS1_SAT:
+    return t - GPS_towOffset_;
+  default:
+    return t;
+  }
+}
+
+void InertialSenseROS::merge_port2(double before, AuxPort::steady_clock_t::time_point arrived_before)
+{
+  // Hand over the second link's frames that are older than the main link frame about to
+  // be handled.  When either side has no device time, fall back to arrival order
+  const AuxPort::frame_t* f;
+  while ((f = port2_->front()) != NULL)
+  {
+    double t = merge_time(f->did, f->data);
+    if ((t >= 0 && before >= 0) ? t > before : f->arrival > arrived_before)
+      break;
+    if (t >= 0 && t < last_port1_time_)
+      port2_->count_late();
+    handle_frame(f->did, f->data);
+    port2_->pop();
+  }
+}
+
+void InertialSenseROS::enable_tracing(const FrameTracer::options_t& options)
+{
+  delete tracer_;
+  tracer_ = new FrameTracer(options);
+}
+
+void InertialSenseROS::enable_imu_health(const ImuHealth::options_t& options)
+{
+  delete imu_health_;
+  imu_health_ = new ImuHealth(options);
+}
+
+void InertialSenseROS::enable_frames(const std::vector<std::string>& frames, const std::string& tf_frame)
+{
+  odom_frames_.clear();
+  odom_frame_ids_.clear();
+  odom_frame_streams_.clear();
+  tf_frame_ = -1;
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    int f = GeodeticFrames::frame(frames[i]);
+    if (f < 0)
+    {
+      ROS_WARN("inertialsense: unknown frame \"%s\" in ~frames, expected ned, enu, ecef or utm", frames[i].c_str());
+      continue;
+    }
+    if (std::find(odom_frames_.begin(), odom_frames_.end(), f) != odom_frames_.end())
+      continue;
+    if (GeodeticFrames::frame(tf_frame) == f)
+      tf_frame_ = odom_frames_.size();
+    odom_frames_.push_back(f);
+    odom_frame_ids_.push_back(GeodeticFrames::name(f));
+    odom_frame_streams_.push_back(ros_stream_t());
+  }
+  if (!tf_frame.empty() && tf_frame_ < 0)
+    ROS_WARN("inertialsense: ~tf_frame \"%s\" isn't one of ~frames, no tf is published", tf_frame.c_str());
+
+  // Publishers are left unadvertised when running disconnected
+  if (!connected_)
+    return;
+  for (size_t i = 0; i < odom_frames_.size(); i++)
+  {
+    std::string name = GeodeticFrames::name(odom_frames_[i]);
+    odom_frame_streams_[i].enabled = true;
+    advertise<nav_msgs::Odometry>(odom_frame_streams_[i], "ins/" + name, "INS_" + name, "latest", 1);
+  }
+  if (tf_frame_ >= 0)
+  {
+    tf_.enabled = true;
+    advertise<tf2_msgs::TFMessage>(tf_, "/tf", "tf", "fifo", 16);
+  }
+}
+
+void InertialSenseROS::set_frames_reference(const double* lla)
+{
+  if (geodetic_.set_reference(lla, utm_zone_) && geodetic_.has_reference() && !odom_frames_.empty())
+    ROS_INFO("inertialsense: frames referenced to %.7f, %.7f, %.2f, UTM zone %d", lla[0], lla[1], lla[2],
+             geodetic_.utm_zone());
+}
+
+void InertialSenseROS::export_trace(bool final)
+{
+  if (tracer_)
+    tracer_->export_histograms(final);
+}
+
+void InertialSenseROS::trace_timer_callback(const ros::TimerEvent& event)
+{
+  (void)event;
+  export_trace();
+}
+
+void InertialSenseROS::read_bandwidth_params()
+{
+  std::string policy_name;
+  nh_private_.param<std::string>("bandwidth_policy", policy_name, "warn");
+  if (!BandwidthPlanner::parse_policy(policy_name, bandwidth_policy_))
+  {
+    ROS_ERROR("inertialsense: unknown bandwidth_policy \"%s\", using \"warn\"", policy_name.c_str());
+    bandwidth_policy_ = BandwidthPlanner::POLICY_WARN;
+  }
+  if (!nh_private_.getParam("bandwidth_priority", bandwidth_priority_))
+  {
+    const char* defaults[] = { "GPS", "INS", "IMU", "preint_IMU", "mag", "baro", "GPS_info", "NMEA" };
+    bandwidth_priority_.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+  }
+  double limit = nh_private_.param<double>("bandwidth_limit", 0.9);
+  bandwidth_capacity_ = limit * baudrate_ / 10.0; // 8N1 is 10 bits per byte
+  if (port2_)
+  {
+    int baudrate2 = nh_private_.param<int>("port2_baudrate", nh_private_.param<int>("ser1_baud_rate", 115200));
+    bandwidth2_capacity_ = limit * baudrate2 / 10.0;
+  }
+}
+
+void InertialSenseROS::build_bandwidth_plan(int nav_dt_ms, const stream_config_t& config, BandwidthPlanner& planner1,
+                                            BandwidthPlanner& planner2)
+{
+  // From the requests that go to the uINS: a data set comes at the rate it is asked for on a link,
+  // whichever streams it is there for, and not at all on a link that doesn't ask for it
+  did_requests_t requests = did_requests(config, nav_dt_ms);
+  int link = 0;
+  auto dt = [&](uint32_t did)
+  {
+    std::map<uint32_t, uint32_t>::const_iterator m = requests.multiples[link].find(did);
+    if (m != requests.multiples[link].end())
+      return native_period_ms(did, nav_dt_ms) * m->second * 1e-3;
+    uint32_t rmc_bit = did == DID_GPS_NAV ? RMC_BITS_GPS_NAV : 0;
+    for (size_t i = 0; i < sizeof(stream_dids) / sizeof(stream_dids[0]); i++)
+    {
+      if (stream_dids[i].did == did)
+        rmc_bit = stream_dids[i].rmc_bit;
+    }
+    return (requests.rmc_bits[link] & rmc_bit) ? native_period_ms(did, nav_dt_ms) * 1e-3 : 0.0;
+  };
+  double nmea_dt = config.NMEA_rate * 1e-3;
+  bool nmea = config.NMEA_rate > 0 && config.NMEA_configuration;
+  bool nmea_here = nmea && (config.NMEA_ports & NMEA_SER0); // ser1 is a different link
+  bool nmea_port2 = port2_ && nmea && (config.NMEA_ports & NMEA_SER1);
+
+  // Each link is planned on its own, a stream is enabled in the plan of the link it is on
+  planner1 = BandwidthPlanner();
+  planner2 = BandwidthPlanner();
+  for (link = 0; link < (port2_ ? 2 : 1); link++)
+  {
+    BandwidthPlanner& planner = link ? planner2 : planner1;
+    bool port2 = link == 1;
+    planner.add_stream("GPS", !port2, !port2); // needed for time sync even when not published
+    planner.add_stream("INS", config.on("INS") && on_port2("INS") == port2);
+    planner.add_stream("IMU", config.on("IMU") && on_port2("IMU") == port2);
+    planner.add_stream("GPS_info", config.on("GPS_info") && on_port2("GPS_info") == port2);
+    planner.add_stream("mag", config.on("mag") && on_port2("mag") == port2);
+    planner.add_stream("baro", config.on("baro") && on_port2("baro") == port2);
+    planner.add_stream("preint_IMU", config.on("preint_IMU") && on_port2("preint_IMU") == port2);
+    planner.add_stream("NMEA", port2 ? nmea_port2 : nmea_here);
+    planner.add_stream("shm", config.on("shm") && !port2);
+    planner.add_stream("allan", config.on("allan") && !port2);
+
+    planner.add_did("GPS", DID_GPS_NAV, sizeof(gps_nav_t), dt(DID_GPS_NAV));
+    planner.add_did("INS", DID_INS_1, sizeof(ins_1_t), dt(DID_INS_1));
+    planner.add_did("INS", DID_INS_2, sizeof(ins_2_t), dt(DID_INS_2));
+    planner.add_did("INS", DID_DUAL_IMU, sizeof(dual_imu_t), dt(DID_DUAL_IMU));
+    planner.add_did("INS", DID_INL2_VARIANCE, sizeof(inl2_variance_t), dt(DID_INL2_VARIANCE));
+    planner.add_did("IMU", DID_INS_1, sizeof(ins_1_t), dt(DID_INS_1));
+    planner.add_did("IMU", DID_INS_2, sizeof(ins_2_t), dt(DID_INS_2));
+    planner.add_did("IMU", DID_DUAL_IMU, sizeof(dual_imu_t), dt(DID_DUAL_IMU));
+    planner.add_did("GPS_info", DID_GPS1_SAT, sizeof(gps_sat_t), dt(DID_GPS1_SAT));
+    planner.add_did("mag", DID_MAGNETOMETER_1, sizeof(magnetometer_t), dt(DID_MAGNETOMETER_1));
+    planner.add_did("baro", DID_BAROMETER, sizeof(barometer_t), dt(DID_BAROMETER));
+    planner.add_did("preint_IMU", DID_PREINTEGRATED_IMU, sizeof(preintegrated_imu_t), dt(DID_PREINTEGRATED_IMU));
+    planner.add_did("shm", DID_INS_2, sizeof(ins_2_t), dt(DID_INS_2));
+    planner.add_did("shm", DID_DUAL_IMU, sizeof(dual_imu_t), dt(DID_DUAL_IMU));
+    planner.add_did("allan", DID_DUAL_IMU, sizeof(dual_imu_t), dt(DID_DUAL_IMU));
+    planner.add_ascii("NMEA", (config.NMEA_configuration & NMEA_GPGGA) ? 82 : 0, nmea_dt);
+    planner.add_ascii("NMEA", (config.NMEA_configuration & NMEA_GPGLL) ? 50 : 0, nmea_dt);
+    planner.add_ascii("NMEA", (config.NMEA_configuration & NMEA_GPGSA) ? 66 : 0, nmea_dt);
+    planner.add_ascii("NMEA", (config.NMEA_configuration & NMEA_GPRMC) ? 70 : 0, nmea_dt);
+  }
+}
+
+bool InertialSenseROS::plan_bandwidth(int nav_dt_ms, stream_config_t& config, BandwidthPlanner& planner1,
+                                      BandwidthPlanner& planner2)
+{
+  build_bandwidth_plan(nav_dt_ms, config, planner1, planner2);
+  std::vector<std::string> disabled;
+  if (!planner1.plan(bandwidth_capacity_, bandwidth_policy_, bandwidth_priority_, disabled))
+    return false;
+  if (port2_)
+  {
+    std::vector<std::string> disabled2;
+    if (!planner2.plan(bandwidth2_capacity_, bandwidth_policy_, bandwidth_priority_, disabled2))
+      return false;
+    disabled.insert(disabled.end(), disabled2.begin(), disabled2.end());
+  }
+  for (size_t i = 0; i < disabled.size(); i++)
+  {
+    if (disabled[i] == "NMEA")
+      config.NMEA_rate = 0;
+    else
+      config.streams.erase(disabled[i]);
+  }
+  // A shared data set can slow down once a stream that wanted it faster is off, so the plan kept
+  // for diagnostics comes from the requests that will actually be sent
+  if (!disabled.empty())
+    build_bandwidth_plan(nav_dt_ms, config, planner1, planner2);
+  planner1.log_plan(bandwidth_capacity_);
+  if (port2_)
+    planner2.log_plan(bandwidth2_capacity_);
+  return true;
+}
+
+InertialSenseROS::ros_stream_t* InertialSenseROS::stream(const std::string& name)
+{
+  if (name == "INS") return &INS_;
+  if (name == "IMU") return &IMU_;
+  if (name == "GPS") return &GPS_;
+  if (name == "GPS_info") return &GPS_info_;
+  if (name == "mag") return &mag_;
+  if (name == "baro") return &baro_;
+  if (name == "preint_IMU") return &dt_vel_;
+  return NULL;
+}
+
+void InertialSenseROS::advertise_stream(const std::string& name, ros_stream_t& stream)
+{
+  if (name == "INS")
+    advertise<nav_msgs::Odometry>(stream, "ins", "INS", "latest", 1);
+  else if (name == "IMU")
+    advertise<sensor_msgs::Imu>(stream, "imu", "IMU", "fifo", 16);
+  // GPS is always streamed for time sync, this only decides whether it is published
+  else if (name == "GPS")
+    advertise<inertial_sense::GPS>(stream, "gps", "GPS", "fifo", 4);
+  else if (name == "GPS_info")
+  {
+    advertise<inertial_sense::GPSInfo>(stream, "gps/info", "GPS_info", "latest", 1);
+    // Every change matters to whoever rebuilds the list from them
+    advertise<inertial_sense::GPSInfoEvents>(stream, "gps/info/events", "GPS_info_events", "lossless", 16, true);
+  }
+  else if (name == "mag")
+    advertise<sensor_msgs::MagneticField>(stream, "mag", "mag", "fifo", 8);
+  else if (name == "baro")
+    advertise<sensor_msgs::FluidPressure>(stream, "baro", "baro", "fifo", 8);
+  // Preintegrated IMU (coning and sculling integrals)
+  else if (name == "preint_IMU")
+    advertise<inertial_sense::PreIntIMU>(stream, "preint_imu", "preint_IMU", "lossless", 64);
+}
+
+uint32_t InertialSenseROS::native_period_ms(uint32_t did, int nav_dt_ms)
+{
+  switch (did)
+  {
+  case DID_GPS_NAV: return 200;
+  case DID_GPS1_SAT: return 1000;
+  case DID_STROBE_IN_TIME: return 1000;
+  case DID_MAGNETOMETER_1:
+  case DID_MAGNETOMETER_2:
+  case DID_BAROMETER: return 20;
+  default: return nav_dt_ms; // the navigation-rate data sets
+  }
+}
+
+uint32_t InertialSenseROS::period_multiple(uint32_t did, int period_ms, int nav_dt_ms)
+{
+  uint32_t native = std::max<uint32_t>(native_period_ms(did, nav_dt_ms), 1);
+  return std::max<uint32_t>((period_ms + native / 2) / native, 1);
+}
+
+InertialSenseROS::did_requests_t InertialSenseROS::did_requests(const stream_config_t& config, int nav_dt_ms) const
+{
+  did_requests_t requests;
+  requests.rmc_bits[0] = RMC_BITS_GPS_NAV | RMC_BITS_STROBE_IN_TIME; // we always need GPS for time synchronization
+  for (size_t i = 0; i < sizeof(stream_dids) / sizeof(stream_dids[0]); i++)
+  {
+    const char* name = stream_dids[i].stream;
+    if (!config.on(name))
+      continue;
+    int link = on_port2(name) ? 1 : 0; // shm and allan are always on the main port
+    int period = config.period(name);
+    if (period <= 0)
+    {
+      requests.rmc_bits[link] |= stream_dids[i].rmc_bit;
+      continue;
+    }
+
+    // Streams sharing a data set get it at the fastest period any of them asks for
+    uint32_t multiple = period_multiple(stream_dids[i].did, period, nav_dt_ms);
+    std::map<uint32_t, uint32_t>::iterator m = requests.multiples[link].find(stream_dids[i].did);
+    if (m == requests.multiples[link].end() || multiple < m->second)
+      requests.multiples[link][stream_dids[i].did] = multiple;
+  }
+
+  // Covariance comes back on the port that asks for it
+  if (config.on("INS"))
+    requests.multiples[on_port2("INS") ? 1 : 0][DID_INL2_VARIANCE] = nav_dt_ms;
+
+  // A data set on RMC already comes at the full rate, and the second link only carries what
+  // the main one doesn't already
+  requests.rmc_bits[1] &= ~requests.rmc_bits[0];
+  for (size_t i = 0; i < sizeof(stream_dids) / sizeof(stream_dids[0]); i++)
+  {
+    for (int link = 0; link < 2; link++)
+    {
+      if ((requests.rmc_bits[0] | requests.rmc_bits[link]) & stream_dids[i].rmc_bit)
+        requests.multiples[link].erase(stream_dids[i].did);
+    }
+    if (requests.multiples[0].count(stream_dids[i].did))
+    {
+      requests.rmc_bits[1] &= ~stream_dids[i].rmc_bit;
+      requests.multiples[1].erase(stream_dids[i].did);
+    }
+  }
+  return requests;
+}
+
+void InertialSenseROS::send_did_requests(const did_requests_t& requests, const did_requests_t& before, bool all,
+                                         std::vector<std::string>& sent)
+{
+  // Encoded here rather than with comm_, which belongs to the read loop once it is running.  ~port2 is
+  // only ever written to for these, so it is written directly
+  is_comm_instance_t comm;
+  uint8_t buffer[PKT_BUF_SIZE];
+  comm.buffer = buffer;
+  comm.bufferSize = sizeof(buffer);
+  is_comm_init(&comm);
+  auto write = [&](int link, const std::function<int(is_comm_instance_t*)>& encode)
+  {
+    if (link == 0 && initialized_)
+    {
+      commands_->post(encode);
+      return;
+    }
+    int messageSize = encode(&comm);
+    serialPortWrite(link ? port2_->port() : &serial_, buffer, messageSize);
+  };
+
+  for (int link = 0; link < (port2_ ? 2 : 1); link++)
+  {
+    char description[48];
+    const std::map<uint32_t, uint32_t>& multiples = requests.multiples[link];
+    const std::map<uint32_t, uint32_t>& old_multiples = before.multiples[link];
+
+    // A period multiple of 0 sends the data set once and stops it
+    for (std::map<uint32_t, uint32_t>::const_iterator m = old_multiples.begin(); m != old_multiples.end(); ++m)
+    {
+      if (multiples.count(m->first))
+        continue;
+      uint32_t did = m->first;
+      write(link, [did](is_comm_instance_t* c) { return is_comm_get_data(c, did, 0, 0, 0); });
+      snprintf(description, sizeof(description), "DID %u off%s", did, link ? " (port2)" : "");
+      sent.push_back(description);
+    }
+
+    bool rmc_changed = all || requests.rmc_bits[link] != before.rmc_bits[link];
+    if (rmc_changed)
+    {
+      uint32_t bits = requests.rmc_bits[link];
+      if (link == 0)
+        write(link, [bits](is_comm_instance_t* c) { return is_comm_get_data_rmc(c, bits); });
+      else
+      {
+        rmc_t rmc = {};
+        rmc.bits = bits;
+        rmc.options = RMC_OPTIONS_PORT_SER1;
+        write(link, [rmc](is_comm_instance_t* c) mutable { return is_comm_set_data(c, DID_RMC, 0, sizeof(rmc), &rmc); });
+      }
+      sent.push_back(link ? "RMC (port2)" : "RMC");
+    }
+
+    // An RMC request may replace what was asked for on its own, so those follow it
+    for (std::map<uint32_t, uint32_t>::const_iterator m = multiples.begin(); m != multiples.end(); ++m)
+    {
+      std::map<uint32_t, uint32_t>::const_iterator old = old_multiples.find(m->first);
+      if (!rmc_changed && old != old_multiples.end() && old->second == m->second)
+        continue;
+      uint32_t did = m->first;
+      uint32_t multiple = m->second;
+      write(link, [did, multiple](is_comm_instance_t* c) { return is_comm_get_data(c, did, 0, 0, multiple); });
+      snprintf(description, sizeof(description), "DID %u x%u%s", did, multiple, link ? " (port2)" : "");
+      sent.push_back(description);
+    }
+  }
+}
+
+ascii_msgs_t InertialSenseROS::NMEA_messages(const stream_config_t& config)
+{
+  ascii_msgs_t msgs = {};
+  msgs.options = (config.NMEA_ports & NMEA_SER0) ? RMC_OPTIONS_PORT_SER0 : 0; // output on serial 0
+  msgs.options |= (config.NMEA_ports & NMEA_SER1) ? RMC_OPTIONS_PORT_SER1 : 0; // output on serial 1
+  msgs.gpgga = (config.NMEA_configuration & NMEA_GPGGA) ? config.NMEA_rate : 0;
+  msgs.gpgll = (config.NMEA_configuration & NMEA_GPGLL) ? config.NMEA_rate : 0;
+  msgs.gpgsa = (config.NMEA_configuration & NMEA_GPGSA) ? config.NMEA_rate : 0;
+  msgs.gprmc = (config.NMEA_configuration & NMEA_GPRMC) ? config.NMEA_rate : 0;
+  return msgs;
+}
+
+void InertialSenseROS::set_expected_periods()
+{
+  // Navigation-rate DIDs on RMC come out every startupNavDtMs, the rest on RMC are learned from
+  // their timestamps
+  const uint32_t dids[] = { DID_INS_1, DID_INS_2, DID_DUAL_IMU, DID_PREINTEGRATED_IMU, DID_INL2_VARIANCE,
+                            DID_GPS1_SAT, DID_MAGNETOMETER_1, DID_BAROMETER };
+  for (int link = 0; link < (port2_ ? 2 : 1); link++)
+  {
+    StreamStats& stats = link ? port2_->stats() : stats_;
+    const did_requests_t& requests = did_requests_;
+    for (size_t i = 0; i < sizeof(dids) / sizeof(dids[0]); i++)
+    {
+      double period = 0;
+      std::map<uint32_t, uint32_t>::const_iterator m = requests.multiples[link].find(dids[i]);
+      if (m != requests.multiples[link].end())
+        period = native_period_ms(dids[i], nav_dt_ms_) * m->second * 1e-3;
+      else if (native_period_ms(dids[i], nav_dt_ms_) == (uint32_t)nav_dt_ms_)
+      {
+        for (size_t j = 0; j < sizeof(stream_dids) / sizeof(stream_dids[0]); j++)
+        {
+          if (stream_dids[j].did == dids[i] && (requests.rmc_bits[link] & stream_dids[j].rmc_bit))
+            period = nav_dt_ms_ * 1e-3;
+        }
+      }
+      stats.set_expected_period(dids[i], period);
+    }
+  }
 }
 
 template <typename T>
@@ -174,7 +889,7 @@ void InertialSenseROS::set_vector_flash_config(std::string param_name, uint32_t
   }
 
   int messageSize = is_comm_set_data(&comm_, DID_FLASH_CONFIG, offset, sizeof(v), v);
-  serialPortWrite(&serial_, message_buffer_, messageSize);
+  send_config(messageSize);
 }
 
 template <typename T>
@@ -183,7 +898,64 @@ void InertialSenseROS::set_flash_config(std::string param_name, uint32_t offset,
   T tmp;
   nh_private_.param<T>(param_name, tmp, def);
   int messageSize = is_comm_set_data(&comm_, DID_FLASH_CONFIG, offset, sizeof(T), &tmp);
-  serialPortWrite(&serial_, message_buffer_, messageSize);
+  send_config(messageSize);
+}
+
+void InertialSenseROS::send_config(int messageSize)
+{
+  // During start up nothing is streaming yet and the writes are expected to go out in order
+  if (initialized_)
+    writer_.push(SerialWriter::PRIORITY_CONFIG, message_buffer_, messageSize);
+  else
+    serialPortWrite(&serial_, message_buffer_, messageSize);
+}
+
+void InertialSenseROS::rtcm_callback(const inertial_sense::RTCM::ConstPtr& msg)
+{
+  if (!msg->data.empty())
+    writer_.push(SerialWriter::PRIORITY_CORRECTION, msg->data.data(), msg->data.size(), msg->header.stamp.toSec());
+}
+
+template <typename T>
+void InertialSenseROS::advertise(ros_stream_t& stream, const std::string& topic, const std::string& name,
+                                 const std::string& policy, int depth, bool second)
+{
+  std::string policy_name = nh_private_.param<std::string>("publish_policy/" + name, policy);
+  nh_private_.param<int>("publish_depth/" + name, depth, depth);
+  PublishExecutor::policy_t p;
+  if (!PublishExecutor::parse_policy(policy_name, p))
+  {
+    ROS_WARN("inertialsense: unknown ~publish_policy/%s \"%s\", using %s", name.c_str(), policy_name.c_str(), policy.c_str());
+    PublishExecutor::parse_policy(policy, p);
+  }
+
+  // Let TCPROS hold as much as our own queue, latest only keeps the newest there too
+  ros::Publisher& pub = second ? stream.pub2 : stream.pub;
+  pub = nh_.advertise<T>(topic, p == PublishExecutor::POLICY_LATEST ? 1 : std::max(depth, 1));
+  if (executor_)
+  {
+    (second ? stream.queue2 : stream.queue) = executor_->add<T>(topic, pub, p, depth);
+    ROS_DEBUG("inertialsense: publishing %s %s, depth %d", topic.c_str(), PublishExecutor::policy_name(p), depth);
+  }
+}
+
+template <typename T>
+void InertialSenseROS::publish(ros_stream_t& stream, const T& msg, bool second)
+{
+  // Publishers are left unadvertised when running disconnected
+  ros::Publisher& pub = second ? stream.pub2 : stream.pub;
+  PublishExecutor::Topic* queue = second ? stream.queue2 : stream.queue;
+  if (pub)
+  {
+    if (tracer_)
+      tracer_->publish_started();
+    if (queue)
+      static_cast<PublishExecutor::TopicQueue<T>*>(queue)->push(msg);
+    else
+      pub.publish(msg);
+    if (tracer_)
+      tracer_->publish_finished();
+  }
 }
 
 void InertialSenseROS::get_flash_config()
@@ -208,14 +980,26 @@ void InertialSenseROS::flash_config_callback(const nvm_flash_cfg_t * const msg)
 
 void InertialSenseROS::INS1_callback(const ins_1_t * const msg)
 {
-  if (got_GPS_fix_ & inertial_init_)
+  // Store the first fix as the reference, the parameter is only updated once the uINS has it
+  if (got_GPS_fix_ & inertial_init_ && commands_)
   {
-    std::vector<double> refLla_ (3);
-    refLla_[0] = msg->lla[0];
-    refLla_[1] = msg->lla[1];
-    refLla_[2] = msg->lla[2];
-    nh_private_.setParam("GPS_ref_lla", refLla_);
-    set_vector_flash_config<double>("GPS_ref_lla", 3, offsetof(nvm_flash_cfg_t, refLla));
+    double refLla[3] = { msg->lla[0], msg->lla[1], msg->lla[2] };
+    commands_->set_data(DID_FLASH_CONFIG, offsetof(nvm_flash_cfg_t, refLla), sizeof(refLla), refLla,
+                        [this](const CommandChannel::result_t& result)
+    {
+      if (!result.success)
+      {
+        ROS_ERROR("inertialsense: unable to store GPS_ref_lla: %s", result.message.c_str());
+        return;
+      }
+      const double* lla = (const double*)result.data.data();
+      std::vector<double> ref(lla, lla + 3);
+      nh_private_.setParam("GPS_ref_lla", ref);
+      ROS_INFO("inertialsense: GPS_ref_lla set to %.7f, %.7f, %.2f", lla[0], lla[1], lla[2]);
+      // The cached transforms are only read by the read thread, so they change there.  Not waited
+      // for, this runs on the command channel's thread and would hold up every other command
+      post_to_read_loop([this, ref]() { set_frames_reference(ref.data()); });
+    });
     inertial_init_ = false;
   }
   odom_msg.header.frame_id = frame_id_;
@@ -259,7 +1043,9 @@ void InertialSenseROS::INS_variance_callback(const inl2_variance_t * const msg)
 void InertialSenseROS::INS2_callback(const ins_2_t * const msg)
 {
   insStatus_ = msg->insStatus;  
-  odom_msg.header.stamp = ros::Time::now();
+  odom_msg.header.stamp = clock_sync_ ? ros_time_from_tow(msg->timeOfWeek) : ros::Time::now();
+  if (shm_ins_.map)
+    shmRingWrite(&shm_ins_, msg, sizeof(*msg), odom_msg.header.stamp.toSec(), msg->timeOfWeek);
   odom_msg.header.frame_id = frame_id_;
 
   odom_msg.pose.pose.orientation.w = msg->qn2b[0];
@@ -275,13 +1061,68 @@ void InertialSenseROS::INS2_callback(const ins_2_t * const msg)
   odom_msg.twist.twist.angular.y = imu1_msg.angular_velocity.y;
   odom_msg.twist.twist.angular.z = imu1_msg.angular_velocity.z;
   if (INS_.enabled)
-    INS_.pub.publish(odom_msg);
+  {
+    publish(INS_, odom_msg);
+    if (!odom_frames_.empty())
+      publish_frames(msg->lla);
+  }
+}
+
+void InertialSenseROS::publish_frames(const double* lla)
+{
+  const geometry_msgs::Quaternion& q = odom_msg.pose.pose.orientation;
+  double q_ned[4] = { q.w, q.x, q.y, q.z };
+  GeodeticFrames::pose_t poses[GeodeticFrames::FRAMES];
+  geodetic_.convert(lla, q_ned, odom_frames_.data(), odom_frames_.size(), poses);
+
+  for (size_t i = 0; i < odom_frames_.size(); i++)
+  {
+    if (GeodeticFrames::needs_reference(odom_frames_[i]) && !geodetic_.has_reference())
+      continue;
+    const GeodeticFrames::pose_t& pose = poses[i];
+    nav_msgs::Odometry& odom = frame_msg_;
+    odom = odom_msg;
+    odom.header.frame_id = odom_frame_ids_[i];
+    odom.child_frame_id = frame_id_;
+    odom.pose.pose.position.x = pose.position[0];
+    odom.pose.pose.position.y = pose.position[1];
+    odom.pose.pose.position.z = pose.position[2];
+    odom.pose.pose.orientation.w = pose.orientation[0];
+    odom.pose.pose.orientation.x = pose.orientation[1];
+    odom.pose.pose.orientation.y = pose.orientation[2];
+    odom.pose.pose.orientation.z = pose.orientation[3];
+
+    // Position covariance is diagonal in NED, R P R^T in the frame
+    const double* r = pose.rotation;
+    const double p[3] = { odom_msg.pose.covariance[0], odom_msg.pose.covariance[7], odom_msg.pose.covariance[14] };
+    for (int a = 0; a < 3; a++)
+    {
+      for (int b = 0; b < 3; b++)
+        odom.pose.covariance[6*a+b] = r[3*a] * r[3*b] * p[0] + r[3*a+1] * r[3*b+1] * p[1] + r[3*a+2] * r[3*b+2] * p[2];
+    }
+    publish(odom_frame_streams_[i], odom);
+
+    if ((int)i == tf_frame_)
+    {
+      tf_msg_.transforms.resize(1);
+      geometry_msgs::TransformStamped& t = tf_msg_.transforms[0];
+      t.header = odom.header;
+      t.child_frame_id = frame_id_;
+      t.transform.translation.x = pose.position[0];
+      t.transform.translation.y = pose.position[1];
+      t.transform.translation.z = pose.position[2];
+      t.transform.rotation = odom.pose.pose.orientation;
+      publish(tf_, tf_msg_);
+    }
+  }
 }
 
 
 void InertialSenseROS::IMU_callback(const dual_imu_t* const msg)
 {
-  imu1_msg.header.stamp = ros::Time::now();
+  imu1_msg.header.stamp = clock_sync_ ? ros_time_from_start_time(msg->time) : ros::Time::now();
+  if (shm_imu_.map)
+    shmRingWrite(&shm_imu_, msg, sizeof(*msg), imu1_msg.header.stamp.toSec(), msg->time);
   imu1_msg.header.frame_id = imu2_msg.header.frame_id = frame_id_;
 
   imu1_msg.angular_velocity.x = msg->I[0].pqr[0];
@@ -298,10 +1139,103 @@ void InertialSenseROS::IMU_callback(const dual_imu_t* const msg)
 //  imu2_msg.linear_acceleration.y = msg->I[1].acc[1];
 //  imu2_msg.linear_acceleration.z = msg->I[1].acc[2];
 
+  if (imu_health_)
+    imu_health_->push(*msg);
+
+  if (allan_)
+  {
+    float sample[AllanVariance::DUAL_IMU_CHANNELS];
+    AllanVariance::dual_imu_sample(*msg, sample);
+    std::lock_guard<std::mutex> lock(allan_mutex_);
+    if (allan_->samples() == 0)
+      allan_first_time_ = msg->time;
+    allan_last_time_ = msg->time;
+    allan_->push(sample);
+  }
+
   if (IMU_.enabled)
   {
-    IMU_.pub.publish(imu1_msg);
+    publish(IMU_, imu1_msg);
 //    IMU_.pub2.publish(imu2_msg);
+
+    float sample[6] = { msg->I[0].pqr[0], msg->I[0].pqr[1], msg->I[0].pqr[2],
+                        msg->I[0].acc[0], msg->I[0].acc[1], msg->I[0].acc[2] };
+    if (imu_decimator_.size() && imu_decimator_.push(sample, 6, imu1_msg.header.stamp.toSec()))
+    {
+      for (int i = 0; i < imu_decimator_.size(); i++)
+      {
+        if (!imu_decimator_.ready(i))
+          continue;
+        const float* value = imu_decimator_.value(i);
+        sensor_msgs::Imu decimated = imu1_msg;
+        decimated.header.stamp = ros::Time(imu_decimator_.time(i));
+        decimated.angular_velocity.x = value[0];
+        decimated.angular_velocity.y = value[1];
+        decimated.angular_velocity.z = value[2];
+        decimated.linear_acceleration.x = value[3];
+        decimated.linear_acceleration.y = value[4];
+        decimated.linear_acceleration.z = value[5];
+        publish(imu_decimated_[i], decimated);
+      }
+    }
+  }
+}
+
+double InertialSenseROS::allan_dt() const
+{
+  // From the device clock, which doesn't see the host's scheduling
+  uint64_t n = allan_->samples();
+  return n > 1 ? (allan_last_time_ - allan_first_time_) / (n - 1) : 0.0;
+}
+
+void InertialSenseROS::allan_timer_callback(const ros::TimerEvent& event)
+{
+  (void)event;
+  std::vector<std::vector<AllanVariance::point_t> > curves(allan_names_.size());
+  std::vector<AllanVariance::noise_t> noise(allan_names_.size());
+  {
+    std::lock_guard<std::mutex> lock(allan_mutex_);
+    double dt = allan_dt();
+    if (dt <= 0)
+      return;
+    for (size_t c = 0; c < allan_names_.size(); c++)
+      allan_->curve(c, dt, curves[c]);
+  }
+  for (size_t c = 0; c < allan_names_.size(); c++)
+    noise[c] = AllanVariance::fit(curves[c]);
+
+  FILE* file = fopen(allan_file_.c_str(), "w");
+  if (!file)
+  {
+    ROS_WARN_THROTTLE(60, "inertialsense: unable to write ~allan_file \"%s\"", allan_file_.c_str());
+    return;
+  }
+  AllanVariance::write_csv(file, allan_names_, curves, noise);
+  fclose(file);
+}
+
+int InertialSenseROS::imu_period_ms(const did_requests_t& requests, int nav_dt_ms) const
+{
+  for (int link = 0; link < 2; link++)
+  {
+    std::map<uint32_t, uint32_t>::const_iterator m = requests.multiples[link].find(DID_DUAL_IMU);
+    if (m != requests.multiples[link].end())
+      return native_period_ms(DID_DUAL_IMU, nav_dt_ms) * m->second;
+  }
+  return native_period_ms(DID_DUAL_IMU, nav_dt_ms);
+}
+
+void InertialSenseROS::setup_imu_decimation(int period_ms)
+{
+  for (int i = 0; i < imu_decimator_.size(); i++)
+  {
+    int hz = imu_decimation_hz_[i];
+    int ratio = std::max<int>(lround(1000.0 / (hz * period_ms)), 1);
+    double actual_hz = 1000.0 / (ratio * period_ms);
+    if (fabs(actual_hz - hz) > 0.01 * hz)
+      ROS_WARN("inertialsense: imu/%dhz comes out at %.1f Hz, every %d IMU samples (%d ms apart)", hz, actual_hz, ratio,
+               period_ms);
+    imu_decimator_.set_ratio(i, ratio);
   }
 }
 
@@ -310,9 +1244,12 @@ void InertialSenseROS::GPS_callback(const gps_nav_t * const msg)
 {
   GPS_week_ = msg->week;
   GPS_towOffset_ = msg->towOffset;
+  if (GPS_.enabled || shm_gps_.map)
+    gps_msg.header.stamp = clock_sync_ ? ros_time_from_week_and_tow(msg->week, msg->timeOfWeekMs * 1e-3) : ros::Time::now();
+  if (shm_gps_.map)
+    shmRingWrite(&shm_gps_, msg, sizeof(*msg), gps_msg.header.stamp.toSec(), msg->timeOfWeekMs * 1e-3);
   if (GPS_.enabled)
   {
-    gps_msg.header.stamp = ros::Time::now();
     gps_msg.fix_type = msg->status & GPS_STATUS_FIX_MASK;
     gps_msg.header.frame_id =frame_id_;
     gps_msg.num_sat = (uint8_t)(msg->status & GPS_STATUS_NUM_SATS_USED_MASK);
@@ -327,7 +1264,7 @@ void InertialSenseROS::GPS_callback(const gps_nav_t * const msg)
     gps_msg.linear_velocity.x = msg->velNed[0];
     gps_msg.linear_velocity.y = msg->velNed[1];
     gps_msg.linear_velocity.z = msg->velNed[2];
-    GPS_.pub.publish(gps_msg);
+    publish(GPS_, gps_msg);
   }
 
   if (!got_GPS_fix_)
@@ -339,110 +1276,410 @@ void InertialSenseROS::GPS_callback(const gps_nav_t * const msg)
   }
 }
 
-void InertialSenseROS::update()
+bool InertialSenseROS::take_rt_thread(RealTime::thread_options_t& options, size_t& stack_bytes)
+{
+  if (!rt_pending_)
+    return false;
+  options = rt_thread_;
+  stack_bytes = rt_stack_bytes_;
+  rt_pending_ = false;
+  return true;
+}
+
+void InertialSenseROS::update(int timeout_ms)
 {
-  uint8_t buffer[512];
-  int bytes_read = serialPortReadTimeout(&serial_, buffer, 512, 1);
+  int bytes_read;
+  int request;
+  bool more;
+
+  // Set up whichever thread ends up running the device, not the one that constructed it
+  if (rt_pending_ && initialized_)
+  {
+    RealTime::configure_thread("is_read", rt_thread_, rt_stack_bytes_);
+    rt_pending_ = false;
+  }
+
+  if (read_loop_task_pending_.load(std::memory_order_acquire))
+  {
+    std::lock_guard<std::mutex> lock(read_loop_task_mutex_);
+    while (!read_loop_tasks_.empty())
+    {
+      std::shared_ptr<read_loop_task_t> task = read_loop_tasks_.front();
+      read_loop_tasks_.pop_front();
+      task->run();
+      task->done = true;
+    }
+    read_loop_task_pending_.store(false, std::memory_order_release);
+    read_loop_task_done_.notify_all();
+  }
+
+  if (connected_ && !port_open_ && !reopen_port())
+    return;
 
-  for (int i = 0; i < bytes_read; i++)
+  do
+  {
+    // When polled, ask the driver how much is waiting and take all of it with one read(),
+    // growing the buffer (up to ~read_buffer_max) when it falls short
+    request = read_buffer_.size();
+    more = false;
+    if (timeout_ms == 0)
+    {
+      int available = serialPortGetByteCountAvailableToRead(&serial_);
+      stats_.add_syscalls(1);
+      if (available > request && read_buffer_.size() < read_buffer_max_)
+      {
+        size_t size = read_buffer_.size();
+        while (size < (size_t)available && size < read_buffer_max_)
+          size *= 2;
+        read_buffer_.resize(std::min(size, read_buffer_max_));
+        stats_.set_read_buffer(read_buffer_.size());
+        request = read_buffer_.size();
+      }
+      more = available > request;
+      request = std::min(request, std::max(available, 0));
+    }
+
+    bytes_read = 0;
+    if (request > 0)
+    {
+      if (tracer_)
+        tracer_->read_started();
+      double read_start = timeout_ms > 0 ? WakeupStats::now() : 0;
+      bytes_read = serialPortReadTimeout(&serial_, read_buffer_.data(), request, timeout_ms);
+      if (timeout_ms > 0 && bytes_read == 0)
+        wakeup_.add(timeout_ms * 1e-3, WakeupStats::now() - read_start);
+      if (tracer_)
+        tracer_->read_finished();
+      stats_.add_read(std::max(bytes_read, 0));
+      if (network_port_)
+        stats_.add_truncated(serialPortNetTakeTruncated(&serial_));
+    }
+    if (raw_server_)
+    {
+      raw_server_->broadcast(read_buffer_.data(), bytes_read);
+      raw_server_->service([this](const uint8_t* command, int len)
+      {
+        writer_.push(SerialWriter::PRIORITY_COMMAND, command, len);
+      });
+    }
+    if (connected_)
+      writer_.service(&serial_);
+    parse_bytes(read_buffer_.data(), bytes_read);
+
+    // Don't hold the second link's frames for long when the main one is quiet
+    if (port2_ && initialized_)
+      merge_port2(-1, AuxPort::steady_clock_t::now() - std::chrono::duration_cast<AuxPort::steady_clock_t::duration>(
+                          std::chrono::duration<double>(merge_window_)));
+
+    // Only go around again when the buffer couldn't take everything that was there, or for
+    // datagrams a batched UDP read already pulled in, which won't wake poll() again
+  } while (timeout_ms == 0 && bytes_read > 0 && bytes_read == request && (more || network_port_));
+}
+
+void InertialSenseROS::spin(EventCallbackQueue& queue, const std::function<bool()>& keep_going)
+{
+  // The port, the callback queue, then the raw stream server's sockets
+  std::vector<struct pollfd> fds(2);
+  while (keep_going())
+  {
+    fds.resize(2);
+    fds[0].fd = fd();
+    fds[0].events = POLLIN | POLLRDHUP | (write_pending() ? POLLOUT : 0);
+    fds[1].fd = queue.fd();
+    fds[1].events = POLLIN;
+    raw_stream_fds(fds);
+    int timeout_ms = poll_timeout_ms();
+    double start = WakeupStats::now();
+    int rc = poll(fds.data(), fds.size(), timeout_ms);
+    stats_.add_syscalls(1);
+    if (rc < 0 && errno != EINTR)
+    {
+      ROS_ERROR("inertialsense: poll failed: %s", strerror(errno));
+      break;
+    }
+    if (rc == 0)
+      wakeup_.add(timeout_ms * 1e-3, WakeupStats::now() - start);
+    if (fds[1].revents & POLLIN)
+      queue.call_signalled();
+
+    // Also after callbacks, so anything they queued for the uINS starts going out right away
+    update(0);
+
+    // After update(), so what arrived before a hang up is still handled
+    if (fds[0].fd >= 0)
+      check_port(fds[0].revents);
+  }
+}
+
+int InertialSenseROS::poll_timeout_ms() const
+{
+  // Frames from the second port wait at most the merge window, otherwise only check for
+  // shutdown now and then
+  int timeout_ms = 100;
+  if (port2_)
+    timeout_ms = std::max(1, (int)(merge_window_ * 1e3));
+
+  // With a read threshold poll() won't see the tail of a burst until more data arrives
+  if (read_min_bytes_ > 1)
+    timeout_ms = std::min(timeout_ms, read_max_wait_ms_);
+  return timeout_ms;
+}
+
+int InertialSenseROS::fd()
+{
+  return connected_ && port_open_ ? serialPortPlatformGetFd(&serial_) : -1;
+}
+
+void InertialSenseROS::raw_stream_fds(std::vector<struct pollfd>& fds) const
+{
+  if (raw_server_)
+    raw_server_->poll_fds(fds);
+}
+
+void InertialSenseROS::check_port(short revents)
+{
+  if (!port_open_ || !(revents & (POLLHUP | POLLRDHUP | POLLERR | POLLNVAL)))
+    return;
+  ROS_ERROR("inertialsense: lost \"%s\" (%s), reopening it every second", port_.c_str(),
+            (revents & POLLNVAL) ? "invalid descriptor" : (revents & POLLERR) ? "error" : "hung up");
+  serialPortClose(&serial_);
+  port_open_ = false;
+  port_retry_ = ros::WallTime::now();
+}
+
+bool InertialSenseROS::reopen_port()
+{
+  ros::WallTime now = ros::WallTime::now();
+  if (now < port_retry_)
+    return false;
+  port_retry_ = now + ros::WallDuration(1.0);
+  if (serialPortOpen(&serial_, port_.c_str(), baudrate_, true) != 1)
+    return false;
+
+  ROS_INFO("inertialsense: reopened \"%s\"", port_.c_str());
+  port_open_ = true;
+  // A partial frame from before is of no use, and a replugged uINS starts with its flash defaults
+  is_comm_init(&comm_);
+  frame_bytes_ = 0;
+  std::vector<std::string> sent;
+  send_did_requests(did_requests_, did_requests_t(), true, sent);
+  return true;
+}
+
+void InertialSenseROS::set_clock_sync(ClockSync* sync, const std::string& name)
+{
+  clock_sync_ = sync;
+  boot_clock_ = sync->add_clock(name + " boot");
+  tow_clock_ = sync->add_clock(name + " tow");
+}
+
+void InertialSenseROS::parse_bytes(const uint8_t* buffer, int len)
+{
+  for (int i = 0; i < len; i++)
   {
     uint32_t message_type = is_comm_parse(&comm_, buffer[i]);
 
+    frame_bytes_++;
+    bad_frames_.track(buffer[i]);
+    if (message_type == (uint32_t)-1)
+    {
+      stats_.add_bad_frame();
+      frame_bytes_ = 0;
+    }
+    else if (message_type != DID_NULL)
+    {
+      stats_.add_frame(message_type, frame_bytes_, message_buffer_);
+      bad_frames_.good_frame();
+      if (commands_)
+        commands_->frame_received(message_type, message_buffer_);
+      frame_bytes_ = 0;
+      if (tracer_)
+        tracer_->frame_parsed(message_type);
+    }
+
     if (message_type == DID_FLASH_CONFIG)
     {
+      // Also the read back of every flash set, so keep parsing what came after it
       flash_config_callback((nvm_flash_cfg_t*) message_buffer_);
-      break;
+      if (tracer_)
+        tracer_->frame_handled();
+      continue;
     }
 
-    if(initialized_)
+    if (initialized_)
     {
-      switch (message_type)
+      // Frames from the second link that belong before this one go first
+      const uint8_t* data = message_buffer_;
+      if (port2_ && message_type != DID_NULL && message_type != (uint32_t)-1)
       {
-      case DID_NULL:
-        // no valid message yet
-        break;
-      case DID_INS_1:
-        INS1_callback((ins_1_t*) message_buffer_);
-        break;
-      case DID_INS_2:
-        INS2_callback((ins_2_t*) message_buffer_);
-        break;
-      case DID_INL2_VARIANCE:
-        INS_variance_callback((inl2_variance_t*) message_buffer_);
-        break;
-
-      case DID_DUAL_IMU:
-        IMU_callback((dual_imu_t*) message_buffer_);
-        break;
-
-      case DID_GPS_NAV:
-        GPS_callback((gps_nav_t*) message_buffer_);
-        break;
-
-      case DID_GPS1_SAT:
-        GPS_Info_callback((gps_sat_t*) message_buffer_);
-        break;
-
-      case DID_MAGNETOMETER_1:
-        mag_callback((magnetometer_t*) message_buffer_, 1);
-        break;
-      case DID_MAGNETOMETER_2:
-        mag_callback((magnetometer_t*) message_buffer_, 2);
-        break;
-
-      case DID_BAROMETER:
-        baro_callback((barometer_t*) message_buffer_);
-        break;
-
-      case DID_PREINTEGRATED_IMU:
-        preint_IMU_callback((preintegrated_imu_t*) message_buffer_);
-        break;
-      case DID_STROBE_IN_TIME:
-        strobe_in_time_callback((strobe_in_time_t*) message_buffer_);
-        break;
-
-      case -1:
-        bad_data_callback(message_buffer_);
-        break;
-
-      default:
-        ROS_INFO("Unhandled IS message %d", message_type);
-        break;
+        double t = merge_time(message_type, message_buffer_);
+        if (port2_->front())
+        {
+          // Their handlers may write to the uINS through message_buffer_
+          memcpy(merge_buffer_, message_buffer_, sizeof(merge_buffer_));
+          data = merge_buffer_;
+          merge_port2(t, AuxPort::steady_clock_t::now());
+        }
+        if (t >= 0)
+          last_port1_time_ = t;
       }
+      handle_frame(message_type, data);
     }
+
+    if (tracer_ && message_type != DID_NULL)
+      tracer_->frame_handled();
+  }
+}
+
+void InertialSenseROS::handle_frame(uint32_t message_type, const uint8_t* data)
+{
+  switch (message_type)
+  {
+  case DID_NULL:
+    // no valid message yet
+    break;
+  case DID_INS_1:
+    INS1_callback((const ins_1_t*) data);
+    break;
+  case DID_INS_2:
+    INS2_callback((const ins_2_t*) data);
+    break;
+  case DID_INL2_VARIANCE:
+    INS_variance_callback((const inl2_variance_t*) data);
+    break;
+
+  case DID_DUAL_IMU:
+    IMU_callback((const dual_imu_t*) data);
+    break;
+
+  case DID_GPS_NAV:
+    GPS_callback((const gps_nav_t*) data);
+    break;
+
+  case DID_GPS1_SAT:
+    GPS_Info_callback((const gps_sat_t*) data);
+    break;
+
+  case DID_MAGNETOMETER_1:
+    mag_callback((const magnetometer_t*) data, 1);
+    break;
+  case DID_MAGNETOMETER_2:
+    mag_callback((const magnetometer_t*) data, 2);
+    break;
+
+  case DID_BAROMETER:
+    baro_callback((const barometer_t*) data);
+    break;
+
+  case DID_PREINTEGRATED_IMU:
+    preint_IMU_callback((const preintegrated_imu_t*) data);
+    break;
+  case DID_STROBE_IN_TIME:
+    strobe_in_time_callback((const strobe_in_time_t*) data);
+    break;
+
+  case -1:
+    bad_data_callback();
+    break;
+
+  default:
+    ROS_INFO("Unhandled IS message %d", message_type);
+    break;
+  }
+}
+
+void InertialSenseROS::diagnostics_callback(const ros::TimerEvent& event)
+{
+  (void)event;
+  ros::WallTime now = ros::WallTime::now();
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now();
+  stats_.fill_diagnostics(msg, port_, (now - last_diagnostics_).toSec());
+  bandwidth_.fill_diagnostics(msg, port_, bandwidth_capacity_, stats_.byte_rate());
+  if (raw_server_)
+    raw_server_->fill_diagnostics(msg, port_);
+  writer_.fill_diagnostics(msg, port_, rtcm_max_age_);
+  if (commands_)
+    commands_->fill_diagnostics(msg, port_);
+  wakeup_.fill_diagnostics(msg, port_, "read", wakeup_warn_us_);
+  if (executor_)
+    executor_->fill_diagnostics(msg, port_);
+  if (allan_)
+  {
+    std::lock_guard<std::mutex> lock(allan_mutex_);
+    if (allan_dt() > 0)
+      allan_->fill_diagnostics(msg, port_, allan_names_, allan_dt());
   }
+  if (imu_health_)
+    imu_health_->fill_diagnostics(msg, port_);
+  satellites_.fill_diagnostics(msg, port_);
+  if (port2_)
+  {
+    port2_->stats().fill_diagnostics(msg, port2_->name(), (now - last_diagnostics_).toSec());
+    bandwidth2_.fill_diagnostics(msg, port2_->name(), bandwidth2_capacity_, port2_->stats().byte_rate());
+    port2_->fill_diagnostics(msg, wakeup_warn_us_);
+  }
+  last_diagnostics_ = now;
+  diagnostics_pub_.publish(msg);
 }
 
 void InertialSenseROS::strobe_in_time_callback(const strobe_in_time_t * const msg)
 {
   // create the subscriber if it doesn't exist
-  if (strobe_pub_.getTopic().empty())
-    strobe_pub_ = nh_.advertise<std_msgs::Header>("strobe_time", 1);
+  if (strobe_.pub.getTopic().empty() && connected_)
+    advertise<std_msgs::Header>(strobe_, "strobe_time", "strobe", "lossless", 16);
 
   std_msgs::Header strobe_msg;
   strobe_msg.stamp = ros_time_from_week_and_tow(msg->week, msg->timeOfWeekMs * 1e-3);
-  strobe_pub_.publish(strobe_msg);
+  publish(strobe_, strobe_msg);
 }
 
 
 void InertialSenseROS::GPS_Info_callback(const gps_sat_t* const msg)
 {
-  gps_info_msg.header.stamp =ros::Time::now();
+  satellites_.update(*msg, sat_events_);
+  ros::Time stamp = clock_sync_ ? ros_time_from_tow(msg->timeOfWeekMs * 1e-3) : ros::Time::now();
+  if (!sat_events_.empty())
+  {
+    gps_info_events_msg.header.stamp = stamp;
+    gps_info_events_msg.header.frame_id = frame_id_;
+    gps_info_events_msg.events.resize(sat_events_.size());
+    for (size_t i = 0; i < sat_events_.size(); i++)
+    {
+      inertial_sense::SatEvent& event = gps_info_events_msg.events[i];
+      event.type = sat_events_[i].type;
+      event.gnss_id = sat_events_[i].gnss_id;
+      event.sat_id = sat_events_[i].sv_id;
+      event.cno = sat_events_[i].cno;
+    }
+    publish(GPS_info_, gps_info_events_msg, true);
+  }
+
+  if (gps_info_epochs_++ % gps_info_full_every_ != 0)
+    return;
+  // Only the tracked satellites, resizing within the capacity from earlier epochs
+  gps_info_msg.header.stamp = stamp;
   gps_info_msg.header.frame_id = frame_id_;
   gps_info_msg.num_sats = msg->numSats;
-  for (int i = 0; i < 50; i++)
+  gps_info_msg.sattelite_info.resize(satellites_.tracked_count());
+  size_t n = 0;
+  for (int slot = 0; slot < SatelliteStore::SLOTS && n < gps_info_msg.sattelite_info.size(); slot++)
   {
-    gps_info_msg.sattelite_info[i].sat_id = msg->sat[i].svId;
-    gps_info_msg.sattelite_info[i].cno = msg->sat[i].cno;
+    if (!satellites_.tracked(slot))
+      continue;
+    inertial_sense::SatInfo& info = gps_info_msg.sattelite_info[n++];
+    info.gnss_id = satellites_.gnss_id(slot);
+    info.sat_id = satellites_.sv_id(slot);
+    info.cno = satellites_.cno(slot);
   }
-  GPS_info_.pub.publish(gps_info_msg);
+  publish(GPS_info_, gps_info_msg);
 }
 
 
 void InertialSenseROS::mag_callback(const magnetometer_t* const msg, int mag_number)
 {
   sensor_msgs::MagneticField mag_msg;
-  mag_msg.header.stamp = ros::Time::now();
+  mag_msg.header.stamp = clock_sync_ ? ros_time_from_start_time(msg->time) : ros::Time::now();
   mag_msg.header.frame_id = frame_id_;
   mag_msg.magnetic_field.x = msg->mag[0];
   mag_msg.magnetic_field.y = msg->mag[1];
@@ -450,7 +1687,7 @@ void InertialSenseROS::mag_callback(const magnetometer_t* const msg, int mag_num
 
   if(mag_number == 1)
   {
-    mag_.pub.publish(mag_msg);
+    publish(mag_, mag_msg);
   }
 //  else
 //  {
@@ -461,17 +1698,17 @@ void InertialSenseROS::mag_callback(const magnetometer_t* const msg, int mag_num
 void InertialSenseROS::baro_callback(const barometer_t * const msg)
 {
   sensor_msgs::FluidPressure baro_msg;
-  baro_msg.header.stamp = ros::Time::now();
+  baro_msg.header.stamp = clock_sync_ ? ros_time_from_start_time(msg->time) : ros::Time::now();
   baro_msg.header.frame_id = frame_id_;
   baro_msg.fluid_pressure = msg->bar;
 
-  baro_.pub.publish(baro_msg);
+  publish(baro_, baro_msg);
 }
 
 void InertialSenseROS::preint_IMU_callback(const preintegrated_imu_t * const msg)
 {
   inertial_sense::PreIntIMU preintIMU_msg;   
-  preintIMU_msg.header.stamp = ros::Time::now();
+  preintIMU_msg.header.stamp = clock_sync_ ? ros_time_from_start_time(msg->time) : ros::Time::now();
   preintIMU_msg.header.frame_id = frame_id_;
   preintIMU_msg.dtheta.x = msg->theta1[0];
   preintIMU_msg.dtheta.y = msg->theta1[1];
@@ -483,25 +1720,245 @@ void InertialSenseROS::preint_IMU_callback(const preintegrated_imu_t * const msg
 
   preintIMU_msg.dt = msg->dt;
 
-  dt_vel_.pub.publish(preintIMU_msg);
+  publish(dt_vel_, preintIMU_msg);
 }
 
 bool InertialSenseROS::perform_mag_cal_srv_callback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
 {
   (void)req;
-  res.success = true;
-  uint32_t single_axis_command = 1;
-  int messageSize = is_comm_set_data(&comm_, DID_MAG_CAL, offsetof(mag_cal_t, enMagRecal), sizeof(uint32_t), &single_axis_command);
-  serialPortWrite(&serial_, message_buffer_, messageSize);
+  return start_mag_cal(1, res);
 }
 
 bool InertialSenseROS::perform_multi_mag_cal_srv_callback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
 {
   (void)req;
-  res.success = true;
-  uint32_t multi_axis_command = 0;
-  int messageSize = is_comm_set_data(&comm_, DID_MAG_CAL, offsetof(mag_cal_t, enMagRecal), sizeof(uint32_t), &multi_axis_command);
-  serialPortWrite(&serial_, message_buffer_, messageSize);
+  return start_mag_cal(0, res);
+}
+
+bool InertialSenseROS::start_mag_cal(uint32_t mode, std_srvs::Trigger::Response &res)
+{
+  // Runs on the command spinner, so waiting here doesn't hold up reading the reply
+  CommandChannel::result_t result = commands_->set_data(DID_MAG_CAL, offsetof(mag_cal_t, enMagRecal), sizeof(mode), &mode).get();
+  res.success = result.success;
+  res.message = result.message;
+  return true;
+}
+
+bool InertialSenseROS::run_in_read_loop(const std::function<void()>& task, double timeout_s)
+{
+  std::shared_ptr<read_loop_task_t> mine = std::make_shared<read_loop_task_t>();
+  mine->run = task;
+  mine->done = false;
+
+  std::unique_lock<std::mutex> lock(read_loop_task_mutex_);
+  read_loop_tasks_.push_back(mine);
+  read_loop_task_pending_.store(true, std::memory_order_release);
+  if (read_loop_task_done_.wait_for(lock, std::chrono::duration<double>(timeout_s), [&mine]() { return mine->done; }))
+    return true;
+
+  // Not running, take ours back and leave any other caller's in the queue
+  read_loop_tasks_.erase(std::find(read_loop_tasks_.begin(), read_loop_tasks_.end(), mine));
+  if (read_loop_tasks_.empty())
+    read_loop_task_pending_.store(false, std::memory_order_release);
+  return false;
+}
+
+void InertialSenseROS::post_to_read_loop(const std::function<void()>& task)
+{
+  std::shared_ptr<read_loop_task_t> posted = std::make_shared<read_loop_task_t>();
+  posted->run = task;
+  posted->done = false;
+
+  std::lock_guard<std::mutex> lock(read_loop_task_mutex_);
+  read_loop_tasks_.push_back(posted);
+  read_loop_task_pending_.store(true, std::memory_order_release);
+}
+
+bool InertialSenseROS::configure_streams_srv_callback(inertial_sense::ConfigureStreams::Request &req,
+                                                      inertial_sense::ConfigureStreams::Response &res)
+{
+  std::lock_guard<std::mutex> lock(reconfigure_mutex_);
+  res.success = false;
+
+  stream_config_t config = stream_config_;
+  for (int on = 0; on < 2; on++)
+  {
+    const std::vector<std::string>& names = on ? req.enable : req.disable;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+      if (!stream(names[i]))
+      {
+        res.message = "unknown stream \"" + names[i] + "\"";
+        return true;
+      }
+      if (on)
+        config.streams.insert(names[i]);
+      else
+        config.streams.erase(names[i]);
+    }
+  }
+  if (req.period_streams.size() != req.period_ms.size())
+  {
+    res.message = "period_streams and period_ms must be the same length";
+    return true;
+  }
+  for (size_t i = 0; i < req.period_streams.size(); i++)
+  {
+    if (!stream(req.period_streams[i]) || req.period_streams[i] == "GPS")
+    {
+      res.message = "no period for stream \"" + req.period_streams[i] + "\"";
+      return true;
+    }
+    if (req.period_ms[i] > 0)
+      config.period_ms[req.period_streams[i]] = req.period_ms[i];
+    else
+      config.period_ms.erase(req.period_streams[i]);
+  }
+  if (req.set_NMEA)
+  {
+    config.NMEA_rate = req.NMEA_rate;
+    config.NMEA_configuration = req.NMEA_configuration;
+    config.NMEA_ports = req.NMEA_ports;
+  }
+
+  // Only the navigation rate is read at boot, everything else changes on the fly
+  int nav_dt_ms = req.navigation_dt_ms ? req.navigation_dt_ms : nav_dt_ms_;
+  bool reset = nav_dt_ms != nav_dt_ms_;
+  // What the IMU decimators were set up for, before a reset changes nav_dt_ms_
+  int old_imu_period = imu_period_ms(did_requests_, nav_dt_ms_);
+  if (reset && !req.allow_reset)
+  {
+    res.message = "changing navigation_dt_ms resets the uINS, set allow_reset";
+    return true;
+  }
+
+  BandwidthPlanner planner1, planner2;
+  if (!plan_bandwidth(nav_dt_ms, config, planner1, planner2))
+  {
+    res.message = "streams don't fit the serial link (~bandwidth_policy is refuse)";
+    return true;
+  }
+
+  // The flash set has to be confirmed before anything else changes, so a refused one leaves
+  // the node as it was
+  std::vector<std::string> sent;
+  if (reset)
+  {
+    uint32_t value = nav_dt_ms;
+    CommandChannel::result_t result = commands_->set_data(DID_FLASH_CONFIG, offsetof(nvm_flash_cfg_t, startupNavDtMs),
+                                                          sizeof(value), &value).get();
+    if (!result.success)
+    {
+      res.message = "unable to change navigation_dt_ms: " + result.message;
+      return true;
+    }
+    ROS_INFO("navigation rate change from %dms to %dms, resetting uINS to make change", nav_dt_ms_, nav_dt_ms);
+    commands_->post([](is_comm_instance_t* comm)
+    {
+      uint32_t reset_command = 99;
+      return is_comm_set_data(comm, DID_CONFIG, offsetof(config_t, system), sizeof(uint32_t), &reset_command);
+    });
+    sleep(3);
+    sent.push_back("reset");
+  }
+
+  did_requests_t requests = did_requests(config, nav_dt_ms);
+  did_requests_t before = did_requests_;
+  int imu_period = imu_period_ms(requests, nav_dt_ms);
+  bool redecimate = !imu_decimated_.empty() && imu_period != old_imu_period;
+
+  // Publishers for the streams turning on go up before their data is asked for.  The swap
+  // happens between reads, the old publishers are shut down here afterwards
+  std::vector<std::pair<ros_stream_t*, ros_stream_t>> changes;
+  for (size_t i = 0; i < sizeof(stream_names) / sizeof(stream_names[0]); i++)
+  {
+    const char* name = stream_names[i];
+    if (config.on(name) == stream_config_.on(name))
+      continue;
+    ros_stream_t s;
+    s.enabled = config.on(name);
+    if (s.enabled)
+      advertise_stream(name, s);
+    changes.push_back(std::make_pair(stream(name), s));
+  }
+  bool swapped = run_in_read_loop([&]()
+  {
+    for (size_t i = 0; i < changes.size(); i++)
+      std::swap(*changes[i].first, changes[i].second);
+    bandwidth_ = planner1;
+    bandwidth2_ = planner2;
+    // reopen_port() and the stream statistics read these from the read loop too
+    nav_dt_ms_ = nav_dt_ms;
+    did_requests_ = requests;
+    if (redecimate)
+      setup_imu_decimation(imu_period);
+    set_expected_periods();
+  });
+  if (!swapped)
+  {
+    res.message = "the read loop isn't running";
+    return true;
+  }
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    if (executor_ && changes[i].second.queue)
+      executor_->remove(changes[i].second.queue);
+    if (executor_ && changes[i].second.queue2)
+      executor_->remove(changes[i].second.queue2);
+  }
+  changes.clear();
+
+  // Only what changed, unless the reset cleared it all
+  send_did_requests(requests, before, reset, sent);
+
+  ascii_msgs_t msgs = NMEA_messages(config);
+  ascii_msgs_t old_msgs = NMEA_messages(stream_config_);
+  std::string NMEA_error;
+  if (reset || NMEA_unconfirmed_ || memcmp(&msgs, &old_msgs, sizeof(msgs)) != 0)
+  {
+    CommandChannel::result_t result = commands_->set_data(DID_ASCII_BCAST_PERIOD, 0, sizeof(msgs), &msgs).get();
+    NMEA_unconfirmed_ = !result.success;
+    if (!result.success)
+    {
+      // The streams have changed, the NMEA output is left as it was last confirmed and sent
+      // again on the next request
+      config.NMEA_rate = stream_config_.NMEA_rate;
+      config.NMEA_configuration = stream_config_.NMEA_configuration;
+      config.NMEA_ports = stream_config_.NMEA_ports;
+      NMEA_error = "unable to set the NMEA output: " + result.message;
+    }
+    else
+      sent.push_back("ASCII_BCAST_PERIOD");
+  }
+
+  stream_config_ = config;
+
+  // Keep the parameters in line so a restart comes back the same
+  for (size_t i = 0; i < sizeof(stream_names) / sizeof(stream_names[0]); i++)
+  {
+    nh_private_.setParam(std::string("stream_") + stream_names[i], config.on(stream_names[i]));
+    if (config.period(stream_names[i]) > 0)
+      nh_private_.setParam(period_param(stream_names[i]), config.period(stream_names[i]));
+    else if (nh_private_.hasParam(period_param(stream_names[i])))
+      nh_private_.deleteParam(period_param(stream_names[i]));
+  }
+  nh_private_.setParam("NMEA_rate", config.NMEA_rate);
+  nh_private_.setParam("NMEA_configuration", config.NMEA_configuration);
+  nh_private_.setParam("NMEA_ports", config.NMEA_ports);
+  nh_private_.setParam("navigation_dt_ms", nav_dt_ms_);
+
+  for (std::set<std::string>::iterator s = config.streams.begin(); s != config.streams.end(); ++s)
+    if (stream(*s))
+      res.streams.push_back(*s);
+  res.success = NMEA_error.empty();
+  res.message = "sent:";
+  for (size_t i = 0; i < sent.size(); i++)
+    res.message += " " + sent[i];
+  if (sent.empty())
+    res.message = "nothing to send";
+  if (!res.success)
+    res.message = NMEA_error + " (" + res.message + ")";
+  return true;
 }
 
 void InertialSenseROS::reset_device()
@@ -513,13 +1970,18 @@ void InertialSenseROS::reset_device()
   sleep(3);
 }
 
-void InertialSenseROS::bad_data_callback(const uint8_t *buf)
+void InertialSenseROS::bad_data_callback()
 {
-  std::cout << "\nbad data: " << std::endl;
-  for (int i = 0; i < BUFFER_SIZE; i++)
-  {
-    printf("%x ", buf[i]);
-  }
+  // Keep the frame for the bad_frames service, logging every one would stall the read loop
+  uint8_t error = bad_frames_.bad_frame(comm_.bufferSize);
+  ROS_WARN_THROTTLE(1.0, "inertialsense: bad %s frame, %llu bad frames so far (call the bad_frames service for the raw bytes)",
+                    BadFrameLog::error_name(error), (unsigned long long)bad_frames_.total());
+}
+
+bool InertialSenseROS::get_bad_frames_srv_callback(inertial_sense::GetBadFrames::Request &req, inertial_sense::GetBadFrames::Response &res)
+{
+  bad_frames_.get(req.count, res);
+  return true;
 }
 
 ros::Time InertialSenseROS::ros_time_from_week_and_tow(const uint32_t week, const double timeOfWeek)
@@ -532,6 +1994,11 @@ ros::Time InertialSenseROS::ros_time_from_week_and_tow(const uint32_t week, cons
     uint64_t nsec = (timeOfWeek - floor(timeOfWeek))*1e9;
     rostime = ros::Time(sec, nsec);
   }
+  else if (clock_sync_)
+  {
+    // Align with the other devices in this process
+    rostime = clock_sync_->to_ros(tow_clock_, timeOfWeek, ros::Time::now());
+  }
   else
   {
     // Otherwise, estimate the uINS boot time and offset the messages
@@ -562,6 +2029,10 @@ ros::Time InertialSenseROS::ros_time_from_start_time(const double time)
     uint64_t nsec = (time + GPS_towOffset_ - floor(time + GPS_towOffset_))*1e9;
     rostime = ros::Time(sec, nsec);
   }
+  else if (clock_sync_)
+  {
+    rostime = clock_sync_->to_ros(boot_clock_, time, ros::Time::now());
+  }
   else
   {
     // Otherwise, estimate the uINS boot time and offset the messages
@@ -586,15 +2057,3 @@ ros::Time InertialSenseROS::ros_time_from_tow(const double tow)
   return ros_time_from_week_and_tow(GPS_week_, tow);
 }
 
-
-int main(int argc, char**argv)
- {
-  ros::init(argc, argv, "inertial_sense_node");
-  InertialSenseROS thing;
-  while (ros::ok())
-  {
-    ros::spinOnce();
-    thing.update();
-  }
-  return 0;
-}
@@ -0,0 +1,237 @@
+#include "inertial_sense_multi.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+InertialSenseMulti::InertialSenseMulti(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private) :
+  nh_(nh), nh_private_(nh_private), clock_sync_(nh_private.param<double>("clock_sync_window", 10.0)),
+  running_(false)
+{
+  XmlRpc::XmlRpcValue devices, shared;
+  nh_private_.getParam("devices", devices);
+  nh_private_.getParam(nh_private_.getNamespace(), shared);
+  if (devices.getType() != XmlRpc::XmlRpcValue::TypeArray || devices.size() == 0)
+  {
+    ROS_FATAL("inertialsense: ~devices must be a list of {port, baudrate, namespace, frame_id}");
+    exit(0);
+  }
+
+  for (int i = 0; i < devices.size(); i++)
+    add_device(devices[i], shared);
+}
+
+InertialSenseMulti::~InertialSenseMulti()
+{
+  running_ = false;
+  for (size_t i = 0; i < threads_.size(); i++)
+    threads_[i].join();
+  for (size_t i = 0; i < devices_.size(); i++)
+  {
+    delete devices_[i]->driver;
+    delete devices_[i]->queue;
+    delete devices_[i];
+  }
+}
+
+void InertialSenseMulti::add_device(XmlRpc::XmlRpcValue& config, XmlRpc::XmlRpcValue& shared)
+{
+  if (config.getType() != XmlRpc::XmlRpcValue::TypeStruct || !config.hasMember("port") || !config.hasMember("namespace"))
+  {
+    ROS_FATAL("inertialsense: every entry of ~devices needs at least a port and a namespace");
+    exit(0);
+  }
+
+  device_t* d = new device_t;
+  d->ns = static_cast<std::string>(config["namespace"]);
+  d->nh = ros::NodeHandle(nh_, d->ns);
+  d->nh_private = ros::NodeHandle(nh_private_, d->ns);
+
+  // Settings under ~ apply to every device unless ~<namespace>/ overrides them
+  if (shared.getType() == XmlRpc::XmlRpcValue::TypeStruct)
+  {
+    for (XmlRpc::XmlRpcValue::iterator it = shared.begin(); it != shared.end(); ++it)
+    {
+      if (it->first == "devices" || it->second.getType() == XmlRpc::XmlRpcValue::TypeStruct)
+        continue;
+      if (!d->nh_private.hasParam(it->first))
+        d->nh_private.setParam(it->first, it->second);
+    }
+  }
+  d->nh_private.setParam("port", config["port"]);
+  if (config.hasMember("baudrate"))
+    d->nh_private.setParam("baudrate", config["baudrate"]);
+  if (config.hasMember("frame_id"))
+    d->nh_private.setParam("frame_id", config["frame_id"]);
+
+  // Each device gets its own queue so a pool thread only ever runs its own devices' callbacks
+  d->queue = new EventCallbackQueue();
+  d->nh.setCallbackQueue(d->queue);
+  d->nh_private.setCallbackQueue(d->queue);
+
+  ROS_INFO("inertialsense: starting device \"%s\"", d->ns.c_str());
+  d->driver = new InertialSenseROS(d->nh, d->nh_private);
+  d->driver->set_clock_sync(&clock_sync_, d->ns);
+  devices_.push_back(d);
+}
+
+void InertialSenseMulti::set_affinity(int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rc != 0)
+    ROS_WARN("inertialsense: unable to pin thread to CPU %d: %s", cpu, strerror(rc));
+}
+
+// The ~rt setup of a poll thread, once for all the devices it runs.  A device's rt_cpu has to
+// agree with ~cpu_affinity and with the other devices on the thread, since only one can win
+bool InertialSenseMulti::rt_options(const std::vector<device_t*>& devices, int cpu,
+                                    RealTime::thread_options_t& options, size_t& stack_bytes)
+{
+  bool rt = false;
+  options.cpu = cpu;
+  options.priority = 0;
+  stack_bytes = 0;
+  for (size_t i = 0; i < devices.size(); i++)
+  {
+    RealTime::thread_options_t device;
+    size_t device_stack;
+    if (!devices[i]->driver->take_rt_thread(device, device_stack))
+      continue;
+    if (device.cpu >= 0 && options.cpu >= 0 && device.cpu != options.cpu)
+    {
+      ROS_FATAL("inertialsense: device \"%s\" has rt_cpu %d but its poll thread runs on CPU %d, "
+                "pin poll threads with ~cpu_affinity", devices[i]->ns.c_str(), device.cpu, options.cpu);
+      exit(0);
+    }
+    if (device.cpu >= 0)
+      options.cpu = device.cpu;
+    options.priority = std::max(options.priority, device.priority);
+    stack_bytes = std::max(stack_bytes, device_stack);
+    rt = true;
+  }
+  return rt;
+}
+
+void InertialSenseMulti::setup_thread(bool rt, const RealTime::thread_options_t& options, size_t stack_bytes)
+{
+  if (rt)
+    RealTime::configure_thread("is_poll", options, stack_bytes);
+  else if (options.cpu >= 0)
+    set_affinity(options.cpu);
+}
+
+void InertialSenseMulti::spin()
+{
+  int threads = nh_private_.param<int>("threads", 1);
+  std::vector<int> cpus;
+  nh_private_.getParam("cpu_affinity", cpus);
+  threads = std::max(1, std::min<int>(threads, devices_.size()));
+
+  running_ = true;
+  RealTime::thread_options_t options;
+  size_t stack_bytes;
+  if (threads == 1)
+  {
+    bool rt = rt_options(devices_, cpus.empty() ? -1 : cpus[0], options, stack_bytes);
+    setup_thread(rt, options, stack_bytes);
+    poll_loop(devices_, true);
+    return;
+  }
+
+  // Deal the devices out to the pool, ROS's own queue stays on this thread.  Every thread's
+  // settings are checked before any of them starts
+  std::vector<std::vector<device_t*>> mine(threads);
+  std::vector<RealTime::thread_options_t> thread_options(threads);
+  std::vector<size_t> thread_stack(threads);
+  std::vector<char> thread_rt(threads);
+  for (int t = 0; t < threads; t++)
+  {
+    for (size_t i = t; i < devices_.size(); i += threads)
+      mine[t].push_back(devices_[i]);
+    thread_rt[t] = rt_options(mine[t], t < (int)cpus.size() ? cpus[t] : -1, thread_options[t], thread_stack[t]);
+  }
+  for (int t = 0; t < threads; t++)
+  {
+    std::vector<device_t*> devices = mine[t];
+    bool rt = thread_rt[t];
+    options = thread_options[t];
+    stack_bytes = thread_stack[t];
+    threads_.push_back(std::thread([this, devices, rt, options, stack_bytes]()
+    {
+      setup_thread(rt, options, stack_bytes);
+      poll_loop(devices, false);
+    }));
+  }
+  while (running_ && ros::ok())
+  {
+    ros::spinOnce();
+    ros::WallDuration(0.01).sleep();
+  }
+}
+
+void InertialSenseMulti::poll_loop(std::vector<device_t*> devices, bool spin_global)
+{
+  // Each device's port, then each device's callback queue, then the raw stream server sockets of
+  // every device, with the device each belongs to in raw_owner
+  size_t n = devices.size();
+  std::vector<struct pollfd> fds(2 * n);
+  std::vector<size_t> raw_owner;
+  std::vector<char> raw_ready(n);
+
+  while (running_ && ros::ok())
+  {
+    // Nothing of ours is on the global queue, so it's fine to only get to it between wakeups
+    if (spin_global)
+      ros::spinOnce();
+
+    // Sleep until a port or a queue has something, across every device at once
+    int timeout_ms = 100;
+    fds.resize(2 * n);
+    raw_owner.clear();
+    for (size_t i = 0; i < n; i++)
+    {
+      // -1 (left out of the poll) while a port that failed is closed
+      fds[i].fd = devices[i]->driver->fd();
+      fds[i].events = POLLIN | POLLRDHUP | (devices[i]->driver->write_pending() ? POLLOUT : 0);
+      fds[n + i].fd = devices[i]->queue->fd();
+      fds[n + i].events = POLLIN;
+      devices[i]->driver->raw_stream_fds(fds);
+      raw_owner.resize(fds.size() - 2 * n, i);
+      timeout_ms = std::min(timeout_ms, devices[i]->driver->poll_timeout_ms());
+    }
+    double start = WakeupStats::now();
+    int rc = poll(fds.data(), fds.size(), timeout_ms);
+    if (rc == 0)
+    {
+      double elapsed = WakeupStats::now() - start;
+      for (size_t i = 0; i < n; i++)
+        devices[i]->driver->record_wakeup(timeout_ms * 1e-3, elapsed);
+    }
+    if (rc < 0 && errno != EINTR)
+    {
+      ROS_ERROR("inertialsense: poll failed: %s", strerror(errno));
+      break;
+    }
+    std::fill(raw_ready.begin(), raw_ready.end(), 0);
+    for (size_t k = 0; k < raw_owner.size(); k++)
+    {
+      if (fds[2 * n + k].revents)
+        raw_ready[raw_owner[k]] = 1;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+      bool callbacks = fds[n + i].revents & POLLIN;
+      if (callbacks)
+        devices[i]->queue->call_signalled();
+      if (rc == 0 || callbacks || fds[i].fd < 0 || fds[i].revents || raw_ready[i])
+        devices[i]->driver->update(0);
+      if (fds[i].fd >= 0)
+        devices[i]->driver->check_port(fds[i].revents);
+    }
+  }
+}
@@ -0,0 +1,25 @@
+#include "inertial_sense.h"
+#include "inertial_sense_multi.h"
+
+int main(int argc, char**argv)
+ {
+  ros::init(argc, argv, "inertial_sense_node");
+
+  // Several units from one process
+  ros::NodeHandle nh_private("~");
+  if (nh_private.hasParam("devices"))
+  {
+    InertialSenseMulti multi(ros::NodeHandle(), nh_private);
+    multi.spin();
+    return 0;
+  }
+
+  // Everything the driver subscribes to or serves goes through a queue it can sleep on
+  EventCallbackQueue queue;
+  ros::NodeHandle nh;
+  nh.setCallbackQueue(&queue);
+  nh_private.setCallbackQueue(&queue);
+  InertialSenseROS thing(nh, nh_private);
+  thing.spin(queue, []() { return ros::ok(); });
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "inertial_sense.h"
+
+#include <sys/stat.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "event_callback_queue.h"
+
+namespace inertial_sense
+{
+
+/**
+ * @brief Runs InertialSenseROS inside a nodelet manager
+ *
+ * The driver gets its own thread and callback queue, so service and timer
+ * callbacks are serviced between reads exactly like in the standalone node,
+ * with the thread asleep until there is data or a callback.
+ */
+class InertialSenseNodelet : public nodelet::Nodelet
+{
+public:
+  InertialSenseNodelet() : running_(false) {}
+
+  ~InertialSenseNodelet()
+  {
+    running_ = false;
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+private:
+  virtual void onInit()
+  {
+    nh_ = getNodeHandle();
+    nh_private_ = getPrivateNodeHandle();
+    nh_.setCallbackQueue(&queue_);
+    nh_private_.setCallbackQueue(&queue_);
+
+    // Connecting blocks on the device, so don't hold up the manager
+    running_ = true;
+    thread_ = boost::thread(&InertialSenseNodelet::spin, this);
+  }
+
+  void spin()
+  {
+    // Give devices that enumerate late (or a simulator started alongside) a chance to show up
+    std::string port;
+    double port_timeout;
+    nh_private_.param<std::string>("port", port, "/dev/ttyUSB0");
+    nh_private_.param<double>("port_timeout", port_timeout, 5.0);
+    struct stat sb;
+    ros::WallTime start = ros::WallTime::now();
+    while (running_ && stat(port.c_str(), &sb) != 0 && (ros::WallTime::now() - start).toSec() < port_timeout)
+      ros::WallDuration(0.1).sleep();
+
+    driver_.reset(new InertialSenseROS(nh_, nh_private_));
+    driver_->spin(queue_, [this]() { return running_ && ros::ok(); });
+  }
+
+  ros::NodeHandle nh_;
+  ros::NodeHandle nh_private_;
+  EventCallbackQueue queue_;
+  boost::scoped_ptr<InertialSenseROS> driver_;
+  boost::thread thread_;
+  volatile bool running_;
+};
+
+} // namespace inertial_sense
+
+PLUGINLIB_EXPORT_CLASS(inertial_sense::InertialSenseNodelet, nodelet::Nodelet)
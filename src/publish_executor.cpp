@@ -0,0 +1,141 @@
+#include "publish_executor.h"
+#include "diagnostics_util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+bool PublishExecutor::parse_policy(const std::string& name, policy_t& policy)
+{
+  if (name == "latest")
+    policy = POLICY_LATEST;
+  else if (name == "fifo")
+    policy = POLICY_FIFO;
+  else if (name == "lossless")
+    policy = POLICY_LOSSLESS;
+  else
+    return false;
+  return true;
+}
+
+const char* PublishExecutor::policy_name(policy_t policy)
+{
+  switch (policy)
+  {
+  case POLICY_LATEST: return "latest";
+  case POLICY_FIFO: return "fifo";
+  case POLICY_LOSSLESS: return "lossless";
+  }
+  return "";
+}
+
+PublishExecutor::Topic::Topic(const std::string& name, const ros::Publisher& pub, policy_t policy, size_t depth) :
+  name_(name), pub_(pub), policy_(policy), depth_(depth), dropped_(0), max_depth_(0), reported_drops_(0)
+{}
+
+PublishExecutor::PublishExecutor() :
+  busy_(NULL), next_(0), running_(false)
+{}
+
+PublishExecutor::~PublishExecutor()
+{
+  stop();
+}
+
+void PublishExecutor::start()
+{
+  running_ = true;
+  thread_ = std::thread(&PublishExecutor::run, this);
+}
+
+void PublishExecutor::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  ready_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void PublishExecutor::run()
+{
+  pthread_setname_np(pthread_self(), "is_publish");
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true)
+  {
+    // Next topic, after the one served last, with something queued
+    Topic* topic = NULL;
+    for (size_t i = 0; i < topics_.size() && !topic; i++)
+    {
+      size_t t = (next_ + i) % topics_.size();
+      if (!topics_[t]->empty())
+      {
+        topic = topics_[t].get();
+        next_ = t + 1;
+      }
+    }
+
+    if (!topic)
+    {
+      if (!running_)
+        break;
+      ready_.wait(lock);
+      continue;
+    }
+
+    topic->take();
+    busy_ = topic;
+    lock.unlock();
+    topic->publish_taken();
+    lock.lock();
+    busy_ = NULL;
+    published_.notify_all();
+  }
+}
+
+void PublishExecutor::remove(Topic* topic)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  published_.wait(lock, [&]() { return busy_ != topic; });
+  for (size_t i = 0; i < topics_.size(); i++)
+  {
+    if (topics_[i].get() == topic)
+    {
+      topics_.erase(topics_.begin() + i);
+      break;
+    }
+  }
+}
+
+void PublishExecutor::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id)
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: publish";
+  status.hardware_id = hardware_id;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = "OK";
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < topics_.size(); i++)
+  {
+    Topic& t = *topics_[i];
+
+    // Replacing an unsent message is what latest is for, anything else means the topic is behind
+    bool behind = t.policy_ == POLICY_LOSSLESS ? t.max_depth_ > t.depth_
+                                               : t.policy_ == POLICY_FIFO && t.dropped_ != t.reported_drops_;
+    if (behind)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "subscribers falling behind";
+    }
+
+    status.values.push_back(key_value(t.name_ + " depth", t.depth()));
+    status.values.push_back(key_value(t.name_ + " max depth", t.max_depth_));
+    status.values.push_back(key_value(t.name_ + " dropped", t.dropped_));
+    t.max_depth_ = t.depth();
+    t.reported_drops_ = t.dropped_;
+  }
+  msg.status.push_back(status);
+}
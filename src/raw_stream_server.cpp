@@ -0,0 +1,464 @@
+#include "raw_stream_server.h"
+#include "diagnostics_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "ISComm.h"
+#include "ros/ros.h"
+
+#define MAX_COMMAND_BYTES 4096
+
+// Room for a few of the largest (escaped) frames, which are never split
+RawStreamServer::RawStreamServer(size_t buffer_size) :
+  buffer_size_(std::max<size_t>(buffer_size, 4 * PKT_BUF_SIZE)), in_packet_(false), client_count_(0), sent_(0),
+  dropped_(0), commands_(0), disconnects_(0)
+{}
+
+RawStreamServer::~RawStreamServer()
+{
+  while (!clients_.empty())
+    close_client(clients_.size() - 1, "shutting down");
+  for (size_t i = 0; i < listeners_.size(); i++)
+  {
+    close(listeners_[i].fd);
+    if (listeners_[i].url.compare(0, 7, "unix://") == 0)
+      unlink(listeners_[i].url.substr(7).c_str());
+  }
+}
+
+bool RawStreamServer::listen(const std::string& url_with_options)
+{
+  listener_t l;
+  l.policy = DROP_OLDEST;
+  l.url = url_with_options;
+  size_t q = url_with_options.find('?');
+  if (q != std::string::npos)
+  {
+    l.url = url_with_options.substr(0, q);
+    std::string options = url_with_options.substr(q + 1);
+    if (options == "policy=drop_oldest")
+      l.policy = DROP_OLDEST;
+    else if (options == "policy=drop_newest")
+      l.policy = DROP_NEWEST;
+    else if (options == "policy=disconnect")
+      l.policy = DISCONNECT;
+    else
+    {
+      ROS_ERROR("inertialsense: unknown options \"%s\" for raw stream server \"%s\"", options.c_str(), l.url.c_str());
+      return false;
+    }
+  }
+
+  if (l.url.compare(0, 7, "unix://") == 0)
+  {
+    std::string path = l.url.substr(7);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+      ROS_ERROR("inertialsense: bad socket path in \"%s\"", l.url.c_str());
+      return false;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // A socket left behind by a previous run would make bind fail
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(path.c_str());
+
+    l.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (l.fd < 0 || bind(l.fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(l.fd, 8) != 0)
+    {
+      ROS_ERROR("inertialsense: unable to listen on \"%s\": %s", l.url.c_str(), strerror(errno));
+      if (l.fd >= 0)
+        close(l.fd);
+      return false;
+    }
+  }
+  else if (l.url.compare(0, 6, "tcp://") == 0)
+  {
+    std::string address = l.url.substr(6);
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+    {
+      ROS_ERROR("inertialsense: no port in \"%s\"", l.url.c_str());
+      return false;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int rc = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res);
+    if (rc != 0)
+    {
+      ROS_ERROR("inertialsense: unable to resolve \"%s\": %s", l.url.c_str(), gai_strerror(rc));
+      return false;
+    }
+    l.fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
+    int one = 1;
+    if (l.fd >= 0)
+      setsockopt(l.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (l.fd < 0 || bind(l.fd, res->ai_addr, res->ai_addrlen) != 0 || ::listen(l.fd, 8) != 0)
+    {
+      ROS_ERROR("inertialsense: unable to listen on \"%s\": %s", l.url.c_str(), strerror(errno));
+      if (l.fd >= 0)
+        close(l.fd);
+      freeaddrinfo(res);
+      return false;
+    }
+    freeaddrinfo(res);
+  }
+  else
+  {
+    ROS_ERROR("inertialsense: raw stream server \"%s\" must start with tcp:// or unix://", l.url.c_str());
+    return false;
+  }
+
+  ROS_INFO("inertialsense: serving the raw stream on \"%s\"", l.url.c_str());
+  listeners_.push_back(l);
+  return true;
+}
+
+void RawStreamServer::find_frames(const uint8_t* data, size_t len)
+{
+  // Start bytes are escaped inside ISB packets, so between packets a start byte or '$' is a new frame
+  frame_starts_.clear();
+  for (size_t i = 0; i < len; i++)
+  {
+    uint8_t b = data[i];
+    if (b == PSC_START_BYTE)
+    {
+      frame_starts_.push_back(i);
+      in_packet_ = true;
+    }
+    else if (in_packet_)
+      in_packet_ = b != PSC_END_BYTE;
+    else if (b == '$')
+      frame_starts_.push_back(i);
+  }
+}
+
+void RawStreamServer::broadcast(const uint8_t* data, int len)
+{
+  if (len <= 0)
+    return;
+  find_frames(data, len);
+  for (size_t i = clients_.size(); i-- > 0;)
+  {
+    client_t& c = clients_[i];
+    size_t offset = 0;
+
+    // New clients start, and clients that lost the end of a frame pick up again, at the next frame
+    if (!c.joined || c.skipping)
+    {
+      offset = frame_starts_.empty() ? len : frame_starts_[0];
+      if (c.joined)
+        add_dropped(c, offset);
+      if (frame_starts_.empty())
+        continue;
+      c.joined = true;
+      c.skipping = false;
+    }
+
+    // Fast path: nothing queued, hand it straight to the kernel
+    if (c.out_len == 0)
+    {
+      ssize_t n = send(c.fd, data + offset, len - offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        close_client(i, strerror(errno));
+        continue;
+      }
+      n = std::max<ssize_t>(n, 0);
+      offset += n;
+      c.out_pos += n;
+      c.sent += n;
+      sent_.store(sent_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    if (offset < (size_t)len)
+    {
+      size_t space = buffer_size_ - c.out_len;
+      if (len - offset > space && c.policy == DISCONNECT)
+      {
+        close_client(i, "too slow");
+        continue;
+      }
+      queue(c, data + offset, len - offset, offset);
+    }
+  }
+}
+
+void RawStreamServer::append(client_t& c, const uint8_t* data, size_t len)
+{
+  size_t tail = (c.out_head + c.out_len) % buffer_size_;
+  size_t first = std::min(len, buffer_size_ - tail);
+  memcpy(&c.out[tail], data, first);
+  memcpy(&c.out[0], data + first, len - first);
+  c.out_len += len;
+}
+
+void RawStreamServer::add_dropped(client_t& c, size_t bytes)
+{
+  c.dropped += bytes;
+  dropped_.store(dropped_.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+}
+
+void RawStreamServer::queue(client_t& c, const uint8_t* data, size_t len, size_t base)
+{
+  // Everything below is in out_pos counts: the ring holds [head, tail), data would go at [tail, end)
+  uint64_t head = c.out_pos;
+  uint64_t tail = head + c.out_len;
+  uint64_t end = tail + len;
+  new_starts_.clear();
+  for (std::vector<size_t>::const_iterator f = std::lower_bound(frame_starts_.begin(), frame_starts_.end(), base);
+       f != frame_starts_.end(); ++f)
+    new_starts_.push_back(tail + (*f - base));
+
+  if (end - head <= buffer_size_)
+  {
+    append(c, data, len);
+    c.starts.insert(c.starts.end(), new_starts_.begin(), new_starts_.end());
+    return;
+  }
+
+  if (c.policy == DROP_NEWEST)
+  {
+    // The frames that fit, the rest is skipped up to the next one
+    uint64_t keep_end = tail;
+    for (size_t k = 0; k < new_starts_.size() && new_starts_[k] - head <= buffer_size_; k++)
+      keep_end = new_starts_[k];
+    if (keep_end == tail && !c.starts.empty() && (new_starts_.empty() || new_starts_[0] != tail))
+    {
+      // Not even the rest of the last frame fits, so that one goes too (nothing of it is sent yet)
+      add_dropped(c, tail - c.starts.back());
+      c.out_len -= tail - c.starts.back();
+      c.starts.pop_back();
+    }
+    append(c, data, keep_end - tail);
+    for (size_t k = 0; k < new_starts_.size() && new_starts_[k] < keep_end; k++)
+      c.starts.push_back(new_starts_[k]);
+    add_dropped(c, end - keep_end);
+    c.skipping = true;
+    return;
+  }
+
+  // DROP_OLDEST: keep what is left of a frame already partly sent, [head, first), then drop whole
+  // frames [first, cut) until the rest fits
+  bool has_first = !c.starts.empty() || !new_starts_.empty();
+  uint64_t first = !c.starts.empty() ? c.starts.front() : has_first ? new_starts_[0] : end;
+  uint64_t prefix = first - head;
+  uint64_t cut = end;
+  for (size_t k = 0; k < c.starts.size() + new_starts_.size(); k++)
+  {
+    uint64_t start = k < c.starts.size() ? c.starts[k] : new_starts_[k - c.starts.size()];
+    if (prefix + (end - start) <= buffer_size_)
+    {
+      cut = start;
+      break;
+    }
+  }
+  if (!has_first || prefix > buffer_size_)
+  {
+    // A frame bigger than the buffer, it gets cut whatever we do
+    append(c, data, buffer_size_ - c.out_len);
+    add_dropped(c, end - head - buffer_size_);
+    c.starts.clear();
+    c.skipping = true;
+    return;
+  }
+
+  if (first <= tail)
+  {
+    // Move the partial frame up to just before cut, over the frames dropped from the ring
+    uint64_t ring_cut = std::min(cut, tail) - first;
+    for (uint64_t k = prefix; k-- > 0;)
+      c.out[(c.out_head + ring_cut + k) % buffer_size_] = c.out[(c.out_head + k) % buffer_size_];
+    c.out_head = (c.out_head + ring_cut) % buffer_size_;
+    c.out_len -= ring_cut;
+    if (cut < end)
+      append(c, data + (std::max(cut, tail) - tail), end - std::max(cut, tail));
+  }
+  else
+  {
+    append(c, data, first - tail);
+    if (cut < end)
+      append(c, data + (cut - tail), end - cut);
+  }
+  c.out_pos = cut - prefix;
+  while (!c.starts.empty() && c.starts.front() < cut)
+    c.starts.pop_front();
+  for (size_t k = 0; k < new_starts_.size(); k++)
+  {
+    if (new_starts_[k] >= cut)
+      c.starts.push_back(new_starts_[k]);
+  }
+  add_dropped(c, cut - first);
+  // Dropped up to the end, the rest of the last frame is still to come
+  if (cut == end)
+    c.skipping = true;
+}
+
+bool RawStreamServer::send_pending(client_t& c)
+{
+  while (c.out_len > 0)
+  {
+    size_t chunk = std::min(c.out_len, buffer_size_ - c.out_head);
+    ssize_t n = send(c.fd, &c.out[c.out_head], chunk, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    c.out_head = (c.out_head + n) % buffer_size_;
+    c.out_len -= n;
+    c.out_pos += n;
+    c.sent += n;
+    sent_.store(sent_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    if ((size_t)n < chunk)
+      break;
+  }
+  // Frames started before the head are at least partly sent, and can't be dropped any more
+  while (!c.starts.empty() && c.starts.front() < c.out_pos)
+    c.starts.pop_front();
+  return true;
+}
+
+void RawStreamServer::poll_fds(std::vector<struct pollfd>& fds) const
+{
+  struct pollfd pfd;
+  pfd.revents = 0;
+  for (size_t l = 0; l < listeners_.size(); l++)
+  {
+    pfd.fd = listeners_[l].fd;
+    pfd.events = POLLIN;
+    fds.push_back(pfd);
+  }
+  for (size_t i = 0; i < clients_.size(); i++)
+  {
+    pfd.fd = clients_[i].fd;
+    pfd.events = POLLIN | (clients_[i].out_len ? POLLOUT : 0);
+    fds.push_back(pfd);
+  }
+}
+
+void RawStreamServer::service(const std::function<void(const uint8_t*, int)>& forward)
+{
+  for (size_t l = 0; l < listeners_.size(); l++)
+  {
+    int fd;
+    while ((fd = accept4(listeners_[l].fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+      if (listeners_[l].url.compare(0, 6, "tcp://") == 0)
+      {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      }
+      client_t c;
+      c.fd = fd;
+      c.name = listeners_[l].url + " #" + std::to_string(fd);
+      c.policy = listeners_[l].policy;
+      c.out.resize(buffer_size_);
+      c.out_head = c.out_len = 0;
+      c.out_pos = 0;
+      c.joined = c.skipping = false;
+      c.sent = c.dropped = c.commands = 0;
+      clients_.push_back(c);
+      client_count_.store(clients_.size(), std::memory_order_relaxed);
+      ROS_INFO("inertialsense: raw stream client %s connected", c.name.c_str());
+    }
+  }
+
+  for (size_t i = clients_.size(); i-- > 0;)
+  {
+    if (!send_pending(clients_[i]))
+    {
+      close_client(i, strerror(errno));
+      continue;
+    }
+    read_commands(clients_[i], forward);
+    if (clients_[i].fd < 0)
+      close_client(i, "disconnected");
+  }
+}
+
+void RawStreamServer::read_commands(client_t& c, const std::function<void(const uint8_t*, int)>& forward)
+{
+  uint8_t buf[1024];
+  for (;;)
+  {
+    ssize_t n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+      close(c.fd);
+      c.fd = -1;
+      return;
+    }
+    if (n < 0)
+      break;
+    c.in.insert(c.in.end(), buf, buf + n);
+  }
+
+  // Forward whole ISB frames and ASCII sentences, skip anything between them
+  size_t start = 0;
+  while (start < c.in.size())
+  {
+    uint8_t first = c.in[start];
+    uint8_t end_byte = first == PSC_START_BYTE ? PSC_END_BYTE : '\n';
+    if (first != PSC_START_BYTE && first != '$')
+    {
+      start++;
+      continue;
+    }
+    std::vector<uint8_t>::iterator end = std::find(c.in.begin() + start + 1, c.in.end(), end_byte);
+    if (end == c.in.end())
+      break;
+    size_t len = end - c.in.begin() - start + 1;
+    forward(&c.in[start], len);
+    c.commands++;
+    commands_.store(commands_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    start += len;
+  }
+  c.in.erase(c.in.begin(), c.in.begin() + start);
+  if (c.in.size() > MAX_COMMAND_BYTES)
+    c.in.clear();
+}
+
+void RawStreamServer::close_client(size_t i, const char* reason)
+{
+  client_t& c = clients_[i];
+  ROS_INFO("inertialsense: raw stream client %s closed (%s), sent %llu bytes, dropped %llu, forwarded %llu commands",
+           c.name.c_str(), reason, (unsigned long long)c.sent, (unsigned long long)c.dropped,
+           (unsigned long long)c.commands);
+  if (c.fd >= 0)
+    close(c.fd);
+  clients_.erase(clients_.begin() + i);
+  client_count_.store(clients_.size(), std::memory_order_relaxed);
+  disconnects_.store(disconnects_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void RawStreamServer::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id) const
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: raw stream server";
+  status.hardware_id = hardware_id;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = "OK";
+  status.values.push_back(key_value("clients", client_count_.load(std::memory_order_relaxed)));
+  status.values.push_back(key_value("bytes sent", sent_.load(std::memory_order_relaxed)));
+  status.values.push_back(key_value("bytes dropped", dropped_.load(std::memory_order_relaxed)));
+  status.values.push_back(key_value("commands forwarded", commands_.load(std::memory_order_relaxed)));
+  status.values.push_back(key_value("disconnects", disconnects_.load(std::memory_order_relaxed)));
+  msg.status.push_back(status);
+}
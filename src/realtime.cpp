@@ -0,0 +1,140 @@
+#include "realtime.h"
+#include "diagnostics_util.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ros/ros.h"
+
+bool RealTime::lock_memory(size_t heap_bytes)
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+  {
+    ROS_WARN("inertialsense: mlockall failed: %s (needs CAP_IPC_LOCK or a larger memlock limit)", strerror(errno));
+    return false;
+  }
+
+  // Keep freed memory in the heap instead of giving it back, and serve large blocks from it
+  // too, so the pages touched here are the ones later allocations get
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+  if (heap_bytes)
+  {
+    char* heap = (char*)malloc(heap_bytes);
+    if (heap)
+    {
+      memset(heap, 0, heap_bytes);
+      free(heap);
+    }
+  }
+  return true;
+}
+
+void RealTime::configure_thread(const char* name, const thread_options_t& options, size_t stack_bytes)
+{
+  pthread_setname_np(pthread_self(), name);
+
+  if (options.cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(options.cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+      ROS_WARN("inertialsense: unable to pin %s to CPU %d: %s", name, options.cpu, strerror(rc));
+  }
+
+  if (options.priority > 0)
+  {
+    struct sched_param param = {};
+    param.sched_priority = options.priority;
+    int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rc != 0)
+      ROS_WARN("inertialsense: unable to run %s SCHED_FIFO at priority %d: %s (needs CAP_SYS_NICE or an rtprio limit)",
+               name, options.priority, strerror(rc));
+  }
+
+  // Grow the stack now rather than fault on the first deep call
+  if (stack_bytes)
+  {
+    volatile char* stack = (volatile char*)alloca(stack_bytes);
+    for (size_t i = 0; i < stack_bytes; i += 4096)
+      stack[i] = 0;
+  }
+
+  ROS_INFO("inertialsense: %s on CPU %d, %s priority %d", name, options.cpu,
+           options.priority > 0 ? "SCHED_FIFO" : "SCHED_OTHER", options.priority);
+}
+
+WakeupStats::WakeupStats() :
+  count_(0), sum_us_(0), max_us_(0), last_count_(0), last_sum_us_(0)
+{
+  for (int i = 0; i < WAKEUP_BUCKETS; i++)
+  {
+    buckets_[i] = 0;
+    last_buckets_[i] = 0;
+  }
+}
+
+void WakeupStats::add(double timeout_s, double elapsed_s)
+{
+  double late = elapsed_s - timeout_s;
+  uint64_t us = late > 0 ? (uint64_t)(late * 1e6) : 0;
+  int b = 0;
+  while (b < WAKEUP_BUCKETS - 1 && (1ull << b) <= us)
+    b++;
+  inc(buckets_[b], 1);
+  inc(count_, 1);
+  inc(sum_us_, us);
+  if (us > max_us_.load(std::memory_order_relaxed))
+    max_us_.store(us, std::memory_order_relaxed);
+}
+
+void WakeupStats::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id,
+                                   const std::string& name, double warn_us)
+{
+  uint64_t count = count_.load(std::memory_order_relaxed);
+  uint64_t sum = sum_us_.load(std::memory_order_relaxed);
+  uint64_t n = count - last_count_;
+  uint64_t max_us = max_us_.exchange(0, std::memory_order_relaxed);
+
+  // 99th percentile, as the upper edge of its bucket
+  uint64_t delta[WAKEUP_BUCKETS];
+  for (int i = 0; i < WAKEUP_BUCKETS; i++)
+  {
+    uint64_t b = buckets_[i].load(std::memory_order_relaxed);
+    delta[i] = b - last_buckets_[i];
+    last_buckets_[i] = b;
+  }
+  uint64_t p99 = 0, seen = 0;
+  for (int i = 0; i < WAKEUP_BUCKETS && n; i++)
+  {
+    seen += delta[i];
+    if (seen >= 0.99 * n)
+    {
+      p99 = i ? (1ull << i) : 0;
+      break;
+    }
+  }
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: " + name + " wakeup";
+  status.hardware_id = hardware_id;
+  status.level = max_us > warn_us ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = max_us > warn_us ? "late wakeups" : "OK";
+  status.values.push_back(key_value("timed out waits", n));
+  status.values.push_back(key_value("mean delay (us)", n ? (double)(sum - last_sum_us_) / n : 0.0, "%.1f"));
+  status.values.push_back(key_value("p99 delay (us)", p99));
+  status.values.push_back(key_value("max delay (us)", max_us));
+  msg.status.push_back(status);
+
+  last_count_ = count;
+  last_sum_us_ = sum;
+}
@@ -0,0 +1,147 @@
+#include "satellite_store.h"
+#include "diagnostics_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+SatelliteStore::SatelliteStore(int cno_step, int hold) :
+  cno_step_(std::max(cno_step, 1)), hold_(std::max(hold, 1)), head_(0), tracked_count_(0), epochs_total_(0),
+  overflows_(0)
+{
+  memset(slot_of_, NO_SLOT, sizeof(slot_of_));
+  memset(used_, 0, sizeof(used_));
+  memset(tracked_, 0, sizeof(tracked_));
+  memset(gnss_id_, 0, sizeof(gnss_id_));
+  memset(sv_id_, 0, sizeof(sv_id_));
+  memset(reported_cno_, 0, sizeof(reported_cno_));
+  memset(missed_, 0, sizeof(missed_));
+  memset(history_, 0, sizeof(history_));
+}
+
+void SatelliteStore::set_thresholds(int cno_step, int hold)
+{
+  cno_step_ = std::max(cno_step, 1);
+  hold_ = std::max(hold, 1);
+}
+
+int SatelliteStore::slot_for(uint8_t gnss_id, uint8_t sv_id, bool& fresh)
+{
+  uint8_t& slot = slot_of_[gnss_id * 256 + sv_id];
+  fresh = slot == NO_SLOT;
+  if (!fresh)
+    return slot;
+
+  bool* free = std::find(used_, used_ + SLOTS, false);
+  if (free == used_ + SLOTS)
+    return -1;
+  slot = free - used_;
+  used_[slot] = true;
+  gnss_id_[slot] = gnss_id;
+  sv_id_[slot] = sv_id;
+  missed_[slot] = 0;
+  return slot;
+}
+
+void SatelliteStore::release(int slot)
+{
+  slot_of_[gnss_id_[slot] * 256 + sv_id_[slot]] = NO_SLOT;
+  used_[slot] = false;
+  for (int e = 0; e < HISTORY; e++)
+    history_[e][slot] = 0;
+}
+
+void SatelliteStore::update(const gps_sat_t& sats, std::vector<event_t>& events)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  events.clear();
+  head_ = head_ + 1 < HISTORY ? head_ + 1 : 0;
+  uint8_t* row = history_[head_];
+  memset(row, 0, SLOTS);
+  memset(tracked_, 0, sizeof(tracked_));
+  tracked_count_ = 0;
+  epochs_total_++;
+
+  uint32_t n = std::min<uint32_t>(sats.numSats, MAX_NUM_SAT_CHANNELS);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    const gps_sat_sv_t& sv = sats.sat[i];
+    if (sv.cno == 0 || sv.gnssId >= CONSTELLATIONS)
+      continue;
+    bool fresh;
+    int slot = slot_for(sv.gnssId, sv.svId, fresh);
+    if (slot < 0)
+    {
+      overflows_++;
+      continue;
+    }
+    if (tracked_[slot])
+      continue;
+    tracked_[slot] = true;
+    tracked_count_++;
+    row[slot] = sv.cno;
+    missed_[slot] = 0;
+
+    if (fresh || abs((int)sv.cno - (int)reported_cno_[slot]) >= cno_step_)
+    {
+      event_t event = { (uint8_t)(fresh ? APPEARED : CNO_CHANGED), sv.gnssId, sv.svId, sv.cno };
+      events.push_back(event);
+      reported_cno_[slot] = sv.cno;
+    }
+  }
+
+  // Held for a few epochs first, so a satellite fading in and out doesn't flood the events
+  for (int slot = 0; slot < SLOTS; slot++)
+  {
+    if (!used_[slot] || tracked_[slot] || ++missed_[slot] < hold_)
+      continue;
+    event_t event = { DISAPPEARED, gnss_id_[slot], sv_id_[slot], 0 };
+    events.push_back(event);
+    release(slot);
+  }
+}
+
+void SatelliteStore::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (epochs_total_ == 0)
+    return;
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: satellites";
+  status.hardware_id = hardware_id;
+  status.level = overflows_ ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%d tracked", tracked_count_);
+  status.message = buf;
+  if (overflows_)
+    status.message += ", satellites dropped with every slot taken";
+  status.values.push_back(key_value("tracked", tracked_count_, "%.0f"));
+  status.values.push_back(key_value("epochs", epochs_total_, "%.0f"));
+  status.values.push_back(key_value("dropped", overflows_, "%.0f"));
+
+  // u-blox constellation ids: GPS, SBAS, Galileo, BeiDou, IMES, QZSS, GLONASS
+  static const char letters[CONSTELLATIONS + 1] = "GSECIJR?";
+  for (int slot = 0; slot < SLOTS; slot++)
+  {
+    if (!used_[slot])
+      continue;
+    int sum = 0;
+    int count = 0;
+    int min = 255;
+    for (int e = 0; e < HISTORY; e++)
+    {
+      int cno = history_[e][slot];
+      if (cno == 0)
+        continue;
+      sum += cno;
+      count++;
+      min = std::min(min, cno);
+    }
+    snprintf(buf, sizeof(buf), "%c%u", letters[gnss_id_[slot]], sv_id_[slot]);
+    std::string name = buf;
+    status.values.push_back(key_value(name + " cno", history_[head_][slot], "%.0f"));
+    status.values.push_back(key_value(name + " cno mean", count ? (double)sum / count : 0.0, "%.1f"));
+    status.values.push_back(key_value(name + " cno min", count ? min : 0, "%.0f"));
+  }
+  msg.status.push_back(status);
+}
@@ -0,0 +1,170 @@
+#include "serial_writer.h"
+#include "diagnostics_util.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "ros/ros.h"
+
+static const char* priority_name(int priority)
+{
+  switch (priority)
+  {
+  case SerialWriter::PRIORITY_CORRECTION: return "corrections";
+  case SerialWriter::PRIORITY_COMMAND:    return "commands";
+  default:                                return "config";
+  }
+}
+
+SerialWriter::SerialWriter(size_t max_queue_bytes) :
+  max_queue_bytes_(max_queue_bytes), last_correction_stamp_(0), got_correction_(false), reported_drops_(0),
+  has_inflight_(false)
+{
+  for (int i = 0; i < PRIORITY_COUNT; i++)
+  {
+    queued_bytes_[i] = 0;
+    counters_[i] = counters_t();
+  }
+}
+
+bool SerialWriter::push(priority_t priority, const uint8_t* data, int len, double stamp)
+{
+  if (len <= 0)
+    return true;
+
+  packet_t p;
+  p.data.assign(data, data + len);
+  p.offset = 0;
+  p.received = steady_clock_t::now();
+  p.stamp = stamp;
+  p.priority = priority;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::deque<packet_t>& q = queues_[priority];
+  if (priority != PRIORITY_CONFIG && queued_bytes_[priority] + len > max_queue_bytes_)
+  {
+    if (priority == PRIORITY_COMMAND || (size_t)len > max_queue_bytes_)
+    {
+      counters_[priority].dropped++;
+      return false;
+    }
+    // Stale corrections are worse than none, make room by dropping the oldest
+    while (!q.empty() && queued_bytes_[priority] + len > max_queue_bytes_)
+    {
+      queued_bytes_[priority] -= q.front().data.size();
+      q.pop_front();
+      counters_[priority].dropped++;
+    }
+  }
+  queued_bytes_[priority] += len;
+  q.push_back(std::move(p));
+  return true;
+}
+
+void SerialWriter::service(serial_port_t* port)
+{
+  for (;;)
+  {
+    if (!has_inflight_)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (int i = 0; i < PRIORITY_COUNT && !has_inflight_; i++)
+      {
+        if (queues_[i].empty())
+          continue;
+        inflight_ = std::move(queues_[i].front());
+        queues_[i].pop_front();
+        queued_bytes_[i] -= inflight_.data.size();
+        has_inflight_ = true;
+      }
+      if (!has_inflight_)
+        return;
+    }
+
+    int remaining = inflight_.data.size() - inflight_.offset;
+    int n = serialPortWrite(port, &inflight_.data[inflight_.offset], remaining);
+    if (n <= 0)
+      return; // port buffer full, try again after the next read
+    inflight_.offset += n;
+    if (n < remaining)
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished(inflight_);
+    has_inflight_ = false;
+  }
+}
+
+bool SerialWriter::pending()
+{
+  if (has_inflight_)
+    return true;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int i = 0; i < PRIORITY_COUNT; i++)
+  {
+    if (!queues_[i].empty())
+      return true;
+  }
+  return false;
+}
+
+void SerialWriter::finished(const packet_t& p)
+{
+  counters_t& c = counters_[p.priority];
+  double latency = std::chrono::duration<double>(steady_clock_t::now() - p.received).count();
+  c.packets++;
+  c.bytes += p.data.size();
+  c.latency_sum += latency;
+  c.latency_max = std::max(c.latency_max, latency);
+  c.latency_count++;
+  if (p.priority == PRIORITY_CORRECTION)
+  {
+    got_correction_ = true;
+    last_correction_stamp_ = p.stamp > 0 ? p.stamp : ros::Time::now().toSec() - latency;
+  }
+}
+
+void SerialWriter::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id, double max_age)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "inertial_sense: writes";
+  status.hardware_id = hardware_id;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = "OK";
+
+  if (got_correction_)
+  {
+    double age = ros::Time::now().toSec() - last_correction_stamp_;
+    status.values.push_back(key_value("correction age s", age, "%.2f"));
+    if (max_age > 0 && age > max_age)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Corrections are stale";
+    }
+  }
+
+  for (int i = 0; i < PRIORITY_COUNT; i++)
+  {
+    counters_t& c = counters_[i];
+    std::string name = priority_name(i);
+    status.values.push_back(key_value(name + " packets", c.packets));
+    status.values.push_back(key_value(name + " bytes", c.bytes));
+    status.values.push_back(key_value(name + " dropped", c.dropped));
+    status.values.push_back(key_value(name + " queued bytes", queued_bytes_[i]));
+    if (c.latency_count)
+    {
+      status.values.push_back(key_value(name + " latency mean ms", 1e3 * c.latency_sum / c.latency_count, "%.3f"));
+      status.values.push_back(key_value(name + " latency max ms", 1e3 * c.latency_max, "%.3f"));
+    }
+    c.latency_sum = c.latency_max = 0;
+    c.latency_count = 0;
+  }
+  if (counters_[PRIORITY_CORRECTION].dropped > reported_drops_ && status.level == diagnostic_msgs::DiagnosticStatus::OK)
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = "Corrections were dropped";
+  }
+  reported_drops_ = counters_[PRIORITY_CORRECTION].dropped;
+  msg.status.push_back(status);
+}
@@ -0,0 +1,221 @@
+#include "stream_stats.h"
+#include "diagnostics_util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+StreamStats::StreamStats() :
+  in_error_(false), baudrate_(0), read_buffer_(0), byte_rate_(0)
+{
+  link_.read_calls = 0;
+  link_.bytes = 0;
+  link_.frames = 0;
+  link_.bad_frames = 0;
+  link_.resyncs = 0;
+  link_.syscalls = 0;
+  link_.truncated = 0;
+  link_.max_read = 0;
+  for (int i = 0; i < STATS_MAX_DID; i++)
+  {
+    did_[i].frames = 0;
+    did_[i].bytes = 0;
+    did_[i].dropped = 0;
+    did_[i].expected_period = 0.0;
+    did_[i].min_period = 0.0;
+    did_[i].last_time = -1.0;
+  }
+  memset(&last_, 0, sizeof(last_));
+}
+
+void StreamStats::set_expected_period(uint32_t did, double period_s)
+{
+  if (did < STATS_MAX_DID)
+    did_[did].expected_period.store(period_s, std::memory_order_relaxed);
+}
+
+void StreamStats::add_frame(uint32_t did, uint32_t bytes, const uint8_t* data)
+{
+  inc(link_.frames, 1);
+  if (in_error_)
+  {
+    // First good frame after a checksum failure means the parser found its way back
+    inc(link_.resyncs, 1);
+    in_error_ = false;
+  }
+  if (did >= STATS_MAX_DID)
+    return;
+
+  did_counters_t& d = did_[did];
+  inc(d.frames, 1);
+  inc(d.bytes, bytes);
+
+  double t = device_time(did, data);
+  if (t < 0)
+    return;
+  double dt = t - d.last_time;
+  if (d.last_time >= 0 && dt > 0 && dt < 10.0) // larger jumps are device resets or week rollovers
+  {
+    double min_period = d.min_period.load(std::memory_order_relaxed);
+    if (dt > 0.0005 && (min_period == 0 || dt < min_period))
+      d.min_period.store(min_period = dt, std::memory_order_relaxed);
+
+    double period = d.expected_period.load(std::memory_order_relaxed);
+    if (period <= 0)
+      period = min_period;
+    if (period > 0 && dt > 1.5 * period)
+      inc(d.dropped, (uint64_t)(lround(dt / period) - 1));
+  }
+  d.last_time = t;
+}
+
+double StreamStats::device_time(uint32_t did, const uint8_t* data)
+{
+  switch (did)
+  {
+  case DID_INS_1:             return ((const ins_1_t*)data)->timeOfWeek;
+  case DID_INS_2:             return ((const ins_2_t*)data)->timeOfWeek;
+  case DID_INL2_VARIANCE:     return ((const inl2_variance_t*)data)->timeOfWeek;
+  case DID_DUAL_IMU:          return ((const dual_imu_t*)data)->time;
+  case DID_PREINTEGRATED_IMU: return ((const preintegrated_imu_t*)data)->time;
+  case DID_GPS_NAV:           return ((const gps_nav_t*)data)->timeOfWeekMs * 1e-3;
+  case DID_GPS1_SAT:          return ((const gps_sat_t*)data)->timeOfWeekMs * 1e-3;
+  case DID_MAGNETOMETER_1:
+  case DID_MAGNETOMETER_2:    return ((const magnetometer_t*)data)->time;
+  case DID_BAROMETER:         return ((const barometer_t*)data)->time;
+  default:                    return -1.0; // strobes are event driven, so gaps aren't drops
+  }
+}
+
+std::string StreamStats::did_name(uint32_t did)
+{
+  switch (did)
+  {
+  case DID_FLASH_CONFIG:      return "DID_FLASH_CONFIG";
+  case DID_INS_1:             return "DID_INS_1";
+  case DID_INS_2:             return "DID_INS_2";
+  case DID_INL2_VARIANCE:     return "DID_INL2_VARIANCE";
+  case DID_DUAL_IMU:          return "DID_DUAL_IMU";
+  case DID_PREINTEGRATED_IMU: return "DID_PREINTEGRATED_IMU";
+  case DID_GPS_NAV:           return "DID_GPS_NAV";
+  case DID_GPS1_SAT:          return "DID_GPS1_SAT";
+  case DID_MAGNETOMETER_1:    return "DID_MAGNETOMETER_1";
+  case DID_MAGNETOMETER_2:    return "DID_MAGNETOMETER_2";
+  case DID_BAROMETER:         return "DID_BAROMETER";
+  case DID_STROBE_IN_TIME:    return "DID_STROBE_IN_TIME";
+  default:                    return "DID_" + std::to_string(did);
+  }
+}
+
+void StreamStats::fill_diagnostics(diagnostic_msgs::DiagnosticArray& msg, const std::string& hardware_id, double dt)
+{
+  if (dt <= 0)
+    return;
+
+  snapshot_t now;
+  now.read_calls = link_.read_calls.load(std::memory_order_relaxed);
+  now.bytes = link_.bytes.load(std::memory_order_relaxed);
+  now.frames = link_.frames.load(std::memory_order_relaxed);
+  now.bad_frames = link_.bad_frames.load(std::memory_order_relaxed);
+  now.resyncs = link_.resyncs.load(std::memory_order_relaxed);
+  now.syscalls = link_.syscalls.load(std::memory_order_relaxed);
+  now.truncated = link_.truncated.load(std::memory_order_relaxed);
+  uint64_t reads = now.read_calls - last_.read_calls;
+
+  // Link as a whole
+  double byte_rate = (now.bytes - last_.bytes) / dt;
+  byte_rate_ = byte_rate;
+  uint64_t new_bad = now.bad_frames - last_.bad_frames;
+  double utilization = baudrate_ > 0 ? 100.0 * byte_rate * 10.0 / baudrate_ : 0.0; // 8N1 is 10 bits per byte
+
+  diagnostic_msgs::DiagnosticStatus link;
+  link.name = "inertial_sense: link";
+  link.hardware_id = hardware_id;
+  if (now.bytes == last_.bytes)
+  {
+    link.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+    link.message = "No data from uINS";
+  }
+  else if (new_bad > 0)
+  {
+    link.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    link.message = "Checksum failures";
+  }
+  else if (now.truncated > last_.truncated)
+  {
+    link.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    link.message = "UDP datagrams too large, dropped";
+  }
+  else if (utilization > 90.0)
+  {
+    link.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    link.message = "Serial link near saturation";
+  }
+  else
+  {
+    link.level = diagnostic_msgs::DiagnosticStatus::OK;
+    link.message = "OK";
+  }
+  link.values.push_back(key_value("bytes/s", byte_rate, "%.0f"));
+  link.values.push_back(key_value("utilization %", utilization, "%.1f"));
+  link.values.push_back(key_value("baudrate", baudrate_, "%.0f"));
+  link.values.push_back(key_value("frames/s", (now.frames - last_.frames) / dt, "%.1f"));
+  link.values.push_back(key_value("reads/s", reads / dt, "%.1f"));
+  link.values.push_back(key_value("syscalls/s", (reads + now.syscalls - last_.syscalls) / dt, "%.1f"));
+  link.values.push_back(key_value("mean read bytes", reads ? (double)(now.bytes - last_.bytes) / reads : 0.0, "%.1f"));
+  link.values.push_back(key_value("max read bytes", link_.max_read.exchange(0, std::memory_order_relaxed), "%.0f"));
+  link.values.push_back(key_value("read buffer bytes", read_buffer_.load(std::memory_order_relaxed), "%.0f"));
+  link.values.push_back(key_value("checksum failures", new_bad, "%.0f"));
+  link.values.push_back(key_value("checksum failures total", now.bad_frames, "%.0f"));
+  link.values.push_back(key_value("resyncs total", now.resyncs, "%.0f"));
+  if (now.truncated)
+    link.values.push_back(key_value("truncated datagrams total", now.truncated, "%.0f"));
+  msg.status.push_back(link);
+
+  // Each DID that has shown up
+  for (uint32_t did = 0; did < STATS_MAX_DID; did++)
+  {
+    const did_counters_t& d = did_[did];
+    now.did_frames[did] = d.frames.load(std::memory_order_relaxed);
+    now.did_dropped[did] = d.dropped.load(std::memory_order_relaxed);
+    if (now.did_frames[did] == 0)
+      continue;
+
+    double rate = (now.did_frames[did] - last_.did_frames[did]) / dt;
+    uint64_t dropped = now.did_dropped[did] - last_.did_dropped[did];
+    double expected_period = d.expected_period.load(std::memory_order_relaxed);
+    double expected_rate = expected_period > 0 ? 1.0 / expected_period : 0.0;
+    double min_period = d.min_period.load(std::memory_order_relaxed);
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "inertial_sense: " + did_name(did);
+    status.hardware_id = hardware_id;
+    if (expected_rate > 0 && rate < 0.9 * expected_rate)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Rate below expected";
+    }
+    else if (dropped > 0)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Dropped frames";
+    }
+    else
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = "OK";
+    }
+    status.values.push_back(key_value("rate Hz", rate, "%.1f"));
+    if (expected_rate > 0)
+      status.values.push_back(key_value("expected rate Hz", expected_rate, "%.1f"));
+    else if (min_period > 0)
+      status.values.push_back(key_value("observed max rate Hz", 1.0 / min_period, "%.1f"));
+    status.values.push_back(key_value("bytes/frame", (double)d.bytes.load(std::memory_order_relaxed) / now.did_frames[did], "%.1f"));
+    status.values.push_back(key_value("dropped", dropped, "%.0f"));
+    status.values.push_back(key_value("dropped total", now.did_dropped[did], "%.0f"));
+    status.values.push_back(key_value("frames total", now.did_frames[did], "%.0f"));
+    msg.status.push_back(status);
+  }
+
+  last_ = now;
+}
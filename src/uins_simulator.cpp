@@ -0,0 +1,819 @@
+#include "uins_simulator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+
+#define SIM_GPS_WEEK 2000
+#define SIM_TOW_START 300000.0 // seconds into the GPS week at simulator start
+#define SIM_MAX_TX_QUEUE 65536 // bytes the "device" buffers before it starts dropping frames
+#define SIM_DEG2RAD (M_PI / 180.0)
+
+namespace
+{
+
+uint32_t did_size(uint32_t did)
+{
+  switch (did)
+  {
+  case DID_INS_1:             return sizeof(ins_1_t);
+  case DID_INS_2:             return sizeof(ins_2_t);
+  case DID_DUAL_IMU:          return sizeof(dual_imu_t);
+  case DID_PREINTEGRATED_IMU: return sizeof(preintegrated_imu_t);
+  case DID_GPS_NAV:           return sizeof(gps_nav_t);
+  case DID_GPS1_SAT:          return sizeof(gps_sat_t);
+  case DID_MAGNETOMETER_1:
+  case DID_MAGNETOMETER_2:    return sizeof(magnetometer_t);
+  case DID_BAROMETER:         return sizeof(barometer_t);
+  case DID_STROBE_IN_TIME:    return sizeof(strobe_in_time_t);
+  case DID_INL2_VARIANCE:     return sizeof(inl2_variance_t);
+  case DID_FLASH_CONFIG:      return sizeof(nvm_flash_cfg_t);
+  case DID_MAG_CAL:           return sizeof(mag_cal_t);
+  case DID_ASCII_BCAST_PERIOD: return sizeof(ascii_msgs_t);
+  default:                    return 0;
+  }
+}
+
+} // namespace
+
+UINSSimulator::UINSSimulator(const options_t& options) :
+  options_(options), master_fd_(-1), slave_fd_(-1), listen_fd_(-1), udp_(false), peer_len_(0), fixed_peer_(false),
+  running_(false),
+  reset_until_(0), start_(0), tx_budget_(0), tx_last_(0), pkt_counter_(0),
+  replay_pos_(0), rng_(12345), uniform_(0.0, 1.0), noise_(0.0, 1.0),
+  bytes_written_(0), frames_written_(0)
+{
+  memset(&flash_, 0, sizeof(flash_));
+  flash_.size = sizeof(nvm_flash_cfg_t);
+  flash_.startupImuDtMs = 1;
+  flash_.startupNavDtMs = 10;
+  flash_.ser0BaudRate = options_.baudrate;
+  flash_.ser1BaudRate = 115200;
+  flash_.insDynModel = 8;
+  flash_.refLla[0] = 40.25;
+  flash_.refLla[1] = -111.67;
+  flash_.refLla[2] = 1556.59;
+  memset(&mag_cal_, 0, sizeof(mag_cal_));
+  memset(&ascii_, 0, sizeof(ascii_));
+
+  // Default rates of each stream when requested with a period multiple of 1 (0 = tied to navigation rate)
+  const uint32_t stream_table[][2] = {
+    { DID_INS_1, 0 },
+    { DID_INS_2, 0 },
+    { DID_DUAL_IMU, 0 },
+    { DID_PREINTEGRATED_IMU, 0 },
+    { DID_INL2_VARIANCE, 0 },
+    { DID_GPS_NAV, 200 },
+    { DID_GPS1_SAT, 1000 },
+    { DID_MAGNETOMETER_1, 20 },
+    { DID_MAGNETOMETER_2, 20 },
+    { DID_BAROMETER, 20 },
+    { DID_STROBE_IN_TIME, 1000 },
+  };
+  for (size_t i = 0; i < sizeof(stream_table) / sizeof(stream_table[0]); i++)
+  {
+    stream_t s = { stream_table[i][0], stream_table[i][1], 0, 0, 0 };
+    streams_.push_back(s);
+  }
+}
+
+UINSSimulator::~UINSSimulator()
+{
+  close();
+}
+
+bool UINSSimulator::open()
+{
+  if (!options_.listen.empty())
+  {
+    if (!open_network())
+      return false;
+  }
+  else
+  {
+    master_fd_ = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd_ < 0 || grantpt(master_fd_) != 0 || unlockpt(master_fd_) != 0)
+    {
+      fprintf(stderr, "uins_simulator: unable to create pseudo-terminal: %s\n", strerror(errno));
+      return false;
+    }
+    slave_name_ = ptsname(master_fd_);
+
+    // Hold the slave open ourselves so the master never sees a hangup between node restarts
+    slave_fd_ = ::open(slave_name_.c_str(), O_RDWR | O_NOCTTY);
+    if (slave_fd_ < 0)
+    {
+      fprintf(stderr, "uins_simulator: unable to open \"%s\": %s\n", slave_name_.c_str(), strerror(errno));
+      return false;
+    }
+    struct termios tty;
+    tcgetattr(slave_fd_, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave_fd_, TCSANOW, &tty);
+    fcntl(master_fd_, F_SETFL, fcntl(master_fd_, F_GETFL) | O_NONBLOCK);
+
+    if (!options_.link.empty())
+    {
+      unlink(options_.link.c_str());
+      if (symlink(slave_name_.c_str(), options_.link.c_str()) != 0)
+      {
+        fprintf(stderr, "uins_simulator: unable to link \"%s\" -> \"%s\": %s\n",
+                options_.link.c_str(), slave_name_.c_str(), strerror(errno));
+        return false;
+      }
+    }
+  }
+
+  if (!options_.replay_file.empty())
+  {
+    std::ifstream file(options_.replay_file.c_str(), std::ios::binary);
+    if (!file)
+    {
+      fprintf(stderr, "uins_simulator: unable to read replay file \"%s\"\n", options_.replay_file.c_str());
+      return false;
+    }
+    replay_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  start_ = 0;
+  start_ = now();
+  tx_last_ = 0;
+  running_ = true;
+  return true;
+}
+
+void UINSSimulator::close()
+{
+  if (!options_.link.empty() && slave_fd_ >= 0)
+    unlink(options_.link.c_str());
+  if (slave_fd_ >= 0)
+    ::close(slave_fd_);
+  if (master_fd_ >= 0)
+    ::close(master_fd_);
+  if (listen_fd_ >= 0)
+    ::close(listen_fd_);
+  slave_fd_ = master_fd_ = listen_fd_ = -1;
+}
+
+bool UINSSimulator::open_network()
+{
+  // tcp://host:port or udp://host:port[?local=port], the same urls the node takes
+  std::string url = options_.listen;
+  udp_ = url.compare(0, 6, "udp://") == 0;
+  if (!udp_ && url.compare(0, 6, "tcp://") != 0)
+  {
+    fprintf(stderr, "uins_simulator: \"%s\" must start with tcp:// or udp://\n", url.c_str());
+    return false;
+  }
+  std::string address = url.substr(6), local;
+  size_t query = address.find("?local=");
+  if (query != std::string::npos)
+  {
+    local = address.substr(query + 7);
+    address = address.substr(0, query);
+  }
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos)
+  {
+    fprintf(stderr, "uins_simulator: no port in \"%s\"\n", url.c_str());
+    return false;
+  }
+  std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+  if (host.size() >= 2 && host[0] == '[')
+    host = host.substr(1, host.size() - 2);
+
+  struct addrinfo hints, *res = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = udp_ ? SOCK_DGRAM : SOCK_STREAM;
+  int family = AF_UNSPEC;
+  if (udp_ && !host.empty())
+  {
+    // udp://host:port sends to host:port and listens on ?local=
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+    {
+      fprintf(stderr, "uins_simulator: unable to resolve \"%s\"\n", url.c_str());
+      return false;
+    }
+    memcpy(&peer_, res->ai_addr, res->ai_addrlen);
+    peer_len_ = res->ai_addrlen;
+    fixed_peer_ = true;
+    family = res->ai_family;
+    freeaddrinfo(res);
+    host.clear();
+    port = local.empty() ? port : local;
+  }
+
+  hints.ai_family = family;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res) != 0)
+  {
+    fprintf(stderr, "uins_simulator: unable to resolve \"%s\"\n", url.c_str());
+    return false;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
+  int one = 1;
+  if (fd >= 0)
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) != 0 || (!udp_ && listen(fd, 1) != 0))
+  {
+    fprintf(stderr, "uins_simulator: unable to listen on \"%s\": %s\n", url.c_str(), strerror(errno));
+    if (fd >= 0)
+      ::close(fd);
+    freeaddrinfo(res);
+    return false;
+  }
+  freeaddrinfo(res);
+
+  if (udp_)
+    master_fd_ = fd;
+  else
+    listen_fd_ = fd;
+  slave_name_ = url;
+  return true;
+}
+
+int UINSSimulator::read_input(uint8_t* buf, int len)
+{
+  if (!udp_)
+  {
+    int n = read(master_fd_, buf, len);
+    if (n == 0 && listen_fd_ >= 0)
+    {
+      // TCP client went away, wait for the next one
+      if (options_.verbose)
+        printf("uins_simulator: client disconnected\n");
+      ::close(master_fd_);
+      master_fd_ = -1;
+      rx_.clear();
+    }
+    return n;
+  }
+
+  struct sockaddr_storage from;
+  socklen_t from_len = sizeof(from);
+  int n = recvfrom(master_fd_, buf, len, 0, (struct sockaddr*)&from, &from_len);
+  if (n > 0 && !fixed_peer_)
+  {
+    peer_ = from;
+    peer_len_ = from_len;
+  }
+  return n;
+}
+
+int UINSSimulator::write_output(const uint8_t* buf, int len)
+{
+  if (master_fd_ < 0)
+    return 0;
+  if (!udp_)
+    return write(master_fd_, buf, len);
+  if (peer_len_ == 0)
+    return len; // nobody has said hello yet, the output is lost like on a radio
+  return sendto(master_fd_, buf, len, MSG_DONTWAIT, (struct sockaddr*)&peer_, peer_len_);
+}
+
+double UINSSimulator::now() const
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9 - start_;
+}
+
+bool UINSSimulator::stalled(double t) const
+{
+  if (options_.stall_period_ms <= 0 || options_.stall_ms <= 0)
+    return false;
+  double period = options_.stall_period_ms * 1e-3;
+  return std::fmod(t, period) >= period - options_.stall_ms * 1e-3;
+}
+
+void UINSSimulator::run()
+{
+  while (running_)
+    spin_once(1);
+}
+
+void UINSSimulator::spin_once(int timeout_ms)
+{
+  struct pollfd pfd;
+  pfd.fd = master_fd_ >= 0 ? master_fd_ : listen_fd_;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN))
+  {
+    if (master_fd_ < 0)
+    {
+      master_fd_ = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      int one = 1;
+      if (master_fd_ >= 0)
+        setsockopt(master_fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if (master_fd_ >= 0 && options_.verbose)
+        printf("uins_simulator: client connected\n");
+    }
+    else
+    {
+      uint8_t buf[2048];
+      int n = read_input(buf, sizeof(buf));
+      if (n > 0)
+        handle_rx(buf, n);
+    }
+  }
+
+  if (now() >= reset_until_)
+  {
+    if (replay_.empty())
+      emit_due_streams();
+    else
+      emit_replay();
+  }
+  flush_output();
+}
+
+void UINSSimulator::handle_rx(const uint8_t* buf, int len)
+{
+  if (now() < reset_until_)
+    return; // still rebooting
+  for (int i = 0; i < len; i++)
+  {
+    if (buf[i] == PSC_START_BYTE)
+      rx_.clear();
+    rx_.push_back(buf[i]);
+    if (buf[i] == PSC_END_BYTE && rx_.front() == PSC_START_BYTE)
+    {
+      handle_packet(rx_.data(), rx_.size());
+      rx_.clear();
+    }
+    else if (rx_.size() > PKT_BUF_SIZE)
+    {
+      rx_.clear();
+    }
+  }
+}
+
+void UINSSimulator::handle_packet(uint8_t* buf, int len)
+{
+  packet_t pkt;
+  if (is_decode_binary_packet(&pkt, buf, len) != 0)
+  {
+    if (options_.verbose)
+      fprintf(stderr, "uins_simulator: dropped malformed request (%d bytes)\n", len);
+    return;
+  }
+
+  switch (pkt.hdr.pid)
+  {
+  case PID_GET_DATA:
+    if (pkt.body.size >= sizeof(p_data_get_t))
+      handle_get_data((p_data_get_t*)pkt.body.ptr);
+    break;
+  case PID_SET_DATA:
+    if (pkt.body.size >= sizeof(p_data_hdr_t))
+      handle_set_data((p_data_hdr_t*)pkt.body.ptr, pkt.body.ptr + sizeof(p_data_hdr_t));
+    break;
+  case PID_STOP_ALL_BROADCASTS:
+    stop_streams();
+    break;
+  default:
+    break;
+  }
+}
+
+void UINSSimulator::handle_get_data(const p_data_get_t* req)
+{
+  if (options_.verbose)
+    fprintf(stderr, "uins_simulator: get DID %u period multiple %u\n", req->id, req->bc_period_multiple);
+
+  if (req->id == DID_FLASH_CONFIG || req->id == DID_MAG_CAL || req->id == DID_ASCII_BCAST_PERIOD)
+  {
+    const void* data = (req->id == DID_FLASH_CONFIG) ? (const void*)&flash_ :
+                       (req->id == DID_MAG_CAL) ? (const void*)&mag_cal_ : (const void*)&ascii_;
+    uint32_t size = did_size(req->id);
+    uint32_t offset = std::min(req->offset, size);
+    uint32_t count = (req->size == 0) ? size - offset : std::min(req->size, size - offset);
+    send_data(req->id, (const uint8_t*)data + offset, count, offset, 0);
+    return;
+  }
+
+  stream_t* s = find_stream(req->id);
+  if (s == NULL)
+    return;
+  if (req->bc_period_multiple == 0)
+  {
+    // one shot, which also stops it streaming
+    s->period_ms = 0;
+    uint8_t buf[PKT_BUF_SIZE];
+    send_data(s->did, buf, synthesize(s->did, now(), buf), 0, s->seq++);
+    return;
+  }
+  uint32_t base = s->base_period_ms ? s->base_period_ms : flash_.startupNavDtMs;
+  s->period_ms = base * req->bc_period_multiple;
+  s->next_due = now();
+}
+
+void UINSSimulator::handle_set_data(const p_data_hdr_t* hdr, const uint8_t* data)
+{
+  if (options_.verbose)
+    fprintf(stderr, "uins_simulator: set DID %u offset %u size %u\n", hdr->id, hdr->offset, hdr->size);
+
+  switch (hdr->id)
+  {
+  case DID_FLASH_CONFIG:
+    if (hdr->offset + hdr->size <= sizeof(flash_))
+      memcpy((uint8_t*)&flash_ + hdr->offset, data, hdr->size);
+    break;
+
+  case DID_RMC:
+    if (hdr->offset == 0 && hdr->size >= sizeof(uint64_t))
+      set_rmc(((const rmc_t*)data)->bits);
+    break;
+
+  case DID_CONFIG:
+    if (hdr->offset == offsetof(config_t, system) && hdr->size >= sizeof(uint32_t)
+        && *(const uint32_t*)data == 99)
+      reset_device();
+    break;
+
+  case DID_MAG_CAL:
+    if (hdr->offset + hdr->size <= sizeof(mag_cal_))
+    {
+      memcpy((uint8_t*)&mag_cal_ + hdr->offset, data, hdr->size);
+      mag_cal_.progress = 0;
+      send_data(DID_MAG_CAL, &mag_cal_, sizeof(mag_cal_), 0, 0);
+    }
+    break;
+
+  case DID_ASCII_BCAST_PERIOD:
+    if (hdr->offset + hdr->size <= sizeof(ascii_))
+      memcpy((uint8_t*)&ascii_ + hdr->offset, data, hdr->size);
+    break;
+
+  default:
+    break;
+  }
+}
+
+void UINSSimulator::set_rmc(uint64_t bits)
+{
+  const struct { uint64_t bit; uint32_t did; } rmc_table[] = {
+    { RMC_BITS_INS1, DID_INS_1 },
+    { RMC_BITS_INS2, DID_INS_2 },
+    { RMC_BITS_DUAL_IMU, DID_DUAL_IMU },
+    { RMC_BITS_PREINTEGRATED_IMU, DID_PREINTEGRATED_IMU },
+    { RMC_BITS_BAROMETER, DID_BAROMETER },
+    { RMC_BITS_MAGNETOMETER1, DID_MAGNETOMETER_1 },
+    { RMC_BITS_MAGNETOMETER2, DID_MAGNETOMETER_2 },
+    { RMC_BITS_GPS_NAV, DID_GPS_NAV },
+    { RMC_BITS_GPS1_SAT, DID_GPS1_SAT },
+    { RMC_BITS_STROBE_IN_TIME, DID_STROBE_IN_TIME },
+  };
+  for (size_t i = 0; i < sizeof(rmc_table) / sizeof(rmc_table[0]); i++)
+  {
+    stream_t* s = find_stream(rmc_table[i].did);
+    if (!(bits & rmc_table[i].bit))
+    {
+      s->period_ms = 0;
+      continue;
+    }
+    s->period_ms = s->base_period_ms ? s->base_period_ms : flash_.startupNavDtMs;
+    s->next_due = now();
+  }
+}
+
+void UINSSimulator::stop_streams()
+{
+  for (size_t i = 0; i < streams_.size(); i++)
+    streams_[i].period_ms = 0;
+}
+
+void UINSSimulator::reset_device()
+{
+  if (options_.verbose)
+    fprintf(stderr, "uins_simulator: reset, silent for %d ms\n", options_.reset_ms);
+  stop_streams();
+  tx_.clear();
+  memset(&mag_cal_, 0, sizeof(mag_cal_));
+  reset_until_ = now() + options_.reset_ms * 1e-3;
+}
+
+UINSSimulator::stream_t* UINSSimulator::find_stream(uint32_t did)
+{
+  for (size_t i = 0; i < streams_.size(); i++)
+  {
+    if (streams_[i].did == did)
+      return &streams_[i];
+  }
+  return NULL;
+}
+
+double UINSSimulator::override_hz(uint32_t did) const
+{
+  switch (did)
+  {
+  case DID_INS_1:
+  case DID_INS_2:
+  case DID_INL2_VARIANCE:     return options_.ins_hz;
+  case DID_DUAL_IMU:
+  case DID_PREINTEGRATED_IMU: return options_.imu_hz;
+  case DID_GPS_NAV:           return options_.gps_hz;
+  case DID_GPS1_SAT:          return options_.sat_hz;
+  case DID_MAGNETOMETER_1:
+  case DID_MAGNETOMETER_2:    return options_.mag_hz;
+  case DID_BAROMETER:         return options_.baro_hz;
+  case DID_STROBE_IN_TIME:    return options_.strobe_hz;
+  default:                    return 0;
+  }
+}
+
+void UINSSimulator::emit_due_streams()
+{
+  double t = now();
+  uint8_t buf[PKT_BUF_SIZE];
+  for (size_t i = 0; i < streams_.size(); i++)
+  {
+    stream_t& s = streams_[i];
+    if (s.period_ms == 0 || t < s.next_due)
+      continue;
+
+    double hz = override_hz(s.did);
+    double period = (hz > 0) ? 1.0 / hz : s.period_ms * 1e-3;
+    s.next_due += period;
+    if (s.next_due < t)
+      s.next_due = t + period; // fell behind (e.g. during a stall), don't burst to catch up
+
+    send_data(s.did, buf, synthesize(s.did, t, buf), 0, s.seq++);
+  }
+}
+
+void UINSSimulator::emit_replay()
+{
+  if (!tx_.empty())
+    return;
+  size_t count = std::min<size_t>(256, replay_.size() - replay_pos_);
+  out_frame_t frame;
+  frame.bytes.assign(replay_.begin() + replay_pos_, replay_.begin() + replay_pos_ + count);
+  frame.pos = 0;
+  frame.did = DID_NULL;
+  frame.seq = 0;
+  tx_.push_back(frame);
+  replay_pos_ = (replay_pos_ + count) % replay_.size();
+}
+
+uint32_t UINSSimulator::synthesize(uint32_t did, double t, uint8_t* buf)
+{
+  // Vehicle drives a 50 m circle around the reference point at 5 m/s
+  double tow = SIM_TOW_START + t;
+  double radius = 50.0, speed = 5.0;
+  double yaw_rate = speed / radius;
+  double yaw = std::fmod(yaw_rate * t, 2.0 * M_PI);
+  double north = radius * std::sin(yaw), east = radius * (1.0 - std::cos(yaw));
+  double lat = flash_.refLla[0] + north / 111111.0;
+  double lon = flash_.refLla[1] + east / (111111.0 * std::cos(flash_.refLla[0] * SIM_DEG2RAD));
+
+  uint32_t size = did_size(did);
+  memset(buf, 0, size);
+  switch (did)
+  {
+  case DID_INS_1:
+  {
+    ins_1_t* m = (ins_1_t*)buf;
+    m->week = SIM_GPS_WEEK;
+    m->timeOfWeek = tow;
+    m->insStatus = INS_STATUS_NAV_MODE;
+    m->theta[2] = yaw;
+    m->uvw[0] = speed;
+    m->lla[0] = lat;
+    m->lla[1] = lon;
+    m->lla[2] = flash_.refLla[2];
+    m->ned[0] = north;
+    m->ned[1] = east;
+    break;
+  }
+  case DID_INS_2:
+  {
+    ins_2_t* m = (ins_2_t*)buf;
+    m->week = SIM_GPS_WEEK;
+    m->timeOfWeek = tow;
+    m->insStatus = INS_STATUS_NAV_MODE;
+    m->qn2b[0] = std::cos(yaw / 2.0);
+    m->qn2b[3] = std::sin(yaw / 2.0);
+    m->uvw[0] = speed;
+    m->lla[0] = lat;
+    m->lla[1] = lon;
+    m->lla[2] = flash_.refLla[2];
+    break;
+  }
+  case DID_DUAL_IMU:
+  {
+    dual_imu_t* m = (dual_imu_t*)buf;
+    m->time = t;
+    for (int i = 0; i < 2; i++)
+    {
+      for (int j = 0; j < 3; j++)
+      {
+        m->I[i].pqr[j] = 0.002 * noise_(rng_);
+        m->I[i].acc[j] = 0.02 * noise_(rng_);
+      }
+      m->I[i].pqr[2] += yaw_rate;
+      m->I[i].acc[1] += speed * yaw_rate;
+      m->I[i].acc[2] -= 9.80665;
+    }
+    break;
+  }
+  case DID_PREINTEGRATED_IMU:
+  {
+    preintegrated_imu_t* m = (preintegrated_imu_t*)buf;
+    m->time = t;
+    m->dt = flash_.startupNavDtMs * 1e-3;
+    m->theta1[2] = m->theta2[2] = yaw_rate * m->dt;
+    m->vel1[1] = m->vel2[1] = speed * yaw_rate * m->dt;
+    m->vel1[2] = m->vel2[2] = -9.80665 * m->dt;
+    break;
+  }
+  case DID_INL2_VARIANCE:
+  {
+    inl2_variance_t* m = (inl2_variance_t*)buf;
+    m->timeOfWeek = tow;
+    for (int i = 0; i < 3; i++)
+    {
+      m->PxyzNED[i] = 0.25;
+      m->PvelNED[i] = 0.01;
+      m->PattNED[i] = 1e-4;
+      m->PABias[i] = 1e-3;
+      m->PWBias[i] = 1e-6;
+    }
+    break;
+  }
+  case DID_GPS_NAV:
+  {
+    gps_nav_t* m = (gps_nav_t*)buf;
+    m->timeOfWeekMs = (uint32_t)(tow * 1000.0);
+    m->week = SIM_GPS_WEEK;
+    m->status = GPS_STATUS_FIX_3D | 12;
+    m->cnoMean = 45;
+    m->lla[0] = lat;
+    m->lla[1] = lon;
+    m->lla[2] = flash_.refLla[2];
+    m->hMSL = flash_.refLla[2] - 15.0;
+    m->hAcc = 0.8f;
+    m->vAcc = 1.2f;
+    m->pDop = 1.1f;
+    m->velNed[0] = speed * std::cos(yaw);
+    m->velNed[1] = speed * std::sin(yaw);
+    m->towOffset = SIM_TOW_START;
+    break;
+  }
+  case DID_GPS1_SAT:
+  {
+    gps_sat_t* m = (gps_sat_t*)buf;
+    m->timeOfWeekMs = (uint32_t)(tow * 1000.0);
+    m->numSats = 12;
+    for (uint32_t i = 0; i < m->numSats; i++)
+    {
+      m->sat[i].svId = i * 2 + 1;
+      m->sat[i].cno = (uint8_t)(40 + 5 * std::sin(0.01 * t + i) + noise_(rng_));
+      m->sat[i].elev = (int8_t)(10 + 6 * i);
+      m->sat[i].azim = (int16_t)(30 * i);
+    }
+    break;
+  }
+  case DID_MAGNETOMETER_1:
+  case DID_MAGNETOMETER_2:
+  {
+    magnetometer_t* m = (magnetometer_t*)buf;
+    m->time = t;
+    m->mag[0] = std::cos(-yaw) + 0.01 * noise_(rng_);
+    m->mag[1] = std::sin(-yaw) + 0.01 * noise_(rng_);
+    m->mag[2] = 2.0 + 0.01 * noise_(rng_);
+    break;
+  }
+  case DID_BAROMETER:
+  {
+    barometer_t* m = (barometer_t*)buf;
+    m->time = t;
+    m->bar = 84.3 + 0.01 * noise_(rng_);
+    m->mslBar = 101.325;
+    m->barTemp = 25.0;
+    break;
+  }
+  case DID_STROBE_IN_TIME:
+  {
+    strobe_in_time_t* m = (strobe_in_time_t*)buf;
+    m->week = SIM_GPS_WEEK;
+    m->timeOfWeekMs = (uint32_t)(tow * 1000.0);
+    m->count = find_stream(did)->seq;
+    break;
+  }
+  default:
+    break;
+  }
+  return size;
+}
+
+int UINSSimulator::encode_data(uint32_t did, const void* data, uint32_t size, uint32_t offset,
+                               uint8_t counter, uint8_t* out, int out_size)
+{
+  uint8_t body[PKT_BUF_SIZE];
+  if (size + sizeof(p_data_hdr_t) > sizeof(body))
+    return 0;
+  p_data_hdr_t* dhdr = (p_data_hdr_t*)body;
+  dhdr->id = did;
+  dhdr->size = size;
+  dhdr->offset = offset;
+  memcpy(body + sizeof(p_data_hdr_t), data, size);
+
+  packet_hdr_t hdr;
+  hdr.startByte = PSC_START_BYTE;
+  hdr.pid = PID_DATA;
+  hdr.counter = counter;
+  hdr.flags = 0;
+  int n = is_encode_binary_packet(body, size + sizeof(p_data_hdr_t), &hdr, 0, out, out_size);
+  return (n > 0) ? n : 0;
+}
+
+void UINSSimulator::send_data(uint32_t did, const void* data, uint32_t size, uint32_t offset, uint32_t seq)
+{
+  uint8_t payload[PKT_BUF_SIZE];
+  if (size > sizeof(payload))
+    return;
+  memcpy(payload, data, size);
+  if (payload_hook_ && offset == 0)
+    payload_hook_(did, seq, payload, size);
+
+  out_frame_t frame;
+  frame.bytes.resize(2 * PKT_BUF_SIZE);
+  int n = encode_data(did, payload, size, offset, pkt_counter_++, frame.bytes.data(), frame.bytes.size());
+  if (n == 0)
+    return;
+  frame.bytes.resize(n);
+  frame.pos = 0;
+  frame.did = did;
+  frame.seq = seq;
+
+  if (options_.byte_error_rate > 0)
+  {
+    for (size_t i = 0; i < frame.bytes.size(); i++)
+    {
+      if (uniform_(rng_) < options_.byte_error_rate)
+        frame.bytes[i] ^= (uint8_t)(1 << (rng_() % 8));
+    }
+  }
+
+  size_t queued = 0;
+  for (size_t i = 0; i < tx_.size(); i++)
+    queued += tx_[i].bytes.size() - tx_[i].pos;
+  if (queued + frame.bytes.size() > SIM_MAX_TX_QUEUE)
+    return; // device output buffer overflow, frame is lost
+
+  tx_.push_back(frame);
+}
+
+void UINSSimulator::flush_output()
+{
+  double t = now();
+  if (options_.baudrate > 0)
+  {
+    // 10 bits per byte on the wire (start + 8 data + stop)
+    tx_budget_ = std::min(tx_budget_ + (t - tx_last_) * options_.baudrate / 10.0, 4096.0);
+  }
+  tx_last_ = t;
+  if (stalled(t))
+    return;
+
+  while (!tx_.empty())
+  {
+    out_frame_t& frame = tx_.front();
+    size_t count = frame.bytes.size() - frame.pos;
+    if (options_.baudrate > 0)
+      count = std::min(count, (size_t)tx_budget_);
+    if (count == 0)
+      return;
+
+    int n = write_output(frame.bytes.data() + frame.pos, count);
+    if (n <= 0)
+      return; // pty or socket buffer full (nobody reading), try again later
+    frame.pos += n;
+    bytes_written_ += n;
+    if (options_.baudrate > 0)
+      tx_budget_ -= n;
+
+    if (frame.pos < frame.bytes.size())
+      return;
+    frames_written_++;
+    if (written_hook_ && frame.did != DID_NULL)
+      written_hook_(frame.did, frame.seq);
+    tx_.pop_front();
+  }
+}
@@ -0,0 +1,112 @@
+#include "uins_simulator.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static UINSSimulator* g_sim = NULL;
+
+static void handle_signal(int sig)
+{
+  (void)sig;
+  if (g_sim)
+    g_sim->stop();
+}
+
+static void usage(const char* name)
+{
+  printf("Usage: %s [options]\n"
+         "Emulates a uINS on a pseudo-terminal.  Point the node's ~port parameter at the printed\n"
+         "device (or at --link) to run it without hardware.\n\n"
+         "  --link PATH             symlink the pty slave to PATH (e.g. /tmp/ttyUINS)\n"
+         "  --listen URL            serve tcp://host:port or udp://host:port[?local=port] instead of a pty\n"
+         "  --baud N                pace output to N baud, 0 for unpaced (default 3000000)\n"
+         "  --replay FILE           stream a raw capture instead of synthetic data\n"
+         "  --ins-hz HZ             override INS_1/INS_2/INL2_VARIANCE rate\n"
+         "  --imu-hz HZ             override DUAL_IMU/PREINTEGRATED_IMU rate\n"
+         "  --gps-hz HZ             override GPS_NAV rate\n"
+         "  --sat-hz HZ             override GPS1_SAT rate\n"
+         "  --mag-hz HZ             override magnetometer rate\n"
+         "  --baro-hz HZ            override barometer rate\n"
+         "  --strobe-hz HZ          override strobe input rate\n"
+         "  --byte-error-rate P     flip a bit in each output byte with probability P\n"
+         "  --stall PERIOD_MS:MS    stop output for MS every PERIOD_MS\n"
+         "  --reset-ms MS           silence after a DID_CONFIG reset (default 1000)\n"
+         "  --verbose               log every request from the host\n", name);
+}
+
+int main(int argc, char** argv)
+{
+  UINSSimulator::options_t options;
+
+  static struct option long_options[] = {
+    { "link", required_argument, 0, 'l' },
+    { "listen", required_argument, 0, 'L' },
+    { "baud", required_argument, 0, 'b' },
+    { "replay", required_argument, 0, 'r' },
+    { "ins-hz", required_argument, 0, 'I' },
+    { "imu-hz", required_argument, 0, 'i' },
+    { "gps-hz", required_argument, 0, 'g' },
+    { "sat-hz", required_argument, 0, 's' },
+    { "mag-hz", required_argument, 0, 'm' },
+    { "baro-hz", required_argument, 0, 'p' },
+    { "strobe-hz", required_argument, 0, 'S' },
+    { "byte-error-rate", required_argument, 0, 'e' },
+    { "stall", required_argument, 0, 't' },
+    { "reset-ms", required_argument, 0, 'R' },
+    { "verbose", no_argument, 0, 'v' },
+    { "help", no_argument, 0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "l:b:r:v", long_options, NULL)) != -1)
+  {
+    switch (c)
+    {
+    case 'l': options.link = optarg; break;
+    case 'L': options.listen = optarg; break;
+    case 'b': options.baudrate = atoi(optarg); break;
+    case 'r': options.replay_file = optarg; break;
+    case 'I': options.ins_hz = atof(optarg); break;
+    case 'i': options.imu_hz = atof(optarg); break;
+    case 'g': options.gps_hz = atof(optarg); break;
+    case 's': options.sat_hz = atof(optarg); break;
+    case 'm': options.mag_hz = atof(optarg); break;
+    case 'p': options.baro_hz = atof(optarg); break;
+    case 'S': options.strobe_hz = atof(optarg); break;
+    case 'e': options.byte_error_rate = atof(optarg); break;
+    case 't':
+      if (sscanf(optarg, "%d:%d", &options.stall_period_ms, &options.stall_ms) != 2)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'R': options.reset_ms = atoi(optarg); break;
+    case 'v': options.verbose = true; break;
+    default:
+      usage(argv[0]);
+      return (c == 'h') ? 0 : 1;
+    }
+  }
+
+  UINSSimulator sim(options);
+  if (!sim.open())
+    return 1;
+  g_sim = &sim;
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  printf("uINS simulator listening on \"%s\"", sim.port().c_str());
+  if (!options.link.empty())
+    printf(" (linked from \"%s\")", options.link.c_str());
+  printf("\n");
+  fflush(stdout);
+
+  sim.run();
+  printf("uINS simulator wrote %llu frames, %llu bytes\n",
+         (unsigned long long)sim.frames_written(), (unsigned long long)sim.bytes_written());
+  return 0;
+}